@@ -4,6 +4,14 @@
 #include "framework.h"
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <ctime>
+#ifdef __linux__ // fej nélküli futás EGL-lel
+#define HEADLESS_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // Keretrendszer �llapota
 static int minorNumber = 3, majorNumber = 3;
@@ -11,8 +19,1069 @@ static int windowWidth = 600, windowHeight = 600;
 static const char *windowCaption = "Grafika";
 static GLFWwindow *window;
 static bool screenRefresh = true;
+static bool partialRefresh = false; // csak a damage téglalap sérült
+static int damage[4];               // x0, y0, x1, y1 ablak képpontban
 static glApp *pApp = nullptr;
 
+// Üresjárat: csak akkor pörgünk, ha animáció fut vagy rajzolni kell
+static int activeAnimations = 0;
+static std::vector<uint64_t> timerDeadlines; // monotonicNanos szerint
+static float frameCpuUtilization = 0;
+
+// Idő: 64 bites nanoszekundum, fej nélkül virtuális
+static uint64_t virtualNanos = 0;
+static bool virtualClock = false; // fej nélkül és visszajátszáskor
+static uint64_t simulationTick = 0; // 0: nincs rögzített lépés
+static uint64_t simulationBacklog = 0;
+static int maxSubsteps = 8;
+static CatchUpPolicy catchUpPolicy = CATCHUP_DROP;
+static float simulationAlpha = 0;
+
+// Fej nélküli futás: ablak helyett FBO, virtuális óra
+static int headlessFrames = 0; // 0: ablakos mód
+static uint64_t headlessFrameTime = 1000000000 / 60;
+static const char *captureDirectory = nullptr;
+static GLuint offscreenFbo = 0; // 0: az ablak puffere
+static const char *profileFile = nullptr;
+static bool renderThreadRequested = false;
+static bool renderThreadAllowed = false; // az alkalmazás vállalta, lásd enableRenderThread
+static bool debugRequested = false;
+static int debugTopCount = 10;
+static GLADloadproc glLoader = nullptr; // a környezet létrejötte után
+
+// Renderszálas módban az alkalmazás szálán a rögzítés alatt álló lista
+static thread_local CommandList *recordingList = nullptr;
+static CommandList immediateCommands(true);
+
+CommandList &glCommands() {
+  return recordingList ? *recordingList : immediateCommands;
+}
+
+static RenderTargetPool renderTargetPool;
+
+RenderTargetPool &renderTargets() { return renderTargetPool; }
+
+//---------------------------
+class TraceBuffer {
+  //---------------------------
+  // Egy szál eseményei. Csak a saját szála ír bele, a kiírás a közzétett
+  // darabszámig olvas, így a rögzítéshez nem kell zár.
+  struct Event {
+    const char *name;
+    uint64_t start, end;
+  };
+  static constexpr int chunkSize = 4096, maxChunks = 256;
+  std::atomic<Event *> chunks[maxChunks] = {};
+  std::atomic<int> count{0};
+
+public:
+  const int thread;
+  std::atomic<const char *> name{nullptr};
+  std::atomic<int> dropped{0};
+
+  TraceBuffer(int _thread) : thread(_thread) {}
+
+  void Add(const char *eventName, uint64_t start, uint64_t end) {
+    int n = count.load(std::memory_order_relaxed);
+    if (n == chunkSize * maxChunks) {
+      dropped++;
+      return;
+    }
+    Event *chunk = chunks[n / chunkSize].load(std::memory_order_relaxed);
+    if (!chunk) {
+      chunk = new Event[chunkSize];
+      chunks[n / chunkSize].store(chunk, std::memory_order_release);
+    }
+    chunk[n % chunkSize] = {eventName, start, end};
+    count.store(n + 1, std::memory_order_release);
+  }
+
+  template <typename F> void ForEach(F f) const {
+    int n = count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+      const Event &event =
+          chunks[i / chunkSize].load(std::memory_order_acquire)[i % chunkSize];
+      f(event.name, event.start, event.end);
+    }
+  }
+};
+
+std::atomic<bool> traceEnabled{false};
+static uint64_t traceOrigin = 0;
+static std::string traceFile = "trace.json";
+static std::mutex traceMutex; // csak új szál felvételekor és kiíráskor
+static std::vector<TraceBuffer *> traceBuffers;
+static thread_local TraceBuffer *traceBuffer = nullptr;
+
+uint64_t traceClock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static TraceBuffer *threadTraceBuffer() {
+  if (!traceBuffer) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceBuffer = new TraceBuffer((int)traceBuffers.size() + 1);
+    traceBuffers.push_back(traceBuffer); // a szál után is megmarad
+  }
+  return traceBuffer;
+}
+
+void traceEvent(const char *name, uint64_t start, uint64_t end) {
+  if (traceEnabled.load(std::memory_order_relaxed))
+    threadTraceBuffer()->Add(name, start, end);
+}
+
+void traceThreadName(const char *name) {
+  threadTraceBuffer()->name.store(name, std::memory_order_release);
+}
+
+void startTracing(const char *file) {
+  traceFile = file;
+  if (traceOrigin == 0)
+    traceOrigin = traceClock();
+  traceEnabled = true;
+}
+
+static void writeJsonString(FILE *file, const char *text) {
+  fputc('"', file);
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\')
+      fputc('\\', file);
+    if ((unsigned char)*text >= ' ')
+      fputc(*text, file);
+  }
+  fputc('"', file);
+}
+
+bool dumpTrace() {
+  if (traceOrigin == 0)
+    return false;
+  FILE *file = fopen(traceFile.c_str(), "w");
+  if (!file) {
+    printf("Cannot open %s\n", traceFile.c_str());
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(traceMutex);
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  int events = 0, dropped = 0;
+  for (const TraceBuffer *buffer : traceBuffers) {
+    const char *name = buffer->name.load(std::memory_order_acquire);
+    if (!name)
+      name = "thread";
+    fprintf(file,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":",
+            buffer->thread);
+    writeJsonString(file, name);
+    fprintf(file, "}}");
+    buffer->ForEach([&](const char *event, uint64_t start, uint64_t end) {
+      if (start < traceOrigin)
+        return;
+      fprintf(file, ",\n{\"name\":");
+      writeJsonString(file, event);
+      fprintf(file,
+              ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              buffer->thread, (start - traceOrigin) * 1e-3,
+              (end - start) * 1e-3);
+      events++;
+    });
+    fprintf(file, buffer == traceBuffers.back() ? "\n" : ",\n");
+    dropped += buffer->dropped;
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  printf("Trace: %d events written to %s", events, traceFile.c_str());
+  if (dropped > 0)
+    printf(", %d dropped", dropped);
+  printf("\n");
+  return true;
+}
+
+//---------------------------
+class FrameCapture {
+  //---------------------------
+  // A hátsó puffer PBO gyűrűbe olvasódik, néhány képkockával később
+  // képezzük le, a kódolás (PNG vagy nyers RGBA, alulról felfelé) a
+  // munkaszálakon fut. Ha a szálak lemaradnak, képkockát dobunk, nem várunk.
+  static constexpr int ringSize = 3;
+  struct Frame {
+    int index, width, height;
+    std::vector<unsigned char> pixels;
+  };
+
+  fs::path directory;
+  CaptureFormat format = CAPTURE_PNG;
+  unsigned int pbo[ringSize] = {};
+  GLsync fence[ringSize] = {};
+  int frameIndex[ringSize] = {}, frameWidth[ringSize] = {},
+      frameHeight[ringSize] = {};
+  int writeIndex = 0, frameCount = 0, dropped = 0, written = 0;
+  double mainThreadTime = 0; // másodperc
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wakeWorker;
+  std::deque<Frame> queue;
+  std::vector<std::vector<unsigned char>> spareBuffers; // újrahasznosítva
+  int maxQueued = 0;
+  unsigned encodeThreads = 1; // egy PNG deflate szálai, a magok a munkaszálak közt osztva
+  bool quit = false;
+
+  void WorkerLoop() {
+    traceThreadName("FrameCapture worker");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wakeWorker.wait(lock, [this] { return quit || !queue.empty(); });
+      if (queue.empty())
+        return;
+      Frame frame = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      bool ok = Write(frame);
+      lock.lock();
+      written += ok;
+      spareBuffers.push_back(std::move(frame.pixels));
+    }
+  }
+
+  bool Write(Frame &frame) {
+    TRACE_SCOPE("FrameCapture::Write");
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06d.%s", frame.index,
+             format == CAPTURE_PNG ? "png" : "rgba");
+    std::string path = (directory / name).string();
+    size_t rowSize = frame.width * 4;
+    if (format == CAPTURE_RAW) {
+      FILE *file = fopen(path.c_str(), "wb");
+      if (!file)
+        return false;
+      size_t size = fwrite(&frame.pixels[0], 1, frame.pixels.size(), file);
+      fclose(file);
+      return size == frame.pixels.size();
+    }
+    std::vector<unsigned char> row(rowSize); // OpenGL alulról felfelé tárol
+    for (int y = 0; y < frame.height / 2; y++) {
+      unsigned char *a = &frame.pixels[y * rowSize];
+      unsigned char *b = &frame.pixels[(frame.height - 1 - y) * rowSize];
+      memcpy(&row[0], a, rowSize);
+      memcpy(a, b, rowSize);
+      memcpy(b, &row[0], rowSize);
+    }
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.encoder.zlibsettings.threads = encodeThreads;
+    // 60 Hz mellett a sebesség számít: egy próbás LZ77, kb. 2x gyorsabb kódolás
+    state.encoder.zlibsettings.level = LCL_FAST;
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    unsigned error = lodepng_encode(&png, &pngSize, &frame.pixels[0],
+                                    frame.width, frame.height, &state);
+    if (!error)
+      error = lodepng_save_file(png, pngSize, path.c_str());
+    free(png);
+    lodepng_state_cleanup(&state);
+    return error == 0;
+  }
+
+  // A legrégebbi kész PBO átadása a munkaszálaknak
+  void Collect(int i, bool wait) {
+    if (!fence[i])
+      return;
+    GLenum state = glClientWaitSync(fence[i], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                    wait ? GL_TIMEOUT_IGNORED : 0);
+    if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+      return;
+    glDeleteSync(fence[i]);
+    fence[i] = 0;
+    Frame frame;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if ((int)queue.size() >= maxQueued) {
+        dropped++;
+        return;
+      }
+      if (!spareBuffers.empty()) {
+        frame.pixels = std::move(spareBuffers.back());
+        spareBuffers.pop_back();
+      }
+    }
+    frame.index = frameIndex[i];
+    frame.width = frameWidth[i];
+    frame.height = frameHeight[i];
+    size_t size = (size_t)frame.width * frame.height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data) {
+      frame.pixels.resize(size);
+      memcpy(&frame.pixels[0], data, size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!data)
+      return;
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(frame));
+    wakeWorker.notify_one();
+  }
+
+public:
+  FrameCapture(const fs::path &_directory, CaptureFormat _format,
+               int workerCount)
+      : directory(_directory), format(_format) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (workerCount <= 0)
+      workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    maxQueued = 2 * workerCount + ringSize;
+    encodeThreads = std::max(1u, std::thread::hardware_concurrency() / workerCount);
+    glGenBuffers(ringSize, pbo);
+    for (int i = 0; i < workerCount; i++)
+      workers.emplace_back(&FrameCapture::WorkerLoop, this);
+  }
+
+  // A megjelenítés után, buffercsere előtt hívandó
+  void Capture(int width, int height) {
+    TRACE_SCOPE("FrameCapture::Capture");
+    auto start = std::chrono::steady_clock::now();
+    int i = writeIndex;
+    Collect(i, true); // csak akkor vár, ha a gyűrű körbeért
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    if (frameWidth[i] != width || frameHeight[i] != height) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL,
+                   GL_STREAM_READ);
+      frameWidth[i] = width;
+      frameHeight[i] = height;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frameIndex[i] = frameCount++;
+    writeIndex = (writeIndex + 1) % ringSize;
+    for (int n = 1; n < ringSize; n++) // a korábbiak közül ami kész
+      Collect((writeIndex + n - 1) % ringSize, false);
+    mainThreadTime += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  }
+
+  ~FrameCapture() {
+    for (int n = 0; n < ringSize; n++)
+      Collect((writeIndex + n) % ringSize, true);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wakeWorker.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+    glDeleteBuffers(ringSize, pbo);
+    printf("Capture %s: %d frames written, %d dropped, %.3f ms/frame on the "
+           "main thread\n",
+           directory.string().c_str(), written, dropped,
+           frameCount ? 1000.0 * mainThreadTime / frameCount : 0.0);
+  }
+};
+static FrameCapture *capture = nullptr;
+
+//---------------------------
+class Profiler {
+  //---------------------------
+  // CPU és GPU mérési pontok. A GPU idők GL_TIME_ELAPSED lekérdezésekből
+  // jönnek, egy gyűrűben, queryFrames képkockával később olvasva, így nincs
+  // várakozás. Egymásba ágyazott GPU mérés nem lehet, a belső csak CPU.
+  static constexpr int queryFrames = 4;
+  static constexpr int window = 128; // gördülő statisztika hossza
+
+  struct Scope {
+    std::string name;
+    float cpu[window] = {}, gpu[window] = {};
+    int cpuCount = 0, gpuCount = 0;
+    bool hasGpu = false;
+  };
+  struct Sample {
+    int scope;
+    uint64_t cpuNanos;
+    int query; // -1: nincs GPU mérés
+  };
+  struct PendingFrame {
+    long long frame = -1;
+    std::vector<Sample> samples;
+    std::vector<GLuint> queries;
+  };
+
+  std::vector<Scope> scopes;
+  std::unordered_map<std::string, int> scopeIds;
+  std::vector<Sample> current;
+  PendingFrame pending[queryFrames];
+  long long frameCount = 0;
+  bool gpuActive = false;
+  FILE *csv = nullptr;
+
+  // kijelzés: egy rajzolási hívás, betűk és sávok egy textúrából
+  bool overlay;
+  GPUProgram overlayProgram;
+  unsigned int vao = 0, vbo = 0, fontTexture = 0;
+  std::vector<float> vertices;
+
+  static float Percentile(const float *values, int count, float p) {
+    std::vector<float> sorted(values, values + count);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::max(0, (int)ceilf(p * count) - 1)];
+  }
+
+  void Record(float *ring, int &count, float value) {
+    ring[count % window] = value;
+    count++;
+  }
+
+  // Egy régi képkocka GPU eredményeinek begyűjtése, ha már elkészültek
+  void Resolve(PendingFrame &frame) {
+    if (frame.frame < 0)
+      return;
+    std::vector<double> gpuMs(frame.samples.size(), -1.0);
+    // az első képkocka GPU ideje bemelegítés (shader fordítás), egyes
+    // meghajtók itt értelmetlen értéket adnak
+    bool ready = frame.frame > 0;
+    for (const Sample &sample : frame.samples)
+      if (sample.query >= 0) {
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[sample.query],
+                           GL_QUERY_RESULT_AVAILABLE, &available);
+        ready &= available != 0;
+      }
+    for (size_t i = 0; ready && i < frame.samples.size(); i++) {
+      const Sample &sample = frame.samples[i];
+      if (sample.query < 0)
+        continue;
+      GLuint64 nanos = 0;
+      glGetQueryObjectui64v(frame.queries[sample.query], GL_QUERY_RESULT,
+                            &nanos);
+      gpuMs[i] = nanos * 1e-6;
+      Scope &scope = scopes[sample.scope];
+      Record(scope.gpu, scope.gpuCount, (float)gpuMs[i]);
+    }
+    if (csv)
+      for (size_t i = 0; i < frame.samples.size(); i++) {
+        const Sample &sample = frame.samples[i];
+        fprintf(csv, "%lld,%s,%.4f,", frame.frame,
+                scopes[sample.scope].name.c_str(), sample.cpuNanos * 1e-6);
+        if (gpuMs[i] >= 0)
+          fprintf(csv, "%.4f", gpuMs[i]);
+        fputc('\n', csv);
+      }
+    frame.frame = -1;
+    frame.samples.clear();
+  }
+
+  void Quad(float x, float y, float w, float h, float u0, float v0, float u1,
+            float v1, vec4 color) {
+    float corners[6][4] = {{x, y, u0, v0},         {x + w, y, u1, v0},
+                           {x + w, y + h, u1, v1}, {x, y, u0, v0},
+                           {x + w, y + h, u1, v1}, {x, y + h, u0, v1}};
+    for (auto &c : corners)
+      vertices.insert(vertices.end(), {c[0], c[1], c[2], c[3], color.x,
+                                       color.y, color.z, color.w});
+  }
+
+  void Bar(float x, float y, float w, float h, vec4 color) {
+    float u = 0.5f / fontGlyphs.size() / 6; // a 0. jel tele van
+    Quad(x, y, w, h, u, 0.5f, u, 0.5f, color);
+  }
+
+  void Text(float x, float y, const std::string &text, vec4 color) {
+    const float scale = 2, cell = 1.0f / fontGlyphs.size();
+    for (char c : text) {
+      size_t glyph = fontGlyphs.find((char)toupper(c));
+      if (glyph != std::string::npos && c != ' ')
+        Quad(x, y, 6 * scale, 8 * scale, glyph * cell, 0, (glyph + 1) * cell,
+             1, color);
+      x += 6 * scale;
+    }
+  }
+
+  void CreateOverlay() {
+    overlayProgram.create(R"(
+      #version 330
+      uniform vec2 viewport;
+      layout(location = 0) in vec4 vertex; // pixel pozíció, textúra koord.
+      layout(location = 1) in vec4 vertexColor;
+      out vec2 uv;
+      out vec4 color;
+      void main() {
+        gl_Position = vec4(vertex.x / viewport.x * 2 - 1,
+                           1 - vertex.y / viewport.y * 2, 0, 1);
+        uv = vertex.zw;
+        color = vertexColor;
+      }
+    )",
+                          R"(
+      #version 330
+      uniform sampler2D font;
+      in vec2 uv;
+      in vec4 color;
+      out vec4 fragmentColor;
+      void main() { fragmentColor = color * texture(font, uv).r; }
+    )");
+    overlayProgram.setLabel("Profiler overlay");
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    labelObject(GL_VERTEX_ARRAY, vao, "Profiler overlay");
+    labelObject(GL_BUFFER, vbo, "Profiler overlay vertices");
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), NULL);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                          (void *)(4 * sizeof(float)));
+
+    // 5x7-es jelek 6x8-as cellákban egymás mellett
+    int width = 6 * (int)fontGlyphs.size();
+    std::vector<unsigned char> atlas(width * 8, 0);
+    for (size_t g = 0; g < fontGlyphs.size(); g++)
+      for (int row = 0; row < 7; row++)
+        for (int col = 0; col < 5; col++)
+          if (fontBitmap[g][row] & (16 >> col))
+            atlas[row * width + g * 6 + col] = 255;
+    for (int row = 0; row < 8; row++) // tele cella a sávokhoz
+      for (int col = 0; col < 6; col++)
+        atlas[row * width + col] = 255;
+    glGenTextures(1, &fontTexture);
+    glBindTexture(GL_TEXTURE_2D, fontTexture);
+    labelObject(GL_TEXTURE, fontTexture, "Profiler font");
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, 8, 0, GL_RED,
+                 GL_UNSIGNED_BYTE, &atlas[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+
+  static const std::string fontGlyphs;
+  static const unsigned char fontBitmap[][7];
+
+public:
+  Profiler(bool _overlay, const char *csvPath) : overlay(_overlay) {
+    if (csvPath) {
+      csv = fopen(csvPath, "w");
+      if (csv)
+        fprintf(csv, "frame,scope,cpu_ms,gpu_ms\n");
+      else
+        printf("Cannot open %s\n", csvPath);
+    }
+    if (overlay)
+      CreateOverlay();
+  }
+
+  int ScopeId(const char *name) {
+    auto it = scopeIds.find(name);
+    if (it != scopeIds.end())
+      return it->second;
+    scopes.emplace_back();
+    scopes.back().name = name;
+    return scopeIds[name] = (int)scopes.size() - 1;
+  }
+
+  // Mérési pont kezdete; a visszaadott index az End paramétere
+  int Begin(const char *name, bool gpu) {
+    Sample sample = {ScopeId(name), 0, -1};
+    // renderszálas módban itt nincs GL környezet, csak CPU mérés lehet
+    if (gpu && !gpuActive && glCommands().Immediate()) {
+      PendingFrame &frame = pending[frameCount % queryFrames];
+      size_t used = 0;
+      for (const Sample &s : current)
+        used += s.query >= 0;
+      if (used == frame.queries.size()) {
+        frame.queries.push_back(0);
+        glGenQueries(1, &frame.queries.back());
+      }
+      sample.query = (int)used;
+      glBeginQuery(GL_TIME_ELAPSED, frame.queries[used]);
+      gpuActive = true;
+    }
+    current.push_back(sample);
+    return (int)current.size() - 1;
+  }
+
+  void End(int index, uint64_t cpuNanos) {
+    Sample &sample = current[index];
+    sample.cpuNanos = cpuNanos;
+    if (sample.query >= 0) {
+      glEndQuery(GL_TIME_ELAPSED);
+      gpuActive = false;
+    }
+  }
+
+  // Kirajzolt képkocka vége: statisztika, CSV, kijelzés
+  void EndFrame(int width, int height) {
+    // ugyanaz a mérési pont többször is előfordulhat egy képkockán
+    std::vector<uint64_t> cpuSum(scopes.size(), 0);
+    for (const Sample &sample : current)
+      cpuSum[sample.scope] += sample.cpuNanos;
+    for (size_t i = 0; i < scopes.size(); i++)
+      if (cpuSum[i] > 0)
+        Record(scopes[i].cpu, scopes[i].cpuCount, cpuSum[i] * 1e-6f);
+    for (const Sample &sample : current)
+      scopes[sample.scope].hasGpu |= sample.query >= 0;
+
+    PendingFrame &frame = pending[frameCount % queryFrames];
+    frame.frame = frameCount++;
+    frame.samples.swap(current);
+    current.clear();
+    Resolve(pending[frameCount % queryFrames]); // a legrégebbi
+    if (overlay && glCommands().Immediate())
+      DrawOverlay(width, height);
+  }
+
+  void DrawOverlay(int width, int height) {
+    vertices.clear();
+    const vec4 white(1, 1, 1, 1), cpuColor(0.3f, 0.9f, 0.3f, 1),
+        gpuColor(1, 0.6f, 0.2f, 1);
+    const float lineHeight = 20, barScale = 200 / 16.7f; // 16,7 ms = 200 px
+    Bar(4, 4, 560, lineHeight * (scopes.size() + 1) + 8,
+        vec4(0, 0, 0, 0.6f));
+    Text(8, 8, "SCOPE         CPU MIN/AVG/P99   GPU MIN/AVG/P99", white);
+    float y = 8 + lineHeight;
+    for (Scope &scope : scopes) {
+      char line[96];
+      int cpuN = std::min(scope.cpuCount, window);
+      int gpuN = std::min(scope.gpuCount, window);
+      float cpuAvg = 0, gpuAvg = 0;
+      for (int i = 0; i < cpuN; i++)
+        cpuAvg += scope.cpu[i] / cpuN;
+      for (int i = 0; i < gpuN; i++)
+        gpuAvg += scope.gpu[i] / gpuN;
+      int n = snprintf(line, sizeof(line), "%-12.12s", scope.name.c_str());
+      if (cpuN > 0)
+        n += snprintf(line + n, sizeof(line) - n, " %5.2f/%5.2f/%5.2f",
+                      Percentile(scope.cpu, cpuN, 0), cpuAvg,
+                      Percentile(scope.cpu, cpuN, 0.99f));
+      if (gpuN > 0)
+        snprintf(line + n, sizeof(line) - n, " %5.2f/%5.2f/%5.2f",
+                 Percentile(scope.gpu, gpuN, 0), gpuAvg,
+                 Percentile(scope.gpu, gpuN, 0.99f));
+      Text(8, y, line, white);
+      Bar(8, y + 16, cpuAvg * barScale, 2, cpuColor);
+      Bar(8 + cpuAvg * barScale, y + 16, gpuAvg * barScale, 2, gpuColor);
+      y += lineHeight;
+    }
+
+    // az alkalmazás állapotát nem rontjuk el
+    GLint program, vertexArray, arrayBuffer, texture, activeTexture,
+        viewport[4];
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertexArray);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &arrayBuffer);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    glViewport(0, 0, width, height);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    overlayProgram.Use();
+    overlayProgram.setUniform(vec2((float)width, (float)height), "viewport");
+    overlayProgram.setUniform(0, "font");
+    glBindTexture(GL_TEXTURE_2D, fontTexture);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                 vertices.data(), GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, (int)vertices.size() / 8);
+
+    if (!blend)
+      glDisable(GL_BLEND);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glActiveTexture(activeTexture);
+    glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
+    glBindVertexArray(vertexArray);
+    glUseProgram(program);
+  }
+
+  ~Profiler() {
+    glFinish(); // a függő GPU mérések is bekerülnek
+    for (int n = 0; n < queryFrames; n++)
+      Resolve(pending[(frameCount + n) % queryFrames]);
+    printf("Profile (ms)    cpu min/avg/p99       gpu min/avg/p99\n");
+    for (Scope &scope : scopes) {
+      int cpuN = std::min(scope.cpuCount, window);
+      int gpuN = std::min(scope.gpuCount, window);
+      printf("%-14s", scope.name.c_str());
+      float avg = 0;
+      if (cpuN > 0) {
+        for (int i = 0; i < cpuN; i++)
+          avg += scope.cpu[i] / cpuN;
+        printf("  %6.3f/%6.3f/%6.3f", Percentile(scope.cpu, cpuN, 0), avg,
+               Percentile(scope.cpu, cpuN, 0.99f));
+      }
+      if (gpuN > 0) {
+        avg = 0;
+        for (int i = 0; i < gpuN; i++)
+          avg += scope.gpu[i] / gpuN;
+        printf("  %6.3f/%6.3f/%6.3f", Percentile(scope.gpu, gpuN, 0), avg,
+               Percentile(scope.gpu, gpuN, 0.99f));
+      }
+      printf("\n");
+    }
+    for (PendingFrame &frame : pending)
+      if (!frame.queries.empty())
+        glDeleteQueries((int)frame.queries.size(), &frame.queries[0]);
+    if (overlay) {
+      glDeleteBuffers(1, &vbo);
+      glDeleteVertexArrays(1, &vao);
+      glDeleteTextures(1, &fontTexture);
+    }
+    if (csv)
+      fclose(csv);
+  }
+};
+
+// Az első jel a tele cella, a kisbetűk nagybetűként jelennek meg
+const std::string Profiler::fontGlyphs = "#0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/-_%()=,<>";
+const unsigned char Profiler::fontBitmap[][7] = {
+    {0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f}, // #
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+    {0x0e, 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11}, // A
+    {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, // B
+    {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, // C
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, // D
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, // E
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, // F
+    {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, // G
+    {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // H
+    {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, // L
+    {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // O
+    {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, // P
+    {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, // Q
+    {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, // R
+    {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, // S
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, // W
+    {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04}, // Y
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, // Z
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+    {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f}, // _
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+    {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, // =
+    {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, // ,
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+};
+static Profiler *profiler = nullptr;
+
+ProfileScope::ProfileScope(const char *_name, bool gpu) : name(_name) {
+  if (profiler)
+    index = profiler->Begin(name, gpu);
+  if (profiler || traceEnabled)
+    start = traceClock();
+}
+
+ProfileScope::~ProfileScope() {
+  if (!start)
+    return;
+  uint64_t end = traceClock();
+  if (profiler && index >= 0)
+    profiler->End(index, end - start);
+  traceEvent(name, start, end);
+}
+
+//---------------------------
+class RenderThread {
+  //---------------------------
+  // Két parancslista: amíg a renderszál az egyiket játssza le, az alkalmazás
+  // a másikba rögzít, így legfeljebb egy képkocka átfedés van.
+  CommandList lists[2];
+  int recording = 0;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  const CommandList *submitted = nullptr;
+  int width = 0, height = 0, frames = 0;
+  bool quit = false;
+  double replayTime = 0, waitTime = 0, listBytes = 0; // mp, mp, bájt
+
+  void Loop() {
+    traceThreadName("render");
+    glfwMakeContextCurrent(window);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [this] { return quit || submitted; });
+      if (!submitted)
+        break;
+      const CommandList *list = submitted;
+      lock.unlock();
+      uint64_t start = traceClock();
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      list->Replay();
+      traceEvent("CommandList::Replay", start, traceClock());
+      if (capture)
+        capture->Capture(width, height);
+      uint64_t swapStart = traceClock();
+      glfwSwapBuffers(window);
+      traceEvent("glfwSwapBuffers", swapStart, traceClock());
+      lock.lock();
+      replayTime += (swapStart - start) * 1e-9;
+      submitted = nullptr;
+      done.notify_all();
+    }
+    glfwMakeContextCurrent(NULL);
+  }
+
+public:
+  RenderThread() {
+    glfwMakeContextCurrent(NULL); // a környezet a renderszálé lesz
+    thread = std::thread(&RenderThread::Loop, this);
+    recordingList = &lists[recording];
+  }
+
+  // A rögzített képkocka átadása; vár, ha az előző még nem készült el
+  void Submit(int _width, int _height) {
+    TRACE_SCOPE("RenderThread::Submit");
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return !submitted; });
+    waitTime += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    listBytes += lists[recording].Size();
+    frames++;
+    submitted = &lists[recording];
+    width = _width, height = _height;
+    wake.notify_one();
+    lock.unlock();
+    recording ^= 1;
+    lists[recording].Reset(); // ezt már lejátszotta a renderszál
+    recordingList = &lists[recording];
+  }
+
+  ~RenderThread() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [this] { return !submitted; });
+      quit = true;
+      wake.notify_one();
+    }
+    thread.join();
+    recordingList = nullptr;
+    glfwMakeContextCurrent(window);
+    lists[recording].Replay(); // a be nem mutatott képkocka utáni munka
+    if (frames > 0)
+      printf("Render thread: %d frames, %.3f ms replay, %.3f ms app wait, "
+             "%.1f KiB list per frame\n",
+             frames, 1000.0 * replayTime / frames, 1000.0 * waitTime / frames,
+             listBytes / frames / 1024);
+  }
+};
+static RenderThread *renderThread = nullptr;
+
+static bool hasExtension(const char *name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++)
+    if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+      return true;
+  return false;
+}
+
+//---------------------------
+class DebugOutput {
+  //---------------------------
+  // GL_KHR_debug üzenetek forrás, típus és azonosító szerint összesítve. A
+  // kimenet szinkron, így a visszahívás a kiváltó GL hívás szálán fut (ez
+  // renderszálas módban a renderszál).
+  struct Entry {
+    GLenum source = 0, type = 0, severity = 0;
+    GLuint id = 0;
+    uint64_t count = 0;
+    std::string message; // az első előfordulás szövege
+  };
+  std::mutex mutex;
+  std::unordered_map<uint64_t, Entry> entries;
+  int topCount;
+  PFNGLDEBUGMESSAGECALLBACKPROC messageCallback = nullptr;
+  PFNGLOBJECTLABELPROC objectLabel = nullptr;
+  GLint maxLabelLength = 256;
+
+  static const char *SourceName(GLenum source) {
+    switch (source) {
+    case GL_DEBUG_SOURCE_API:
+      return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+      return "window";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER:
+      return "compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:
+      return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:
+      return "application";
+    default:
+      return "other";
+    }
+  }
+
+  static const char *TypeName(GLenum type) {
+    switch (type) {
+    case GL_DEBUG_TYPE_ERROR:
+      return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+      return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+      return "undefined";
+    case GL_DEBUG_TYPE_PORTABILITY:
+      return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+      return "performance";
+    case GL_DEBUG_TYPE_MARKER:
+      return "marker";
+    default:
+      return "other";
+    }
+  }
+
+  static void APIENTRY Callback(GLenum source, GLenum type, GLuint id,
+                                GLenum severity, GLsizei length,
+                                const GLchar *message, const void *user) {
+    ((DebugOutput *)user)->Add(source, type, id, severity, message);
+  }
+
+  void Add(GLenum source, GLenum type, GLuint id, GLenum severity,
+           const char *message) {
+    uint64_t key = (uint64_t)(source & 0xffff) << 48 |
+                   (uint64_t)(type & 0xffff) << 32 | id;
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[key];
+    if (entry.count++ > 0)
+      return;
+    entry.source = source;
+    entry.type = type;
+    entry.id = id;
+    entry.severity = severity;
+    entry.message = message;
+    // Minden fajtából az első azonnal látszik, a többit csak számoljuk
+    if (severity != GL_DEBUG_SEVERITY_NOTIFICATION)
+      printf("GL %s %s 0x%x: %s\n", SourceName(source), TypeName(type), id,
+             message);
+  }
+
+public:
+  DebugOutput(int _topCount) : topCount(_topCount) {}
+
+  // Az aktuális környezetre; hamis, ha a driver nem tudja
+  bool Install(GLADloadproc load) {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major * 10 + minor >= 43 || hasExtension("GL_KHR_debug")) {
+      messageCallback =
+          (PFNGLDEBUGMESSAGECALLBACKPROC)load("glDebugMessageCallback");
+      objectLabel = (PFNGLOBJECTLABELPROC)load("glObjectLabel");
+    }
+    if (!messageCallback || !objectLabel) {
+      printf("GL debug output needs OpenGL 4.3 or GL_KHR_debug\n");
+      messageCallback = nullptr;
+      objectLabel = nullptr;
+      return false;
+    }
+    GLint flags = 0;
+    glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+    if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT))
+      printf("GL debug output without a debug context, the driver may report "
+             "less\n");
+    glGetIntegerv(GL_MAX_LABEL_LENGTH, &maxLabelLength);
+    glEnable(GL_DEBUG_OUTPUT);
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    messageCallback(Callback, this);
+    return true;
+  }
+
+  void Label(GLenum identifier, GLuint name, const std::string &label) {
+    if (objectLabel && name)
+      objectLabel(identifier, name,
+                  std::min((GLsizei)label.size(), maxLabelLength - 1),
+                  label.c_str());
+  }
+
+  // Összesítés típusonként és a leggyakoribb teljesítmény figyelmeztetések
+  ~DebugOutput() {
+    if (!messageCallback)
+      return;
+    messageCallback(nullptr, nullptr);
+    glDisable(GL_DEBUG_OUTPUT);
+    std::vector<const Entry *> performance;
+    uint64_t total = 0, errors = 0, warnings = 0;
+    for (auto &item : entries) {
+      const Entry &entry = item.second;
+      total += entry.count;
+      if (entry.type == GL_DEBUG_TYPE_ERROR)
+        errors += entry.count;
+      if (entry.type == GL_DEBUG_TYPE_PERFORMANCE) {
+        warnings += entry.count;
+        performance.push_back(&entry);
+      }
+    }
+    printf("GL debug: %llu messages (%zu kinds), %llu errors, %llu "
+           "performance warnings\n",
+           (unsigned long long)total, entries.size(),
+           (unsigned long long)errors, (unsigned long long)warnings);
+    std::sort(performance.begin(), performance.end(),
+              [](const Entry *a, const Entry *b) {
+                return a->count > b->count;
+              });
+    if (performance.size() > (size_t)topCount)
+      performance.resize(topCount);
+    if (!performance.empty())
+      printf("%8s  %-11s %10s  %s\n", "count", "source", "id", "message");
+    for (const Entry *entry : performance)
+      printf("%8llu  %-11s 0x%08x  %.100s\n", (unsigned long long)entry->count,
+             SourceName(entry->source), entry->id, entry->message.c_str());
+  }
+};
+static DebugOutput *debugOutput = nullptr;
+
+void labelObject(GLenum identifier, GLuint name, const std::string &label) {
+  if (debugOutput)
+    debugOutput->Label(identifier, name, label);
+}
+
+// A kért debug kimenet telepítése, amint van környezet
+static void startDebugOutput() {
+  if (!debugRequested || !glLoader || debugOutput)
+    return;
+  debugOutput = new DebugOutput(debugTopCount);
+  if (!debugOutput->Install(glLoader)) {
+    delete debugOutput;
+    debugOutput = nullptr;
+  }
+}
+
 // Esem�nykezel�k
 static void error_callback(int error, const char *description) {
   fprintf(stderr, "Error: %s\n", description);
@@ -20,43 +1089,437 @@ static void error_callback(int error, const char *description) {
 
 static void window_refresh_callback(GLFWwindow *window) {
   screenRefresh = true;
+  partialRefresh = false;
+}
+
+// Monoton óra az indulás óta; fej nélkül és visszajátszáskor a virtuális óra
+// a hívó szál processzorideje: a munkás-, mentő- és rajzoló szálak nem számítanak
+static uint64_t threadCpuNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t monotonicNanos() {
+  if (virtualClock)
+    return virtualNanos;
+  static auto origin = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - origin)
+      .count();
 }
 
+//---------------------------
+class LatencyStats {
+  //---------------------------
+  // Bemenet -> onDisplay -> megjelenítés késleltetés. A csere után egy
+  // fence kerül a parancsfolyamba; az elkészültét a fő ciklus várakozás
+  // nélkül figyeli, így a mérés nem állítja meg a CPU-GPU átfedést.
+  struct Pending {
+    GLsync fence;
+    uint64_t input, display; // 0: a képkockához nem tartozott bemenet
+  };
+  std::deque<Pending> pending;
+  std::vector<double> inputToDisplay, inputToPresent, displayToPresent; // ms
+
+  static void Report(const char *name, std::vector<double> &values) {
+    if (values.empty())
+      return;
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (double v : values)
+      sum += v;
+    auto at = [&](double p) {
+      return values[(size_t)(p * (values.size() - 1))];
+    };
+    printf("%-17s %6zu %7.2f %7.2f %7.2f %7.2f %7.2f %7.2f\n", name,
+           values.size(), values.front(), sum / values.size(), at(0.5),
+           at(0.95), at(0.99), values.back());
+  }
+
+public:
+  uint64_t inputArrival = 0; // a legrégebbi még meg nem jelenített bemenet
+
+  void Presented(uint64_t display) {
+    pending.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+                       inputArrival, display});
+    inputArrival = 0;
+  }
+
+  bool Waiting() const { return !pending.empty(); }
+
+  // Elkészült fence-ek begyűjtése; legfeljebb deadline időpontig vár
+  void Poll(uint64_t deadline = 0) {
+    while (!pending.empty()) {
+      Pending &frame = pending.front();
+      uint64_t now = traceClock();
+      GLenum status =
+          glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                           deadline > now ? deadline - now : 0);
+      if (status == GL_TIMEOUT_EXPIRED)
+        return;
+      now = traceClock();
+      glDeleteSync(frame.fence);
+      displayToPresent.push_back((now - frame.display) * 1e-6);
+      if (frame.input) {
+        inputToDisplay.push_back((frame.display - frame.input) * 1e-6);
+        inputToPresent.push_back((now - frame.input) * 1e-6);
+      }
+      pending.pop_front();
+    }
+  }
+
+  ~LatencyStats() {
+    Poll(traceClock() + 1000000000);
+    printf("Latency (ms)           n     min     avg     p50     p95     p99"
+           "     max\n");
+    Report("input->display", inputToDisplay);
+    Report("input->present", inputToPresent);
+    Report("display->present", displayToPresent);
+  }
+};
+static LatencyStats *latency = nullptr;
+static bool latencyRequested = false;
+static int swapInterval = 1;
+static uint64_t frameLimitNanos = 0; // 0: nincs korlát
+
+// A csereintervallum a környezet szálán állítható
+static void applySwapInterval() {
+  int interval = swapInterval;
+  if (interval < 0 && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+      !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+    printf("Adaptive vsync is not supported, using vsync\n");
+    interval = 1;
+  }
+  glfwSwapInterval(interval);
+}
+
+// Pontos képkocka korlát: alvás a határidő előttig, a maradék pörgéssel.
+// Az alvás rátartását az operációs rendszer mért késéséhez igazítjuk.
+static void limitFrameRate() {
+  static uint64_t deadline = 0;
+  static double spinMargin = 1e6; // ns
+  uint64_t now = traceClock();
+  deadline += frameLimitNanos;
+  if (deadline < now) { // lemaradtunk: nem pótoljuk sorozatban
+    deadline = now;
+    return;
+  }
+  TRACE_SCOPE("limitFrameRate");
+  if (deadline - now > spinMargin) {
+    uint64_t wake = deadline - (uint64_t)spinMargin;
+    if (latency) // alvás helyett a képkocka fence-ére várunk
+      latency->Poll(wake);
+    now = traceClock();
+    if (wake > now)
+      std::this_thread::sleep_for(std::chrono::nanoseconds(wake - now));
+    double late = (double)traceClock() - (double)wake;
+    spinMargin =
+        std::max(2e5, std::min(4e6, 0.9 * spinMargin + 0.1 * 2 * late));
+  }
+  while (traceClock() < deadline)
+    std::this_thread::yield();
+}
+
+void glApp::setSwapInterval(int interval) {
+  swapInterval = interval;
+  if (window)
+    glCommands().Call(applySwapInterval);
+}
+
+void glApp::setFrameRateLimit(float framesPerSecond) {
+  frameLimitNanos =
+      framesPerSecond > 0 ? (uint64_t)(1e9 / framesPerSecond) : 0;
+}
+
+void glApp::enableLatencyStats() { latencyRequested = true; }
+
+// Bemeneti esemény; a visszahívások csak sorba teszik, a feldolgozás
+// képkockánként egyszer, sorrendben történik
+struct InputEvent {
+  enum Type { KEY_DOWN, KEY_UP, CHARACTER, BUTTON_DOWN, BUTTON_UP, MOTION };
+  Type type;
+  int code; // billentyű, karakter vagy egérgomb
+  int x, y;
+};
+static std::vector<InputEvent> inputEvents;
+static std::vector<MotionSample> motionSamples, frameMotionSamples;
+
+static void queueInput(InputEvent::Type type, int code, double x, double y,
+                       uint64_t time);
+
+//---------------------------
+class InputLog {
+  //---------------------------
+  // Bemenet felvétele és visszajátszása teljesítményméréshez. Minden rekord
+  // egy típus bájt, előjeles varint időkülönbség (ns) és a típus adatai.
+  // A FRAME rekord a fő ciklus egy lépését zárja: a sorszám és az
+  // advanceTime intervalluma, így a visszajátszás ugyanazt az időt látja.
+  static constexpr uint32_t magic = 0x4e495247, version = 1; // "GRIN"
+  enum { FRAME = 0x10 };                                     // egyébként Type
+  FILE *file;
+  bool replaying;
+  uint64_t lastTime = 0, frames = 0, events = 0;
+
+  void Put(uint64_t v) { // varint
+    for (; v >= 0x80; v >>= 7)
+      fputc((int)(v & 0x7f) | 0x80, file);
+    fputc((int)v, file);
+  }
+  void PutSigned(int64_t v) { Put(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); }
+  void PutTime(uint64_t time) {
+    PutSigned((int64_t)(time - lastTime));
+    lastTime = time;
+  }
+  bool Get(uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int c = fgetc(file);
+      if (c == EOF)
+        return false;
+      v |= (uint64_t)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return true;
+    }
+    return false;
+  }
+  bool GetSigned(int64_t &v) {
+    uint64_t u;
+    if (!Get(u))
+      return false;
+    v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return true;
+  }
+  bool GetTime(uint64_t &time) {
+    int64_t delta;
+    if (!GetSigned(delta))
+      return false;
+    time = lastTime += delta;
+    return true;
+  }
+
+public:
+  InputLog(const char *path, bool replay) : replaying(replay) {
+    file = fopen(path, replay ? "rb" : "wb");
+    uint32_t header[4] = {magic, version, (uint32_t)windowWidth,
+                          (uint32_t)windowHeight};
+    if (file && !replay) {
+      fwrite(header, sizeof(header), 1, file);
+    } else if (file) {
+      uint32_t stored[4] = {};
+      if (fread(stored, sizeof(stored), 1, file) != 1 || stored[0] != magic ||
+          stored[1] != version) {
+        fclose(file);
+        file = nullptr;
+      } else if (stored[2] != header[2] || stored[3] != header[3]) {
+        printf("Warning: %s was recorded at %ux%u\n", path, stored[2],
+               stored[3]);
+      }
+    }
+    if (!file) {
+      printf("Cannot %s input log %s\n", replay ? "read" : "write", path);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bool Replaying() const { return replaying; }
+
+  void Record(InputEvent::Type type, int code, double x, double y,
+              uint64_t time) {
+    if (replaying)
+      return;
+    events++;
+    fputc(type, file);
+    PutTime(time);
+    if (type == InputEvent::MOTION) {
+      float position[2] = {(float)x, (float)y};
+      fwrite(position, sizeof(position), 1, file);
+      return;
+    }
+    Put((uint32_t)code);
+    if (type == InputEvent::BUTTON_DOWN || type == InputEvent::BUTTON_UP) {
+      PutSigned((int64_t)x);
+      PutSigned((int64_t)y);
+    }
+  }
+
+  // A fő ciklus egy lépése, az események után
+  void Frame(uint64_t start, uint64_t end) {
+    fputc(FRAME, file);
+    Put(frames++);
+    PutTime(start);
+    PutTime(end);
+  }
+
+  // A következő lépés eseményei a sorba; hamis, ha vége a felvételnek
+  bool Next(uint64_t &start, uint64_t &end) {
+    int type;
+    while ((type = fgetc(file)) != EOF) {
+      uint64_t time, index, code = 0;
+      int64_t x = 0, y = 0;
+      if (type == FRAME) {
+        if (!Get(index) || !GetTime(start) || !GetTime(end))
+          return false;
+        frames++;
+        return true;
+      }
+      if (type > InputEvent::MOTION || !GetTime(time))
+        return false;
+      events++;
+      if (type == InputEvent::MOTION) {
+        float position[2];
+        if (fread(position, sizeof(position), 1, file) != 1)
+          return false;
+        queueInput(InputEvent::MOTION, 0, position[0], position[1], time);
+        continue;
+      }
+      if (!Get(code))
+        return false;
+      if ((type == InputEvent::BUTTON_DOWN || type == InputEvent::BUTTON_UP) &&
+          (!GetSigned(x) || !GetSigned(y)))
+        return false;
+      queueInput((InputEvent::Type)type, (int)code, (double)x, (double)y,
+                 time);
+    }
+    return false;
+  }
+
+  ~InputLog() {
+    printf("Input %s: %llu steps, %llu events, %ld bytes\n",
+           replaying ? "replay" : "record", (unsigned long long)frames,
+           (unsigned long long)events, ftell(file));
+    fclose(file);
+  }
+};
+static InputLog *inputLog = nullptr;
+static const char *recordFile = nullptr, *replayFile = nullptr;
+static std::vector<double> replayFrameTimes; // ms, kirajzolt képkockánként
+
+static void queueInput(InputEvent::Type type, int code, double x, double y,
+                       uint64_t time) {
+  if (inputLog)
+    inputLog->Record(type, code, x, y, time);
+  if (latency && !latency->inputArrival)
+    latency->inputArrival = traceClock();
+  if (type != InputEvent::MOTION) {
+    inputEvents.push_back({type, code, (int)x, (int)y});
+    return;
+  }
+  motionSamples.push_back({x, y, time * 1e-9});
+  // egymást követő mozgásokból csak az utolsó pozíció számít
+  if (!inputEvents.empty() && inputEvents.back().type == InputEvent::MOTION)
+    inputEvents.back().x = (int)x, inputEvents.back().y = (int)y;
+  else
+    inputEvents.push_back({InputEvent::MOTION, 0, (int)x, (int)y});
+}
+
+// Visszajátszáskor a valódi bemenet nem számít
+static bool liveInput() { return !inputLog || !inputLog->Replaying(); }
+
 static void key_callback(GLFWwindow *window, int key, int scancode, int action,
                          int mods) {
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
     glfwSetWindowShouldClose(window, GLFW_TRUE);
     return;
   }
+  if (!liveInput())
+    return;
   if ((mods & GLFW_MOD_SHIFT) == 0)
     key += 'a' - 'A';
   if (action == GLFW_PRESS || action == GLFW_REPEAT)
-    pApp->onKeyboard(key);
+    queueInput(InputEvent::KEY_DOWN, key, 0, 0, monotonicNanos());
   if (action == GLFW_RELEASE)
-    pApp->onKeyboardUp(key);
+    queueInput(InputEvent::KEY_UP, key, 0, 0, monotonicNanos());
 }
 
 void character_callback(GLFWwindow *window, unsigned int codepoint) {
-  pApp->onKeyboard(codepoint);
+  if (liveInput())
+    queueInput(InputEvent::CHARACTER, (int)codepoint, 0, 0, monotonicNanos());
 }
 
 void mouse_button_callback(GLFWwindow *window, int button, int action,
                            int mods) {
+  if (!liveInput())
+    return;
   double pX, pY;
   glfwGetCursorPos(window, &pX, &pY);
-  if (action == GLFW_PRESS)
-    pApp->onMousePressed((button == GLFW_MOUSE_BUTTON_LEFT) ? MOUSE_LEFT
-                                                            : MOUSE_RIGHT,
-                         (int)pX, (int)pY);
-  else
-    pApp->onMouseReleased((button == GLFW_MOUSE_BUTTON_LEFT) ? MOUSE_LEFT
-                                                             : MOUSE_RIGHT,
-                          (int)pX, (int)pY);
+  MouseButton but =
+      (button == GLFW_MOUSE_BUTTON_LEFT) ? MOUSE_LEFT : MOUSE_RIGHT;
+  queueInput(action == GLFW_PRESS ? InputEvent::BUTTON_DOWN
+                                  : InputEvent::BUTTON_UP,
+             but, (int)pX, (int)pY, monotonicNanos());
 }
 
 static void cursor_position_callback(GLFWwindow *window, double xpos,
                                      double ypos) {
-  pApp->onMouseMotion((int)xpos, (int)ypos);
+  if (liveInput())
+    queueInput(InputEvent::MOTION, 0, xpos, ypos, monotonicNanos());
+}
+
+// A sorba gyűlt események továbbítása az alkalmazásnak
+static void dispatchInput() {
+  // bemenet nélküli képkockán se maradjanak meg az előző minták
+  frameMotionSamples.swap(motionSamples);
+  motionSamples.clear();
+  if (inputEvents.empty())
+    return;
+  TRACE_SCOPE("dispatchInput");
+  std::vector<InputEvent> events;
+  events.swap(inputEvents); // a kezelők újabb eseményt nem tehetnek elé
+  for (const InputEvent &event : events) {
+    switch (event.type) {
+    case InputEvent::KEY_DOWN:
+    case InputEvent::CHARACTER: {
+      TRACE_SCOPE("onKeyboard");
+      pApp->onKeyboard(event.code);
+      break;
+    }
+    case InputEvent::KEY_UP: {
+      TRACE_SCOPE("onKeyboardUp");
+      pApp->onKeyboardUp(event.code);
+      break;
+    }
+    case InputEvent::BUTTON_DOWN: {
+      TRACE_SCOPE("onMousePressed");
+      pApp->onMousePressed((MouseButton)event.code, event.x, event.y);
+      break;
+    }
+    case InputEvent::BUTTON_UP: {
+      TRACE_SCOPE("onMouseReleased");
+      pApp->onMouseReleased((MouseButton)event.code, event.x, event.y);
+      break;
+    }
+    case InputEvent::MOTION: {
+      TRACE_SCOPE("onMouseMotion");
+      pApp->onMouseMotion(event.x, event.y);
+      break;
+    }
+    }
+  }
+  events.clear();
+  if (inputEvents.empty())
+    inputEvents.swap(events); // a lefoglalt tár megmarad
+}
+
+// Visszajátszás eredménye: képkockánkénti idők és összesítés
+static void printReplayTimings() {
+  std::vector<double> sorted = replayFrameTimes;
+  for (size_t i = 0; i < sorted.size(); i++)
+    printf("replay frame %zu: %.3f ms\n", i, sorted[i]);
+  if (sorted.empty())
+    return;
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  for (double t : sorted)
+    sum += t;
+  printf("Replay: %zu frames, avg %.3f ms, median %.3f ms, p99 %.3f ms, "
+         "max %.3f ms\n",
+         sorted.size(), sum / sorted.size(), sorted[sorted.size() / 2],
+         sorted[(sorted.size() * 99) / 100], sorted.back());
+}
+
+const std::vector<MotionSample> &glApp::mouseSamples() const {
+  return frameMotionSamples;
 }
 
 // Applik�ci� konstruktora
@@ -82,27 +1545,761 @@ glApp::glApp(const char *_windowCaption) {
 }
 
 // Rajzold �jra az alkalmaz�si ablakot
-void glApp::refreshScreen() { screenRefresh = true; }
+void glApp::refreshScreen() {
+  screenRefresh = true;
+  partialRefresh = false;
+}
+
+void glApp::refreshScreen(int x, int y, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return;
+  if (!screenRefresh) { // az első sérülés a képkockában
+    partialRefresh = true;
+    damage[0] = x, damage[1] = y;
+    damage[2] = x + width, damage[3] = y + height;
+  } else if (partialRefresh) {
+    damage[0] = std::min(damage[0], x), damage[1] = std::min(damage[1], y);
+    damage[2] = std::max(damage[2], x + width);
+    damage[3] = std::max(damage[3], y + height);
+  }
+  screenRefresh = true;
+}
+
+// Idő léptetése: szabad és rögzített lépésű animáció
+static void advanceTime(uint64_t start, uint64_t end) {
+  {
+    PROFILE_CPU("onTimeElapsed");
+    pApp->onTimeElapsed(start * 1e-9, end * 1e-9);
+  }
+  if (simulationTick == 0)
+    return;
+  simulationBacklog += end - start;
+  for (int step = 0; step < maxSubsteps && simulationBacklog >= simulationTick;
+       step++) {
+    PROFILE_CPU("onSimulate");
+    pApp->onSimulate(simulationTick * 1e-9);
+    simulationBacklog -= simulationTick;
+  }
+  if (simulationBacklog >= simulationTick) { // lemaradtunk
+    if (catchUpPolicy == CATCHUP_DROP)
+      simulationBacklog %= simulationTick;
+    else // legfeljebb egy képkockányi lépés marad a következőkre
+      simulationBacklog =
+          std::min(simulationBacklog, simulationTick * maxSubsteps);
+  }
+  simulationAlpha =
+      (float)std::min(1.0, (double)simulationBacklog / simulationTick);
+  if (activeAnimations > 0) { // az interpolált állapot minden képkockán más
+    screenRefresh = true;
+    partialRefresh = false;
+  }
+}
+
+void glApp::setSimulationRate(double ticksPerSecond, int _maxSubsteps,
+                              CatchUpPolicy policy) {
+  simulationTick = ticksPerSecond > 0 ? (uint64_t)(1e9 / ticksPerSecond) : 0;
+  simulationBacklog = 0;
+  maxSubsteps = std::max(1, _maxSubsteps);
+  catchUpPolicy = policy;
+}
+
+float glApp::interpolationAlpha() const { return simulationAlpha; }
+
+void glApp::startAnimation() { activeAnimations++; }
+
+void glApp::stopAnimation() {
+  if (activeAnimations > 0)
+    activeAnimations--;
+}
+
+void glApp::setTimer(float delay) {
+  timerDeadlines.push_back(monotonicNanos() + (uint64_t)(delay * 1e9));
+}
+
+float glApp::cpuUtilization() const { return frameCpuUtilization; }
+
+// Várakozás a következő eseményig vagy időzítőig; igaz, ha blokkoltunk
+static bool waitForEvents() {
+  TRACE_SCOPE("waitForEvents");
+  uint64_t now = monotonicNanos();
+  timerDeadlines.erase(std::remove_if(timerDeadlines.begin(),
+                                      timerDeadlines.end(),
+                                      [now](uint64_t t) { return t <= now; }),
+                       timerDeadlines.end());
+  if (activeAnimations > 0 || screenRefresh) {
+    glfwPollEvents();
+    return false;
+  }
+  if (latency && latency->Waiting()) { // előbb a fence-ek, utána az események
+    latency->Poll(traceClock() + 50000000);
+    glfwPollEvents();
+  } else if (timerDeadlines.empty()) {
+    glfwWaitEvents();
+  } else {
+    uint64_t next =
+        *std::min_element(timerDeadlines.begin(), timerDeadlines.end());
+    glfwWaitEventsTimeout((next - now) * 1e-9);
+  }
+  return true;
+}
+
+// Renderszálas módban a mentés a renderszálon fut, ott kell létrehozni
+void glApp::startCapture(const char *directory, CaptureFormat format,
+                         int workers) {
+  std::string path = directory;
+  glCommands().Call([path, format, workers] {
+    delete capture;
+    capture = new FrameCapture(path, format, workers);
+  });
+}
+
+void glApp::stopCapture() {
+  glCommands().Call([] {
+    delete capture;
+    capture = nullptr;
+  });
+}
+
+void glApp::enableProfiler(bool overlay, const char *csvFile) {
+  delete profiler;
+  profiler = new Profiler(overlay, csvFile);
+}
+
+void glApp::disableProfiler() {
+  delete profiler;
+  profiler = nullptr;
+}
+
+void glApp::enableRenderThread() { renderThreadAllowed = true; }
+
+void glApp::enableDebugOutput(int topCount) {
+  debugRequested = true;
+  debugTopCount = topCount;
+  if (glLoader) // környezet már van: a GL hívások a lista szálán
+    glCommands().Call([] { startDebugOutput(); });
+}
+
+//---------------------------
+struct Job {
+  //---------------------------
+  std::function<void()> work;
+  Job *parent;
+  std::atomic<int> unfinished{0}; // saját maga és a még futó gyerekek
+};
+
+//---------------------------
+class JobSystem {
+  //---------------------------
+  // Munkalopó szálkészlet. Minden szálnak saját Chase–Lev sora van: a
+  // tulajdonos az aljára tesz és onnan vesz el, a többiek a tetejéről
+  // lopnak. A feladatok szálanként egy gyűrűből jönnek, foglalás nélkül.
+  static constexpr int queueSize = 4096, jobsPerThread = 4096;
+
+  struct Worker {
+    std::atomic<int64_t> top{0}, bottom{0};
+    std::atomic<Job *> queue[queueSize];
+    Job jobs[jobsPerThread];
+    unsigned next = 0;
+
+    // csak a tulajdonos hívja
+    bool Push(Job *job) {
+      int64_t b = bottom.load(std::memory_order_relaxed);
+      int64_t t = top.load(std::memory_order_acquire);
+      if (b - t >= queueSize)
+        return false;
+      queue[b & (queueSize - 1)].store(job, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_release);
+      return true;
+    }
+
+    // csak a tulajdonos hívja
+    Job *Pop() {
+      int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+      bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t t = top.load(std::memory_order_relaxed);
+      if (t > b) { // üres
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      Job *job = queue[b & (queueSize - 1)].load(std::memory_order_relaxed);
+      if (t == b) { // az utolsó elemért a tolvajokkal versenyzünk
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+          job = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+      }
+      return job;
+    }
+
+    // bármely szál hívhatja
+    Job *Steal() {
+      int64_t t = top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = bottom.load(std::memory_order_acquire);
+      if (t >= b)
+        return nullptr;
+      Job *job = queue[t & (queueSize - 1)].load(std::memory_order_relaxed);
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        return nullptr;
+      return job;
+    }
+  };
+
+  std::vector<Worker *> workers; // 0: a fő szál
+  std::vector<std::thread> threads;
+  std::atomic<int> queued{0}, sleeping{0};
+  std::atomic<bool> quit{false};
+  std::mutex mutex;
+  std::condition_variable wake;
+  static thread_local int workerIndex; // -1: nem a készlet szála
+
+  Job *Next(int self) {
+    if (Job *job = workers[self]->Pop())
+      return job;
+    for (size_t i = 1; i < workers.size(); i++)
+      if (Job *job = workers[(self + i) % workers.size()]->Steal())
+        return job;
+    return nullptr;
+  }
+
+  void Finish(Job *job) {
+    while (job) {
+      // nullára csökkentés után a hely már újrahasznosítható
+      Job *parent = job->parent;
+      if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) > 1)
+        return;
+      job = parent;
+    }
+  }
+
+  void Execute(Job *job) {
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    job->work();
+    job->work = nullptr; // a lefoglalt erőforrások felszabadítása
+    Finish(job);
+  }
+
+  void WorkerLoop(int self) {
+    workerIndex = self;
+    traceThreadName("job worker");
+    while (!quit.load(std::memory_order_relaxed)) {
+      if (Job *job = Next(self)) {
+        Execute(job);
+        continue;
+      }
+      // rövid pörgés, utána alvás, hogy üresjáratban ne terheljen
+      bool found = false;
+      for (int spin = 0; spin < 64 && !found; spin++) {
+        std::this_thread::yield();
+        found = queued.load(std::memory_order_relaxed) > 0;
+      }
+      if (found)
+        continue;
+      sleeping.fetch_add(1);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return queued.load() > 0 || quit.load(); });
+      }
+      sleeping.fetch_sub(1);
+    }
+  }
+
+public:
+  // count: szálak száma a fő szállal együtt, 0: magonként egy
+  JobSystem(int count = 0) {
+    if (count <= 0)
+      count = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < count; i++)
+      workers.push_back(new Worker());
+    workerIndex = 0;
+    for (int i = 1; i < count; i++)
+      threads.emplace_back(&JobSystem::WorkerLoop, this, i);
+  }
+
+  int Workers() const { return (int)workers.size(); }
+
+  Job *Create(std::function<void()> work, Job *parent) {
+    if (workerIndex < 0) { // idegen szálon nincs saját gyűrű
+      printf("Jobs can only be created on the main or a worker thread\n");
+      exit(EXIT_FAILURE);
+    }
+    Worker *worker = workers[workerIndex];
+    Job *job = &worker->jobs[worker->next++ % jobsPerThread];
+    while (job->unfinished.load(std::memory_order_acquire) > 0) {
+      // a gyűrű körbeért egy még futó feladatra: addig segítünk
+      if (Job *other = Next(workerIndex))
+        Execute(other);
+    }
+    job->work = std::move(work);
+    job->parent = parent;
+    job->unfinished.store(1, std::memory_order_relaxed);
+    if (parent)
+      parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+    return job;
+  }
+
+  void Run(Job *job) {
+    queued.fetch_add(1);
+    if (!workers[workerIndex]->Push(job)) { // tele a sor: helyben fut
+      Execute(job);
+      return;
+    }
+    if (sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_one();
+    }
+  }
+
+  // Várakozás helyett más feladatokat végzünk
+  void Wait(const Job *job) {
+    while (job->unfinished.load(std::memory_order_acquire) > 0) {
+      if (Job *other = Next(workerIndex))
+        Execute(other);
+      else
+        std::this_thread::yield();
+    }
+  }
+
+  ~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+      wake.notify_all();
+    }
+    for (std::thread &thread : threads)
+      thread.join();
+    for (Worker *worker : workers)
+      delete worker;
+  }
+};
+thread_local int JobSystem::workerIndex = -1;
+static JobSystem *jobSystem = nullptr;
+
+static JobSystem &jobs() {
+  if (!jobSystem) // csak az első használatkor indulnak a szálak
+    jobSystem = new JobSystem();
+  return *jobSystem;
+}
+
+Job *glApp::createJob(std::function<void()> work, Job *parent) {
+  return jobs().Create(std::move(work), parent);
+}
+
+void glApp::runJob(Job *job) { jobs().Run(job); }
+
+void glApp::waitJob(const Job *job) { jobs().Wait(job); }
+
+int glApp::jobWorkers() { return jobs().Workers(); }
+
+// Rekurzív felezés grain méretig; a darabok bármely szálon futhatnak
+struct ParallelFor {
+  const std::function<void(int, int)> *body;
+  int grain;
+  Job *root;
+
+  void Split(int begin, int end) {
+    while (end - begin > grain) {
+      int middle = begin + (end - begin) / 2;
+      // kicsi lambda, a std::function nem foglal hozzá memóriát
+      jobs().Run(jobs().Create(
+          [this, middle, end] { Split(middle, end); }, root));
+      end = middle;
+    }
+    (*body)(begin, end);
+  }
+};
+
+void glApp::parallelFor(int begin, int end, int grain,
+                        const std::function<void(int, int)> &body) {
+  if (end <= begin)
+    return;
+  ParallelFor loop = {&body, std::max(1, grain), nullptr};
+  loop.root = createJob([&loop, begin, end] { loop.Split(begin, end); });
+  runJob(loop.root);
+  waitJob(loop.root);
+}
+
+// --bench-jobs: feladat indítás költsége és a parallelFor gyorsulása
+// 1..magszám szálon; ablak és GL nélkül fut
+static bool benchJobsRequested = false;
+
+static double benchSeconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+static int benchJobs() {
+  const int single = 100000, batch = 1000, batches = 200;
+  std::atomic<int> sink{0};
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < single; i++) { // egy feladat oda-vissza
+    Job *job = pApp->createJob([&sink] { sink++; });
+    pApp->runJob(job);
+    pApp->waitJob(job);
+  }
+  double roundTrip = benchSeconds(start) / single;
+  start = std::chrono::steady_clock::now();
+  for (int b = 0; b < batches; b++) { // sok gyerek egy szülő alatt
+    Job *root = pApp->createJob([] {});
+    for (int i = 0; i < batch; i++)
+      pApp->runJob(pApp->createJob([&sink] { sink++; }, root));
+    pApp->runJob(root);
+    pApp->waitJob(root);
+  }
+  double perChild = benchSeconds(start) / (batches * batch);
+  int cores = pApp->jobWorkers();
+  printf("Job spawn (%d threads): create+run+wait %.0f ns, "
+         "%d children of one parent %.0f ns/job\n",
+         cores, 1e9 * roundTrip, batch, 1e9 * perChild);
+
+  // számításra kötött ciklus: elemenként 64 szorzás-összeadás
+  const int count = 1 << 20, grain = 4096;
+  std::vector<float> out(count);
+  auto body = [&out](int b, int e) {
+    for (int i = b; i < e; i++) {
+      float x = (float)i;
+      for (int k = 0; k < 64; k++)
+        x = x * 0.999f + 1.0f;
+      out[i] = x;
+    }
+  };
+  start = std::chrono::steady_clock::now();
+  body(0, count);
+  double serial = benchSeconds(start);
+  printf("parallelFor, %d items, grain %d: serial %.1f ms\n", count, grain,
+         1000 * serial);
+  printf("threads      ms  speedup  efficiency\n");
+  for (int threads = 1; threads <= cores; threads++) {
+    delete jobSystem;
+    jobSystem = new JobSystem(threads);
+    double best = 1e9;
+    for (int run = 0; run < 5; run++) {
+      start = std::chrono::steady_clock::now();
+      pApp->parallelFor(0, count, grain, body);
+      best = std::min(best, benchSeconds(start));
+    }
+    printf("%7d %7.1f %7.2fx %10.0f%%\n", threads, 1000 * best, serial / best,
+           100 * serial / best / threads);
+  }
+  delete jobSystem;
+  jobSystem = nullptr;
+  return sink == single + batches * batch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 // Lek�rdez�ses klaviat�ra kezel�s
-bool pollKey(int key) { return (glfwGetKey(window, key) == GLFW_PRESS); }
+bool pollKey(int key) {
+  return window && (glfwGetKey(window, key) == GLFW_PRESS);
+}
+
+static void parseArguments(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--headless" && i + 1 < argc) {
+      headlessFrames = atoi(argv[++i]);
+    } else if (arg == "--fps" && i + 1 < argc && atof(argv[i + 1]) > 0) {
+      headlessFrameTime = (uint64_t)(1e9 / atof(argv[++i]));
+    } else if (arg == "--capture" && i + 1 < argc) {
+      captureDirectory = argv[++i];
+    } else if (arg == "--profile" && i + 1 < argc) {
+      profileFile = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      startTracing(argv[++i]);
+    } else if (arg == "--render-thread") {
+      if (!renderThreadAllowed) { // közvetlen gl* hívások a renderszál mellett
+        printf("%s: --render-thread is not supported, the application does "
+               "not call enableRenderThread()\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      renderThreadRequested = true;
+    } else if (arg == "--swap-interval" && i + 1 < argc) {
+      swapInterval = atoi(argv[++i]);
+    } else if (arg == "--frame-cap" && i + 1 < argc) {
+      pApp->setFrameRateLimit((float)atof(argv[++i]));
+    } else if (arg == "--latency") {
+      latencyRequested = true;
+    } else if (arg == "--gl-debug") {
+      debugRequested = true;
+    } else if (arg == "--record" && i + 1 < argc) {
+      recordFile = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replayFile = argv[++i];
+    } else if (arg == "--bench-jobs") {
+      benchJobsRequested = true;
+    } else {
+      printf("Usage: %s [--headless frames] [--fps rate] "
+             "[--capture directory] [--profile file.csv] "
+             "[--trace file.json] [--render-thread] [--record file] "
+             "[--replay file] [--swap-interval -1|0|1] [--frame-cap fps] "
+             "[--latency] [--gl-debug] [--bench-jobs]\n",
+             argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (renderThreadRequested && headlessFrames > 0) { // EGL-lel nincs renderszál
+    printf("%s: --render-thread is not supported with --headless\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Részleges frissítés ollója GL koordinátákban (a framebuffer és az ablak
+// méretarányával); hamis, ha teljes képkocka kell
+static bool damageScissor(int width, int height, int scissor[4]) {
+  if (!partialRefresh || (offscreenFbo && profiler)) // a kijelzés nem marad
+    return false;
+  int windowW = windowWidth, windowH = windowHeight;
+  if (window)
+    glfwGetWindowSize(window, &windowW, &windowH);
+  float sx = (float)width / std::max(1, windowW);
+  float sy = (float)height / std::max(1, windowH);
+  int x0 = std::max(0, (int)floorf(damage[0] * sx));
+  int x1 = std::min(width, (int)ceilf(damage[2] * sx));
+  int y0 = std::max(0, height - (int)ceilf(damage[3] * sy));
+  int y1 = std::min(height, height - (int)floorf(damage[1] * sy));
+  scissor[0] = x0, scissor[1] = y0;
+  scissor[2] = std::max(0, x1 - x0), scissor[3] = std::max(0, y1 - y0);
+  return true;
+}
+
+// Ablakos módban a hátsó puffer a csere után meghatározatlan, ezért az első
+// részleges frissítéstől a képkockák egy megőrzött célba készülnek, amit a
+// végén a hátsó pufferbe másolunk. Fej nélkül az FBO eleve megmarad.
+static RenderTarget *backBuffer = nullptr;
+static bool backBufferBound = false;
+
+// A GL szálon: a cél kiválasztása és az olló a sérült részre
+static void beginDamage(int width, int height, bool partial,
+                        const int scissor[4]) {
+  backBufferBound = offscreenFbo == 0 && (partial || backBuffer);
+  if (backBufferBound) {
+    if (backBuffer &&
+        (backBuffer->Width() != width || backBuffer->Height() != height)) {
+      delete backBuffer;
+      backBuffer = nullptr;
+    }
+    if (!backBuffer) { // tartalma még nincs, ez teljes képkocka lesz
+      backBuffer = new RenderTarget(width, height);
+      partial = false;
+    }
+    backBuffer->Begin();
+  }
+  if (partial) {
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(scissor[0], scissor[1], scissor[2], scissor[3]);
+  }
+}
+
+static void endDamage(int width, int height) {
+  glDisable(GL_SCISSOR_TEST);
+  if (backBufferBound) {
+    backBuffer->End();
+    backBuffer->Blit(0, 0, width, height);
+  }
+}
+
+// Egy képkocka kirajzolása az aktuális célpufferbe
+static void displayFrame(int width, int height) {
+  int scissor[4];
+  bool partial = damageScissor(width, height, scissor);
+  if (renderThread) { // rögzítés; lejátszás, mentés és csere a renderszálon
+    glCommands().Call([=] { beginDamage(width, height, partial, scissor); });
+    {
+      PROFILE_CPU("onDisplay");
+      pApp->onDisplay();
+    }
+    glCommands().Call([=] { endDamage(width, height); });
+    if (profiler)
+      profiler->EndFrame(width, height);
+    renderThread->Submit(width, height);
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+  beginDamage(width, height, partial, scissor);
+  {
+    PROFILE_GPU("onDisplay");
+    pApp->onDisplay();
+  }
+  endDamage(width, height);
+  if (capture) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreenFbo);
+    capture->Capture(width, height);
+  }
+  if (profiler) { // a kijelzés nem kerül a mentett képekre
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+    profiler->EndFrame(width, height);
+  }
+}
+
+#ifdef HEADLESS_EGL
+// Felület nélküli EGL környezet (Mesa llvmpipe alatt is megy)
+static bool createHeadlessContext(EGLDisplay &display, EGLContext &context) {
+  auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+      "eglGetPlatformDisplayEXT");
+  display = getPlatformDisplay
+                ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                     EGL_DEFAULT_DISPLAY, NULL)
+                : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+    return false;
+  eglBindAPI(EGL_OPENGL_API);
+  EGLint attributes[] = {EGL_CONTEXT_MAJOR_VERSION,
+                         majorNumber,
+                         EGL_CONTEXT_MINOR_VERSION,
+                         minorNumber,
+                         EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                         EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                         EGL_CONTEXT_OPENGL_DEBUG,
+                         debugRequested ? EGL_TRUE : EGL_FALSE,
+                         EGL_NONE};
+  context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+                             attributes);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    return false;
+  glLoader = (GLADloadproc)eglGetProcAddress;
+  return gladLoadGLLoader(glLoader) != 0;
+}
+#endif
+
+static int runHeadless() {
+#ifdef HEADLESS_EGL
+  EGLDisplay display;
+  EGLContext context;
+  bool created;
+  {
+    TRACE_SCOPE("createHeadlessContext");
+    created = createHeadlessContext(display, context);
+  }
+  if (!created) {
+    fprintf(stderr, "Error: cannot create headless EGL context (0x%x)\n",
+            eglGetError());
+    return EXIT_FAILURE;
+  }
+  startDebugOutput();
+
+  // Az ablak helyett ebbe rajzolunk
+  GLuint color, depth;
+  glGenFramebuffers(1, &offscreenFbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, windowWidth,
+                        windowHeight);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depth);
+  labelObject(GL_FRAMEBUFFER, offscreenFbo, "Headless framebuffer");
+  glViewport(0, 0, windowWidth, windowHeight);
+
+  {
+    TRACE_SCOPE("onInitialization");
+    pApp->onInitialization();
+  }
+  if (captureDirectory)
+    pApp->startCapture(captureDirectory);
+  if (profileFile)
+    pApp->enableProfiler(headlessFrames == 0, profileFile);
+
+  // Determinisztikus léptetés: minden képkocka pontosan headlessFrameTime,
+  // visszajátszáskor a felvett lépések (legfeljebb headlessFrames)
+  auto start = std::chrono::steady_clock::now();
+  uint64_t stepStart, stepEnd;
+  for (int frame = 0; frame < headlessFrames; frame++) {
+    TRACE_SCOPE("frame");
+    if (replayFile) {
+      if (!inputLog->Next(stepStart, stepEnd))
+        break;
+      virtualNanos = stepEnd;
+      auto frameStart = std::chrono::steady_clock::now();
+      dispatchInput();
+      advanceTime(stepStart, stepEnd);
+      if (screenRefresh) {
+        displayFrame(windowWidth, windowHeight);
+        glFinish(); // a GPU idő is számítson
+        replayFrameTimes.push_back(
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - frameStart)
+                .count());
+      }
+    } else {
+      virtualNanos += headlessFrameTime;
+      advanceTime(virtualNanos - headlessFrameTime, virtualNanos);
+      displayFrame(windowWidth, windowHeight);
+    }
+    screenRefresh = false;
+    partialRefresh = false; // a következő képkocka a saját sérülésével indul
+  }
+  glFinish();
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  if (replayFile)
+    printReplayTimings();
+  else
+    printf("Headless: %d frames, %.3f ms/frame\n", headlessFrames,
+           headlessFrames ? 1000.0 * elapsed / headlessFrames : 0.0);
+
+  delete inputLog;
+  delete jobSystem;
+  pApp->stopCapture();
+  pApp->disableProfiler();
+  if (traceEnabled)
+    dumpTrace();
+  renderTargetPool.Clear();
+  delete debugOutput;
+  debugOutput = nullptr;
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depth);
+  glDeleteFramebuffers(1, &offscreenFbo);
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+  return EXIT_SUCCESS;
+#else
+  fprintf(stderr, "Error: headless mode needs EGL\n");
+  return EXIT_FAILURE;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+  traceThreadName("main");
+  parseArguments(argc, argv);
+  if (benchJobsRequested)
+    exit(benchJobs());
+  if (recordFile || replayFile)
+    inputLog = new InputLog(replayFile ? replayFile : recordFile, replayFile);
+  virtualClock = headlessFrames > 0 || replayFile;
+  if (headlessFrames > 0)
+    exit(runHeadless());
 
-int main(void) {
   // Alkalmaz�i ablak l�trehoz�sa
   glfwSetErrorCallback(error_callback);
+  uint64_t traceStart = traceClock();
   if (!glfwInit())
     exit(EXIT_FAILURE);
+  traceEvent("glfwInit", traceStart, traceClock());
 
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, majorNumber);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorNumber);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  if (debugRequested)
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
 
+  traceStart = traceClock();
   window =
       glfwCreateWindow(windowWidth, windowHeight, windowCaption, NULL, NULL);
   if (!window) {
     glfwTerminate();
     exit(EXIT_FAILURE);
   }
+  traceEvent("glfwCreateWindow", traceStart, traceClock());
 
   // Esem�nykezel�k regisztr�l�sa
   // glfwSetKeyCallback(window, key_callback);
@@ -111,28 +2308,117 @@ int main(void) {
   glfwSetCursorPosCallback(window, cursor_position_callback);
   glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
+  traceStart = traceClock();
   glfwMakeContextCurrent(window);
   gladLoadGL();
-  glfwSwapInterval(1);
+  glLoader = (GLADloadproc)glfwGetProcAddress;
+  startDebugOutput();
+  applySwapInterval();
+  traceEvent("gladLoadGL", traceStart, traceClock());
 
   // Applik�ci� inicializ�l�sa
-  pApp->onInitialization();
-  float startTime = 0;
+  {
+    TRACE_SCOPE("onInitialization");
+    pApp->onInitialization();
+  }
+  if (captureDirectory)
+    pApp->startCapture(captureDirectory);
+  if (profileFile)
+    pApp->enableProfiler(headlessFrames == 0, profileFile);
+  if (latencyRequested && renderThreadRequested)
+    printf("Latency statistics are not available with the render thread\n");
+  else if (latencyRequested)
+    latency = new LatencyStats();
+  if (renderThreadRequested)
+    renderThread = new RenderThread();
+  uint64_t startTime = monotonicNanos(), wallStart = traceClock(), wallTotal = 0;
+  uint64_t cpuTotal = 0, cpuStart = threadCpuNanos();
+  bool dumpKeyDown = false;
 
   // �zenetkezel� hurok
   while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents(); // esem�nyek lek�rdez�se �s reakci�
+    uint64_t endTime;
+    if (replayFile) { // felvett események és idők
+      glfwPollEvents(); // csak az ablak miatt, a bemenet nem számít
+      if (!inputLog->Next(startTime, endTime))
+        break;
+      virtualNanos = endTime;
+    } else {
+      // eseményre várás vagy lekérdezés, majd reakció
+      if (waitForEvents())
+        startTime = monotonicNanos(); // a várakozás nem animációs idő
+      endTime = monotonicNanos();     // idő lekérdezése
+      if (inputLog)
+        inputLog->Frame(startTime, endTime);
+    }
+    auto frameStart = std::chrono::steady_clock::now();
 
-    float endTime = (float)glfwGetTime();    // id� lek�rdez�se
-    pApp->onTimeElapsed(startTime, endTime); // anim�ci�
+    dispatchInput();                 // képkockánként egyszer, sorrendben
+    advanceTime(startTime, endTime); // animáció
     startTime = endTime;
 
     if (screenRefresh) {
-      pApp->onDisplay();       // rajzol�s
-      glfwSwapBuffers(window); // buffercsere
+      TRACE_SCOPE("frame");
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      uint64_t displayStart = traceClock();
+      displayFrame(width, height); // rajzolás
+      if (!renderThread) {
+        traceStart = traceClock();
+        glfwSwapBuffers(window); // buffercsere
+        traceEvent("glfwSwapBuffers", traceStart, traceClock());
+      }
+      if (latency)
+        latency->Presented(displayStart);
+      if (frameLimitNanos > 0)
+        limitFrameRate();
       screenRefresh = false;
+      partialRefresh = false;
+      if (replayFile)
+        replayFrameTimes.push_back(
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - frameStart)
+                .count());
     }
+
+    if (latency)
+      latency->Poll();
+
+    // F12: nyomkövetés kiírása (lenyomáskor egyszer)
+    bool dumpKey = pollKey(GLFW_KEY_F12);
+    if (dumpKey && !dumpKeyDown && traceEnabled)
+      dumpTrace();
+    dumpKeyDown = dumpKey;
+
+    // CPU terhelés: a fő szál processzorideje / falióra idő
+    uint64_t wallEnd = traceClock();
+    uint64_t cpuEnd = threadCpuNanos();
+    if (wallEnd > wallStart)
+      frameCpuUtilization =
+          (float)std::min(1.0, (double)(cpuEnd - cpuStart) / (wallEnd - wallStart));
+    wallTotal += wallEnd - wallStart;
+    cpuTotal += cpuEnd - cpuStart;
+    wallStart = wallEnd;
+    cpuStart = cpuEnd;
   }
+  if (wallTotal > 0)
+    printf("Main thread CPU utilization: %.1f%% over %.1f s\n",
+           100.0 * cpuTotal / wallTotal, wallTotal * 1e-9);
+  delete renderThread; // a környezet visszakerül a fő szálra
+  renderThread = nullptr;
+  if (replayFile)
+    printReplayTimings();
+  delete latency;
+  delete inputLog;
+  delete jobSystem;
+  pApp->stopCapture();
+  pApp->disableProfiler();
+  if (traceEnabled)
+    dumpTrace();
+  delete backBuffer;
+  renderTargetPool.Clear();
+  delete debugOutput;
+  debugOutput = nullptr;
   glfwDestroyWindow(window);
   glfwTerminate();
   exit(EXIT_SUCCESS);
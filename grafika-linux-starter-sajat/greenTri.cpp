@@ -34,7 +34,9 @@ class GreenTriangleApp : public glApp {
   Geometry<vec2> *triangle; // geometria
   GPUProgram *gpuProgram;   // cs�cspont �s pixel �rnyal�k
 public:
-  GreenTriangleApp() : glApp("Green triangle") {}
+  GreenTriangleApp() : glApp("Green triangle") {
+    enableRenderThread(); // minden rajzolás glCommands()-on át megy
+  }
 
   // Inicializ�ci�,
   void onInitialization() {
@@ -47,9 +49,9 @@ public:
 
   // Ablak �jrarajzol�s
   void onDisplay() {
-    glClearColor(0, 0, 0, 0);     // h�tt�r sz�n
-    glClear(GL_COLOR_BUFFER_BIT); // rasztert�r t�rl�s
-    glViewport(0, 0, winWidth, winHeight);
+    glCommands().ClearColor(0, 0, 0, 0);     // h�tt�r sz�n
+    glCommands().Clear(GL_COLOR_BUFFER_BIT); // rasztert�r t�rl�s
+    glCommands().Viewport(0, 0, winWidth, winHeight);
     triangle->Draw(gpuProgram, GL_TRIANGLES, vec3(0.0f, 1.0f, 0.0f));
   }
 };
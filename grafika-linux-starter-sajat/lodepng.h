@@ -91,6 +91,24 @@ or comment out LODEPNG_COMPILE_ALLOCATORS below*/
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
 
+/*x86 SIMD code paths (SSE2, SSSE3, AVX2) for the hot loops, chosen at runtime with CPUID so
+the same binary runs on any x86 CPU. The portable code is always compiled as well: it is used on
+other architectures and compilers, on CPUs without the required instruction set, and serves as
+the reference the SIMD versions must match byte for byte.*/
+#ifndef LODEPNG_NO_COMPILE_SIMD
+/*pass -DLODEPNG_NO_COMPILE_SIMD to the compiler to disable this,
+or comment out LODEPNG_COMPILE_SIMD below*/
+#define LODEPNG_COMPILE_SIMD
+#endif
+
+/*multithreaded deflate, see the threads setting of LodePNGCompressSettings. It uses std::thread, so it is only
+compiled in when lodepng.cpp is compiled as C++11 or newer, otherwise the setting is ignored.*/
+#ifndef LODEPNG_NO_COMPILE_THREADS
+/*pass -DLODEPNG_NO_COMPILE_THREADS to the compiler to disable this,
+or comment out LODEPNG_COMPILE_THREADS below*/
+#define LODEPNG_COMPILE_THREADS
+#endif
+
 /*Disable built-in CRC function, in that case a custom implementation of
 lodepng_crc32 must be defined externally so that it can be linked in.
 The default built-in CRC code comes with 8KB of lookup tables, so for memory constrained environment you may want it
@@ -343,6 +361,20 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
+/*The LZ77 match finder of deflate, from the smallest to the fastest output*/
+typedef enum LodePNGCompressLevel {
+  /*hash chain search, tuned with windowsize, minmatch, nicematch and lazymatching*/
+  LCL_DEFAULT = 0,
+  /*greedy: one probe in a hash table of 4 bytes per position, takes that match if there is one. Of the tuning
+  settings only windowsize is used, and minmatch if above 4*/
+  LCL_FAST = 1,
+  /*only repeats of the previous byte (distance 1), such as runs of filtered flat colors. Fast, and not much larger
+  than LCL_FAST for screenshots of flat color UI*/
+  LCL_RLE = 2,
+  /*no LZ77 at all, the bytes are only Huffman coded, same as use_lz77 0*/
+  LCL_HUFFMAN_ONLY = 3
+} LodePNGCompressLevel;
+
 /*
 Settings for zlib compression. Tweaking these settings tweaks the balance
 between speed and compression ratio.
@@ -356,6 +388,12 @@ struct LodePNGCompressSettings /*deflate = compress*/ {
   unsigned minmatch; /*minimum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  LodePNGCompressLevel level; /*the match finder, the faster ones trade ratio for speed. Default: LCL_DEFAULT*/
+  /*number of threads for deflate, 0 for one per hardware thread. With more than 1, the input is cut in chunks of
+  256 KiB that are compressed independently and joined with sync flushes. That output is a few bytes per chunk larger
+  and differs from the single threaded one, but is the same for any number of threads. The PNG encoder also uses
+  these threads to choose the filters of the adaptive filter strategies, that doesn't change the output. Default: 1*/
+  unsigned threads;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -893,6 +931,76 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Streaming decoder: instead of the whole file at once, the PNG is pushed in pieces of any size, as they arrive from a
+file or the network, and every row is given to a callback as soon as it is decoded. Only the previous row and the
+32 KiB inflate window are kept, so the memory used stays at a few rows besides the pushed pieces, and the image
+never needs to exist as a whole.
+The rows are in the color type of state->info_raw, or of the PNG if color_convert is off, like with lodepng_decode.
+Unlike there, each row starts at a whole byte for bit depths below 8. y counts from 0 to h - 1 in order.
+Adam7 interlaced images can only be output once all passes are known, these are buffered as a whole and their rows
+are given to the callback at the IEND chunk, or at lodepng_stream_decoder_finish.
+The built-in inflate is always used, the custom_zlib and custom_inflate settings do not apply.
+Return nonzero from the callback to stop decoding, the push then fails with error 116.
+IDAT data is decoded before the CRC of its chunk arrives. Errors in it are returned by the push that completes
+the chunk, as 57 if the CRC does not match, the same as lodepng_decode.
+*/
+typedef unsigned (*LodePNGRowCallback)(void* user, const unsigned char* row, size_t rowsize,
+                                       unsigned y, unsigned w, unsigned h);
+
+typedef struct LodePNGStreamDecoder LodePNGStreamDecoder;
+
+/*
+Creates a streaming decoder. The state holds the settings and receives the PNG info like with lodepng_decode,
+it must stay alive until the decoder is destroyed.
+*/
+unsigned lodepng_stream_decoder_create(LodePNGStreamDecoder** decoder, LodePNGState* state,
+                                       LodePNGRowCallback callback, void* user);
+/*Pushes the next piece of the PNG file, the callback is called for every row it completes. Returns error code,
+once an error happened it is returned by all further calls.*/
+unsigned lodepng_stream_decoder_push(LodePNGStreamDecoder* decoder, const unsigned char* in, size_t insize);
+/*Call after pushing the whole file, returns error code if the file was not complete.*/
+unsigned lodepng_stream_decoder_finish(LodePNGStreamDecoder* decoder);
+void lodepng_stream_decoder_destroy(LodePNGStreamDecoder* decoder);
+/*
+Makes the decoder give a reduced preview instead of the whole image: scale 2, 4 or 8 gives the pixels at
+(x * scale, y * scale), so the callback receives ceil(w / scale) by ceil(h / scale) pixels. Must be called before
+the image data is pushed, 1 switches back to the whole image. Returns error 118 for other scales or when too late.
+For an interlaced image these pixels are exactly the Adam7 passes 1 to 5, 1 to 3 or only 1, and only the first
+quarter, 1/16 or 1/64 of the image data is inflated: once those passes are complete the decoder is done and the
+rest of the file is neither needed nor checked. Some of the data pushed may be held back until more follows, finish
+uses it, so a file cut off anywhere after the passes gives the whole preview. For a non-interlaced image all rows
+must still be inflated and unfiltered, but only the sampled pixels are converted and given to the callback.
+*/
+unsigned lodepng_stream_decoder_set_scale(LodePNGStreamDecoder* decoder, unsigned scale);
+/*Returns 1 once the decoder needs no more data: after IEND, or after the passes of an interlaced preview.*/
+unsigned lodepng_stream_decoder_done(const LodePNGStreamDecoder* decoder);
+
+/*
+Decodes a preview of ceil(w / scale) by ceil(h / scale) pixels into a new buffer, w and h receive that size. See
+lodepng_stream_decoder_set_scale for the scales and what is decoded. The output is like that of lodepng_decode,
+except that rows of less than 8 bits per pixel each start at a new byte, as with lodepng_decode_into.
+*/
+unsigned lodepng_decode_preview(unsigned char** out, unsigned* w, unsigned* h, unsigned scale,
+                                LodePNGState* state, const unsigned char* in, size_t insize);
+
+/*
+Decodes into memory given by the caller, such as a mapped GL pixel buffer, instead of allocating the output.
+Row y is written at out + y * pitch, in the color type of state->info_raw like with lodepng_decode. Like with the
+streaming decoder, each row starts at a whole byte also for bit depths below 8. pitch must be at least the size of
+one row and outsize at least (h - 1) * pitch plus one row, else error 117 is returned before anything is written.
+Use lodepng_inspect first to learn the size. Besides out only a few rows of memory are used.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t pitch, unsigned* w, unsigned* h,
+                             LodePNGState* state, const unsigned char* in, size_t insize);
+
+/*Same as lodepng_decode_into, but with the settings and color type choice of lodepng_decode_memory.*/
+unsigned lodepng_decode_memory_into(unsigned char* out, size_t outsize, size_t pitch, unsigned* w, unsigned* h,
+                                    const unsigned char* in, size_t insize,
+                                    LodePNGColorType colortype, unsigned bitdepth);
+#endif /*LODEPNG_COMPILE_ZLIB*/
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /*
@@ -7,10 +7,21 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
 #include <math.h>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #define FILE_OPERATIONS
@@ -33,11 +44,337 @@ inline mat4 rotate(float angle, const vec3 &v) {
   return rotate(mat4(1.0f), angle, v);
 }
 
+// Nyomkövetés Chrome trace_event JSON formátumba (Perfetto, chrome://tracing).
+// A nevek statikus szövegek legyenek, az eseményeket csak a mutató tárolja.
+extern std::atomic<bool> traceEnabled;
+uint64_t traceClock(); // nanoszekundum
+void traceEvent(const char *name, uint64_t start, uint64_t end);
+void traceThreadName(const char *name);
+void startTracing(const char *file = "trace.json");
+bool dumpTrace(); // a startTracing fájljába
+
+struct TraceScope {
+  const char *name;
+  uint64_t start = 0;
+  TraceScope(const char *_name) : name(_name) {
+    if (traceEnabled.load(std::memory_order_relaxed))
+      start = traceClock();
+  }
+  ~TraceScope() {
+    if (start)
+      traceEvent(name, start, traceClock());
+  }
+};
+#define SCOPE_CONCAT_(a, b) a##b
+#define SCOPE_CONCAT(a, b) SCOPE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope SCOPE_CONCAT(traceScope, __LINE__)(name)
+
+// GL_KHR_debug objektumnév (hibakeresőkben, driver üzenetekben látszik);
+// csak bekapcsolt debug módban hat, az objektumnak már kötve kellett lennie
+void labelObject(GLenum identifier, GLuint name, const std::string &label);
+
+//---------------------------
+class CommandList {
+  //---------------------------
+  // Rögzített GL parancsok a renderszálnak. A parancsok 32 bites szavak
+  // folyamában vannak, a változó hosszú adat (uniform értékek, pufferek
+  // tartalma) képkockánként újrahasznosított arénában. Ha nincs rögzítés
+  // (immediate), minden hívás azonnal végrehajtódik.
+  enum Op : uint32_t {
+    CLEAR_COLOR,
+    CLEAR,
+    VIEWPORT,
+    SCISSOR,
+    ENABLE,
+    DISABLE,
+    BLEND_FUNC,
+    POINT_SIZE,
+    LINE_WIDTH,
+    USE_PROGRAM,
+    UNIFORM_1I,
+    UNIFORM_FLOATS, // location, float darab, aréna offset
+    BIND_VERTEX_ARRAY,
+    BIND_BUFFER,
+    BUFFER_DATA, // cél, puffer, méret, használat, aréna offset
+    BIND_TEXTURE,
+    DRAW_ARRAYS,
+    CALL // tetszőleges függvény a calls tömbből
+  };
+  bool immediate;
+  std::vector<uint32_t> stream;
+  std::vector<unsigned char> arena;
+  std::vector<std::function<void()>> calls;
+
+  static uint32_t Word(float f) {
+    uint32_t w;
+    memcpy(&w, &f, sizeof(w));
+    return w;
+  }
+  static float Float(uint32_t w) {
+    float f;
+    memcpy(&f, &w, sizeof(f));
+    return f;
+  }
+  void Put(std::initializer_list<uint32_t> words) {
+    stream.insert(stream.end(), words);
+  }
+  uint32_t Allocate(const void *data, size_t size) {
+    size_t offset = (arena.size() + 15) & ~(size_t)15; // 16 bájtra igazítva
+    arena.resize(offset + size);
+    if (size > 0)
+      memcpy(&arena[offset], data, size);
+    return (uint32_t)offset;
+  }
+
+public:
+  CommandList(bool _immediate = false) : immediate(_immediate) {}
+  bool Immediate() const { return immediate; }
+  size_t Size() const { return stream.size() * 4 + arena.size(); } // bájt
+
+  void Reset() { // a lefoglalt tár megmarad
+    stream.clear();
+    arena.clear();
+    calls.clear();
+  }
+
+  void ClearColor(float r, float g, float b, float a) {
+    if (immediate)
+      glClearColor(r, g, b, a);
+    else
+      Put({CLEAR_COLOR, Word(r), Word(g), Word(b), Word(a)});
+  }
+  void Clear(GLbitfield mask) {
+    if (immediate)
+      glClear(mask);
+    else
+      Put({CLEAR, mask});
+  }
+  void Viewport(int x, int y, int width, int height) {
+    if (immediate)
+      glViewport(x, y, width, height);
+    else
+      Put({VIEWPORT, (uint32_t)x, (uint32_t)y, (uint32_t)width,
+           (uint32_t)height});
+  }
+  void Scissor(int x, int y, int width, int height) {
+    if (immediate)
+      glScissor(x, y, width, height);
+    else
+      Put({SCISSOR, (uint32_t)x, (uint32_t)y, (uint32_t)width,
+           (uint32_t)height});
+  }
+  void Enable(GLenum capability) {
+    if (immediate)
+      glEnable(capability);
+    else
+      Put({ENABLE, capability});
+  }
+  void Disable(GLenum capability) {
+    if (immediate)
+      glDisable(capability);
+    else
+      Put({DISABLE, capability});
+  }
+  void BlendFunc(GLenum source, GLenum destination) {
+    if (immediate)
+      glBlendFunc(source, destination);
+    else
+      Put({BLEND_FUNC, source, destination});
+  }
+  void PointSize(float size) {
+    if (immediate)
+      glPointSize(size);
+    else
+      Put({POINT_SIZE, Word(size)});
+  }
+  void LineWidth(float width) {
+    if (immediate)
+      glLineWidth(width);
+    else
+      Put({LINE_WIDTH, Word(width)});
+  }
+  void UseProgram(GLuint program) {
+    if (immediate)
+      glUseProgram(program);
+    else
+      Put({USE_PROGRAM, program});
+  }
+  void Uniform(int location, int i) {
+    if (immediate)
+      glUniform1i(location, i);
+    else
+      Put({UNIFORM_1I, (uint32_t)location, (uint32_t)i});
+  }
+  // 1, 2, 3, 4 float vagy 16 float (mat4)
+  void Uniform(int location, const float *values, int count) {
+    if (immediate)
+      ExecuteUniform(location, values, count);
+    else
+      Put({UNIFORM_FLOATS, (uint32_t)location, (uint32_t)count,
+           Allocate(values, count * sizeof(float))});
+  }
+  void BindVertexArray(GLuint vao) {
+    if (immediate)
+      glBindVertexArray(vao);
+    else
+      Put({BIND_VERTEX_ARRAY, vao});
+  }
+  void BindBuffer(GLenum target, GLuint buffer) {
+    if (immediate)
+      glBindBuffer(target, buffer);
+    else
+      Put({BIND_BUFFER, target, buffer});
+  }
+  // A tartalom rögzítéskor átmásolódik, utána a forrás szabadon változhat
+  void BufferData(GLenum target, GLuint buffer, size_t size, const void *data,
+                  GLenum usage) {
+    if (immediate) {
+      glBindBuffer(target, buffer);
+      glBufferData(target, size, data, usage);
+    } else {
+      Put({BUFFER_DATA, target, buffer, (uint32_t)size, usage,
+           Allocate(data, size)});
+    }
+  }
+  void BindTexture(int unit, GLenum target, GLuint texture) {
+    if (immediate) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glBindTexture(target, texture);
+    } else {
+      Put({BIND_TEXTURE, (uint32_t)unit, target, texture});
+    }
+  }
+  void DrawArrays(GLenum mode, int first, int count) {
+    if (immediate)
+      glDrawArrays(mode, first, count);
+    else
+      Put({DRAW_ARRAYS, mode, (uint32_t)first, (uint32_t)count});
+  }
+  // Bármilyen más GL munka; a renderszálon fut le
+  void Call(std::function<void()> function) {
+    if (immediate) {
+      function();
+    } else {
+      Put({CALL, (uint32_t)calls.size()});
+      calls.push_back(std::move(function));
+    }
+  }
+
+  static void ExecuteUniform(int location, const float *v, int count) {
+    switch (count) {
+    case 1:
+      glUniform1f(location, v[0]);
+      break;
+    case 2:
+      glUniform2fv(location, 1, v);
+      break;
+    case 3:
+      glUniform3fv(location, 1, v);
+      break;
+    case 4:
+      glUniform4fv(location, 1, v);
+      break;
+    case 16:
+      glUniformMatrix4fv(location, 1, GL_FALSE, v);
+      break;
+    }
+  }
+
+  void Replay() const {
+    const uint32_t *w = stream.data(), *end = w + stream.size();
+    while (w < end) {
+      switch (*w) {
+      case CLEAR_COLOR:
+        glClearColor(Float(w[1]), Float(w[2]), Float(w[3]), Float(w[4]));
+        w += 5;
+        break;
+      case CLEAR:
+        glClear(w[1]);
+        w += 2;
+        break;
+      case VIEWPORT:
+        glViewport((int)w[1], (int)w[2], (int)w[3], (int)w[4]);
+        w += 5;
+        break;
+      case SCISSOR:
+        glScissor((int)w[1], (int)w[2], (int)w[3], (int)w[4]);
+        w += 5;
+        break;
+      case ENABLE:
+        glEnable(w[1]);
+        w += 2;
+        break;
+      case DISABLE:
+        glDisable(w[1]);
+        w += 2;
+        break;
+      case BLEND_FUNC:
+        glBlendFunc(w[1], w[2]);
+        w += 3;
+        break;
+      case POINT_SIZE:
+        glPointSize(Float(w[1]));
+        w += 2;
+        break;
+      case LINE_WIDTH:
+        glLineWidth(Float(w[1]));
+        w += 2;
+        break;
+      case USE_PROGRAM:
+        glUseProgram(w[1]);
+        w += 2;
+        break;
+      case UNIFORM_1I:
+        glUniform1i((int)w[1], (int)w[2]);
+        w += 3;
+        break;
+      case UNIFORM_FLOATS:
+        ExecuteUniform((int)w[1], (const float *)&arena[w[3]], (int)w[2]);
+        w += 4;
+        break;
+      case BIND_VERTEX_ARRAY:
+        glBindVertexArray(w[1]);
+        w += 2;
+        break;
+      case BIND_BUFFER:
+        glBindBuffer(w[1], w[2]);
+        w += 3;
+        break;
+      case BUFFER_DATA:
+        glBindBuffer(w[1], w[2]);
+        glBufferData(w[1], w[3], w[3] > 0 ? &arena[w[5]] : nullptr, w[4]);
+        w += 6;
+        break;
+      case BIND_TEXTURE:
+        glActiveTexture(GL_TEXTURE0 + w[1]);
+        glBindTexture(w[2], w[3]);
+        w += 4;
+        break;
+      case DRAW_ARRAYS:
+        glDrawArrays(w[1], (int)w[2], (int)w[3]);
+        w += 4;
+        break;
+      case CALL:
+        calls[w[1]]();
+        w += 2;
+        break;
+      default:
+        return;
+      }
+    }
+  }
+};
+
+// Az aktuális parancslista: renderszálas módban a rögzítés alatt álló
+// lista, egyébként azonnal végrehajtó
+CommandList &glCommands();
+
 //---------------------------
 class GPUProgram {
   //--------------------------
   GLuint shaderProgramId = 0;
   bool waitError = true;
+  std::unordered_map<std::string, int> locations; // szerkesztéskor kitöltve
 
   bool checkShader(unsigned int shader,
                    std::string message) { // shader ford�t�si hib�k kezel�se
@@ -76,9 +413,17 @@ class GPUProgram {
 
   int getLocation(
       const std::string &name) { // uniform v�ltoz� c�m�nek lek�rdez�se
-    int location = glGetUniformLocation(shaderProgramId, name.c_str());
+    auto it = locations.find(name);
+    if (it != locations.end())
+      return it->second;
+    // tömbelem, pl. "lights[2]": rögzítés közben nem kérdezhető le
+    int location = glCommands().Immediate()
+                       ? glGetUniformLocation(shaderProgramId, name.c_str())
+                       : -1;
     if (location < 0)
       printf("uniform %s cannot be set\n", name.c_str());
+    else
+      locations[name] = location;
     return location;
   }
 
@@ -137,6 +482,7 @@ public:
   void create(const char *const vertexShaderSource,
               const char *const fragmentShaderSource,
               const char *const geometryShaderSource = nullptr) {
+    TRACE_SCOPE("GPUProgram::create");
     // Program l�trehoz�sa a forr�s sztringb�l
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
     if (!vertexShader) {
@@ -181,6 +527,12 @@ public:
       printf("Error in shader program creation\n");
       exit(-1);
     }
+    std::string label = "GPUProgram " + std::to_string(shaderProgramId);
+    labelObject(GL_PROGRAM, shaderProgramId, label);
+    labelObject(GL_SHADER, vertexShader, label + " vertex");
+    labelObject(GL_SHADER, fragmentShader, label + " fragment");
+    if (geometryShader > 0)
+      labelObject(GL_SHADER, geometryShader, label + " geometry");
     glAttachShader(shaderProgramId, vertexShader);
     glAttachShader(shaderProgramId, fragmentShader);
     if (geometryShader > 0)
@@ -218,6 +570,7 @@ public:
   }
 
   bool addShader(GLenum shaderType, const fs::path &_fileName) {
+    TRACE_SCOPE("GPUProgram::addShader");
     std::string shaderCode = file2string(_fileName);
     GLuint shaderID = glCreateShader(shaderType);
     if (!shaderID) {
@@ -230,54 +583,83 @@ public:
     glCompileShader(shaderID);
     if (!checkShader(shaderID, shaderType2string(shaderType) + " shader error"))
       return false;
-    if (shaderProgramId == 0)
+    labelObject(GL_SHADER, shaderID, _fileName.filename().string());
+    if (shaderProgramId == 0) {
       shaderProgramId = glCreateProgram();
+      labelObject(GL_PROGRAM, shaderProgramId, _fileName.stem().string());
+    }
     glAttachShader(shaderProgramId, shaderID);
     return true;
   }
 #endif
 
   bool link() {
+    TRACE_SCOPE("GPUProgram::link");
     glLinkProgram(shaderProgramId);
-    return checkLinking(shaderProgramId);
+    if (!checkLinking(shaderProgramId))
+      return false;
+    // Az aktív uniformok helye, hogy később ne kelljen a GL-t kérdezni
+    locations.clear();
+    GLint count = 0;
+    glGetProgramiv(shaderProgramId, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; i++) {
+      char name[256];
+      GLint size;
+      GLenum type;
+      glGetActiveUniform(shaderProgramId, i, sizeof(name), nullptr, &size,
+                         &type, name);
+      std::string uniform = name;
+      int location = glGetUniformLocation(shaderProgramId, name);
+      if (uniform.size() > 3 &&
+          uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+        uniform.resize(uniform.size() - 3); // tömb: a név az első elem
+      locations[uniform] = location;
+    }
+    return true;
   }
 
-  void Use() { glUseProgram(shaderProgramId); } // make this program run
+  void setLabel(const std::string &label) { // debug módban látszik
+    labelObject(GL_PROGRAM, shaderProgramId, label);
+  }
+
+  void Use() { // make this program run
+    glCommands().UseProgram(shaderProgramId);
+  }
 
   void setUniform(int i, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniform1i(location, i);
+      glCommands().Uniform(location, i);
   }
 
   void setUniform(float f, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniform1f(location, f);
+      glCommands().Uniform(location, &f, 1);
   }
 
   void setUniform(const vec2 &v, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniform2fv(location, 1, &v.x);
+      glCommands().Uniform(location, &v.x, 2);
   }
 
   void setUniform(const vec3 &v, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniform3fv(location, 1, &v.x);
+      glCommands().Uniform(location, &v.x, 3);
   }
 
   void setUniform(const vec4 &v, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniform4fv(location, 1, &v.x);
+      glCommands().Uniform(location, &v.x, 4);
   }
 
   void setUniform(const mat4 &mat, const std::string &name) {
     int location = getLocation(name);
     if (location >= 0)
-      glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+      glCommands().Uniform(location, &mat[0][0], 16);
   }
 
   ~GPUProgram() {
@@ -301,22 +683,25 @@ public:
     glEnableVertexAttribArray(0);
     int nf = min((int)(sizeof(T) / sizeof(float)), 4);
     glVertexAttribPointer(0, nf, GL_FLOAT, GL_FALSE, 0, NULL);
+    std::string label = "Geometry " + std::to_string(vao);
+    labelObject(GL_VERTEX_ARRAY, vao, label);
+    labelObject(GL_BUFFER, vbo, label + " vertices");
   }
   std::vector<T> &Vtx() { return vtx; }
   void updateGPU() { // CPU -> GPU
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vtx.size() * sizeof(T), &vtx[0],
-                 GL_DYNAMIC_DRAW);
+    glCommands().BufferData(GL_ARRAY_BUFFER, vbo, vtx.size() * sizeof(T),
+                            vtx.data(), GL_DYNAMIC_DRAW);
   }
   void Bind() {
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glCommands().BindVertexArray(vao);
+    glCommands().BindBuffer(GL_ARRAY_BUFFER, vbo);
   } // aktiv�l�s
   void Draw(GPUProgram *prog, int type, vec3 color) {
     if (vtx.size() > 0) {
       prog->setUniform(color, "color");
-      glBindVertexArray(vao);
-      glDrawArrays(type, 0, (int)vtx.size());
+      CommandList &commands = glCommands();
+      commands.BindVertexArray(vao);
+      commands.DrawArrays(type, 0, (int)vtx.size());
     }
   }
   virtual ~Geometry() {
@@ -330,44 +715,162 @@ class Texture {
   //---------------------------
   unsigned int textureId = 0;
 
+#ifdef FILE_OPERATIONS
+  // PNG betöltés: a dekóder sorai egyenesen egy leképezett PBO-ba kerülnek,
+  // így a kép egészében sosem létezik a heapen
+  struct PixelUpload {
+    bool transparent = false;
+    unsigned int width = 0, height = 0;
+    size_t pitch = 0; // 4 bájtra kerekítve, ez a GL_UNPACK_ALIGNMENT alapértéke
+    GLuint pbo = 0;
+    unsigned char *pixels = nullptr;     // a leképezett PBO vagy a tartalék
+    std::vector<unsigned char> fallback; // ha a leképezés nem sikerül
+
+    void Begin(unsigned w, unsigned h) {
+      width = w;
+      height = h;
+      pitch = ((transparent ? 4 : 3) * (size_t)w + 3) & ~(size_t)3;
+      size_t size = pitch * h;
+      glGenBuffers(1, &pbo);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+      pixels = (unsigned char *)glMapBufferRange(
+          GL_PIXEL_UNPACK_BUFFER, 0, size,
+          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if (!pixels) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+        fallback.resize(size);
+        pixels = fallback.data();
+      }
+    }
+
+    static unsigned Row(void *user, const unsigned char *row, size_t rowsize,
+                        unsigned y, unsigned w, unsigned h) {
+      PixelUpload &upload = *(PixelUpload *)user;
+      if (y == 0)
+        upload.Begin(w, h);
+      unsigned char *dst = upload.pixels + y * upload.pitch;
+      if (!upload.transparent) {
+        memcpy(dst, row, rowsize);
+        return 0;
+      }
+      for (unsigned x = 0; x < w; ++x) { // átlátszóság a fényességből
+        const unsigned char *src = row + 4 * x;
+        dst[4 * x + 0] = src[0];
+        dst[4 * x + 1] = src[1];
+        dst[4 * x + 2] = src[2];
+        dst[4 * x + 3] = (unsigned char)((src[0] + src[1] + src[2]) / 6);
+      }
+      return 0;
+    }
+
+    // scale > 1: csak minden scale-edik sor minden scale-edik pixele (előnézet)
+    unsigned Decode(const fs::path &pathname, unsigned scale = 1) {
+      FILE *file = fopen(pathname.string().c_str(), "rb");
+      if (!file)
+        return 78; // lodepng: failed to open file for reading
+      LodePNGState state;
+      lodepng_state_init(&state);
+      state.info_raw.colortype = transparent ? LCT_RGBA : LCT_RGB;
+      state.info_raw.bitdepth = 8;
+      LodePNGStreamDecoder *decoder = nullptr;
+      unsigned error =
+          lodepng_stream_decoder_create(&decoder, &state, Row, this);
+      if (!error)
+        error = lodepng_stream_decoder_set_scale(decoder, scale);
+      std::vector<unsigned char> chunk(1 << 16);
+      size_t n;
+      // váltottsoros képnél az előnézethez a fájl eleje is elég
+      while (!error && !lodepng_stream_decoder_done(decoder) &&
+             (n = fread(chunk.data(), 1, chunk.size(), file)) > 0)
+        error = lodepng_stream_decoder_push(decoder, chunk.data(), n);
+      if (!error)
+        error = lodepng_stream_decoder_finish(decoder);
+      lodepng_stream_decoder_destroy(decoder);
+      lodepng_state_cleanup(&state);
+      fclose(file);
+      return error;
+    }
+
+    // feltöltés a kötött textúrába, a PBO-t hiba esetén is felszabadítja
+    void Upload(bool decoded) {
+      if (pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+          decoded = false; // a tartalom elveszett
+      }
+      if (decoded && pixels) {
+        GLenum format = transparent ? GL_RGBA : GL_RGB;
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+                     GL_UNSIGNED_BYTE, pbo ? NULL : fallback.data()); // GPU-ra
+      }
+      if (pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+      }
+    }
+  };
+  fs::path refinePath; // nem üres, amíg csak az előnézet van a GPU-n
+  bool refineTransparent = false;
+
+  unsigned Load(const fs::path &pathname, bool transparent, unsigned scale) {
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    PixelUpload upload;
+    upload.transparent = transparent;
+    unsigned error;
+    {
+      TRACE_SCOPE("Texture decode");
+      error = upload.Decode(pathname, scale);
+    }
+    {
+      TRACE_SCOPE("Texture upload");
+      upload.Upload(error == 0);
+    }
+    if (error)
+      printf("%s: %s\n", pathname.string().c_str(), lodepng_error_text(error));
+    else
+      printf("%s, w: %d, h: %d\n", pathname.string().c_str(), upload.width,
+             upload.height);
+    return error;
+  }
+#endif
+
 public:
 #ifdef FILE_OPERATIONS
+  // preview = 2, 4 vagy 8: először csak egy ennyiszer kisebb előnézet kerül
+  // a GPU-ra, a teljes képet a Refine tölti be később
   Texture(const fs::path pathname, bool transparent = false,
-          int sampling = GL_LINEAR) {
+          int sampling = GL_LINEAR, unsigned preview = 1) {
     if (textureId == 0)
       glGenTextures(1, &textureId);          // azonos�t� gener�l�s
     glBindTexture(GL_TEXTURE_2D, textureId); // k�t�s
-    unsigned int width, height;
-    unsigned char *pixels;
-    if (transparent) {
-      lodepng_decode32_file(&pixels, &width, &height,
-                            pathname.string().c_str());
-      for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-          float sum = 0;
-          for (int c = 0; c < 3; ++c) {
-            sum += pixels[4 * (x + y * width) + c];
-          }
-          pixels[4 * (x + y * width) + 3] = sum / 6;
-        }
-      }
-
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                   GL_UNSIGNED_BYTE, pixels); // GPU-ra
-    } else {
-      lodepng_decode24_file(&pixels, &width, &height,
-                            pathname.string().c_str());
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                   GL_UNSIGNED_BYTE, pixels); // GPU-ra
+    labelObject(GL_TEXTURE, textureId, pathname.filename().string());
+    if (Load(pathname, transparent, preview) == 0 && preview > 1) {
+      refinePath = pathname;
+      refineTransparent = transparent;
     }
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling); // sz�r�s
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampling);
-    printf("%s, w: %d, h: %d\n", pathname.string().c_str(), width, height);
+  }
+
+  // az előnézet cseréje a teljes képre; true, ha nincs (már) mit finomítani
+  bool Refine() {
+    if (refinePath.empty())
+      return true;
+    if (Load(refinePath, refineTransparent, 1) != 0)
+      return false; // az előnézet marad
+    refinePath.clear();
+    return true;
   }
 #endif
   Texture(int width, int height) {
     glGenTextures(1, &textureId);            // azonos�t� gener�l�sa
     glBindTexture(GL_TEXTURE_2D, textureId); // ez az akt�v innent�l
+    labelObject(GL_TEXTURE, textureId,
+                "Checkerboard " + std::to_string(width) + "x" +
+                    std::to_string(height));
     // procedur�lis text�ra el��ll�t�sa programmal
     const vec3 yellow(1, 1, 0), blue(0, 0, 1);
     std::vector<vec3> image(width * height);
@@ -385,6 +888,9 @@ public:
   Texture(int width, int height, std::vector<vec3> &image) {
     glGenTextures(1, &textureId);            // azonos�t� gener�l�sa
     glBindTexture(GL_TEXTURE_2D, textureId); // ez az akt�v innent�l
+    labelObject(GL_TEXTURE, textureId,
+                "Texture " + std::to_string(width) + "x" +
+                    std::to_string(height));
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT,
                  &image[0]); // To GPU
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
@@ -393,8 +899,7 @@ public:
   }
 
   void Bind(int textureUnit) {
-    glActiveTexture(GL_TEXTURE0 + textureUnit); // aktiv�l�s
-    glBindTexture(GL_TEXTURE_2D, textureId);    // piros ny�l
+    glCommands().BindTexture(textureUnit, GL_TEXTURE_2D, textureId);
   }
   ~Texture() {
     if (textureId > 0)
@@ -402,6 +907,650 @@ public:
   }
 };
 
+//---------------------------
+class RenderTarget {
+  //---------------------------
+  // Textúrába rajzolás FBO-val. Többmintás változatnál a rajzolás egy
+  // többmintás renderbufferbe megy, az End() glBlitFramebuffer-rel oldja fel a
+  // mintavételezhető textúrába. A létrehozás közvetlen GL hívás (mint a
+  // Texture-nél), a Begin/End/Bind viszont renderszálas módban is működik.
+  int width, height, samples, requestedSamples;
+  GLenum colorFormat;
+  bool depth;
+  GLuint fbo = 0, colorTexture = 0, depthBuffer = 0; // feloldott
+  GLuint msaaFbo = 0, msaaColor = 0;                  // többmintás
+  GLint savedFramebuffer = 0, savedViewport[4];
+
+  GLuint CreateRenderbuffer(GLenum format, GLenum attachment) {
+    GLuint buffer;
+    glGenRenderbuffers(1, &buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, buffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width,
+                                     height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER,
+                              buffer);
+    return buffer;
+  }
+
+public:
+  // colorFormat: nem egész belső formátum (GL_RGBA8, GL_RGBA16F, ...)
+  RenderTarget(int _width, int _height, GLenum _colorFormat = GL_RGBA8,
+               bool _depth = true, int _samples = 0)
+      : width(_width), height(_height), samples(_samples),
+        requestedSamples(_samples), colorFormat(_colorFormat), depth(_depth) {
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    samples = max(0, min(samples, (int)maxSamples));
+    GLint savedBinding;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedBinding);
+    std::string label = "RenderTarget " + std::to_string(width) + "x" +
+                        std::to_string(height);
+
+    glGenTextures(1, &colorTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, colorFormat, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           colorTexture, 0);
+    if (depth && samples == 0)
+      depthBuffer =
+          CreateRenderbuffer(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL_ATTACHMENT);
+    labelObject(GL_TEXTURE, colorTexture, label);
+    labelObject(GL_FRAMEBUFFER, fbo, label);
+    bool complete =
+        glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    if (samples > 0) { // a mélység csak a többmintás oldalon kell
+      glGenFramebuffers(1, &msaaFbo);
+      glBindFramebuffer(GL_FRAMEBUFFER, msaaFbo);
+      msaaColor = CreateRenderbuffer(colorFormat, GL_COLOR_ATTACHMENT0);
+      if (depth)
+        depthBuffer = CreateRenderbuffer(GL_DEPTH24_STENCIL8,
+                                         GL_DEPTH_STENCIL_ATTACHMENT);
+      labelObject(GL_FRAMEBUFFER, msaaFbo,
+                  label + " " + std::to_string(samples) + "x MSAA");
+      complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                                 GL_FRAMEBUFFER_COMPLETE;
+    }
+    if (!complete)
+      printf("%s: incomplete framebuffer\n", label.c_str());
+    glBindFramebuffer(GL_FRAMEBUFFER, savedBinding);
+  }
+
+  int Width() const { return width; }
+  int Height() const { return height; }
+  int Samples() const { return samples; }
+  GLuint ColorTexture() const { return colorTexture; } // feloldott szín
+
+  bool Matches(int _width, int _height, GLenum _colorFormat, bool _depth,
+               int _samples) const {
+    return width == _width && height == _height &&
+           colorFormat == _colorFormat && depth == _depth &&
+           requestedSamples == _samples;
+  }
+
+  // Ide rajzolunk az End()-ig; az előző célpuffer és nézet visszaáll
+  void Begin() {
+    glCommands().Call([this] {
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+      glGetIntegerv(GL_VIEWPORT, savedViewport);
+      glBindFramebuffer(GL_FRAMEBUFFER, samples > 0 ? msaaFbo : fbo);
+      glViewport(0, 0, width, height);
+    });
+  }
+
+  void End() {
+    glCommands().Call([this] {
+      if (samples > 0) { // feloldás a textúrába
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, msaaFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      }
+      glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+      glViewport(savedViewport[0], savedViewport[1], savedViewport[2],
+                 savedViewport[3]);
+    });
+  }
+
+  void Bind(int textureUnit) { // mintavételezéshez, End() után
+    glCommands().BindTexture(textureUnit, GL_TEXTURE_2D, colorTexture);
+  }
+
+  // Másolás az aktuális célpufferbe négyszög rajzolása nélkül (átlátszatlan
+  // rétegekhez); az olló teszt erre is hat
+  void Blit(int x, int y, int w, int h) {
+    glCommands().Call([this, x, y, w, h] {
+      GLint target;
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+      glBlitFramebuffer(0, 0, width, height, x, y, x + w, y + h,
+                        GL_COLOR_BUFFER_BIT,
+                        w == width && h == height ? GL_NEAREST : GL_LINEAR);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    });
+  }
+
+  ~RenderTarget() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &colorTexture);
+    if (msaaFbo > 0) {
+      glDeleteFramebuffers(1, &msaaFbo);
+      glDeleteRenderbuffers(1, &msaaColor);
+    }
+    if (depthBuffer > 0)
+      glDeleteRenderbuffers(1, &depthBuffer);
+  }
+};
+
+//---------------------------
+class RenderTargetPool {
+  //---------------------------
+  // Visszaadott célok méret és formátum szerinti újrahasznosítása, hogy az
+  // effektek ne hozzanak létre képkockánként új FBO-t
+  std::vector<RenderTarget *> available;
+
+public:
+  RenderTarget *Acquire(int width, int height, GLenum colorFormat = GL_RGBA8,
+                        bool depth = true, int samples = 0) {
+    for (size_t i = 0; i < available.size(); i++) {
+      RenderTarget *target = available[i];
+      if (target->Matches(width, height, colorFormat, depth, samples)) {
+        available.erase(available.begin() + i);
+        return target;
+      }
+    }
+    return new RenderTarget(width, height, colorFormat, depth, samples);
+  }
+  void Release(RenderTarget *target) {
+    if (target)
+      available.push_back(target);
+  }
+  void Clear() { // a környezet megszűnése előtt
+    for (RenderTarget *target : available)
+      delete target;
+    available.clear();
+  }
+  ~RenderTargetPool() { Clear(); }
+};
+
+RenderTargetPool &renderTargets();
+
+#ifdef FILE_OPERATIONS
+//---------------------------
+class VirtualTexture {
+  //---------------------------
+  // Csempék: tileDir/<mip>/<x>_<y>.png, négyzetes RGBA lapok, 0 a legfinomabb
+  // szint, a legdurvább szinten egyetlen csempe. A GPU-n csak a laptábla és a
+  // rögzített méretű fizikai lapgyorsítótár van, így a memória korlátos.
+  static constexpr int feedbackScale = 8;      // visszacsatolás: ablak / 8
+  static constexpr int readbackFrames = 3;     // PBO gyűrű hossza
+  static constexpr int maxUploadsPerFrame = 8; // lapfeltöltés képkockánként
+  static constexpr int maxPendingLoads = 64;   // betöltési sor korlátja
+
+  struct Tile {
+    int key;
+    std::vector<unsigned char> pixels; // üres, ha a csempe hiányzik
+  };
+
+  fs::path tileDir;
+  int pageSize = 0, pages = 1, mipCount = 1, cacheSide;
+  unsigned int pageTableId = 0, cacheId = 0;
+  // a laptábla CPU oldali másolata szintenként, csak a változás töltődik fel
+  std::vector<std::vector<unsigned int>> table;
+  // ha a látható lapok nem férnek a gyorsítótárba, durvább szintet kérünk
+  int mipBias = 0;
+  bool saturated = false;
+
+  // fizikai lapok és LRU sor (eleje a legrégebben használt)
+  std::vector<int> slotKey, slotStamp;
+  int feedbackStamp = 0;
+  std::list<int> lru;
+  std::vector<std::list<int>::iterator> lruPos;
+  std::unordered_map<int, int> resident; // csempe -> fizikai lap
+  std::unordered_set<int> missing;       // nem létező csempék
+  std::unordered_set<int> requested;     // úton lévő kérések
+
+  // visszacsatolási menet, aszinkron visszaolvasás
+  unsigned int feedbackFbo = 0, feedbackColor = 0;
+  int feedbackWidth = 0, feedbackHeight = 0;
+  unsigned int pbo[readbackFrames] = {};
+  int pboWidth[readbackFrames] = {}, pboHeight[readbackFrames] = {};
+  GLsync fence[readbackFrames] = {};
+  int writeIndex = 0;
+  GLint savedViewport[4] = {};
+  GLint savedFramebuffer = 0;
+
+  // háttérszál
+  std::thread loader;
+  std::mutex mutex;
+  std::condition_variable wakeLoader;
+  std::deque<int> loadQueue;
+  std::vector<Tile> loaded;
+  bool quit = false;
+
+  static int Key(int x, int y, int mip) { return (mip << 24) | (y << 12) | x; }
+  static int KeyX(int key) { return key & 0xfff; }
+  static int KeyY(int key) { return (key >> 12) & 0xfff; }
+  static int KeyMip(int key) { return key >> 24; }
+
+  Tile LoadTile(int key) {
+    TRACE_SCOPE("VirtualTexture::LoadTile");
+    Tile tile;
+    tile.key = key;
+    fs::path path = tileDir / std::to_string(KeyMip(key)) /
+                    (std::to_string(KeyX(key)) + "_" +
+                     std::to_string(KeyY(key)) + ".png");
+    unsigned int width = 0, height = 0;
+    std::vector<unsigned char> file;
+    if (lodepng::load_file(file, path.string()) != 0)
+      return tile; // hiányzó csempe
+    // egyenesen a csempe pufferébe dekódol, köztes másolat nélkül
+    tile.pixels.resize(pageSize * pageSize * 4);
+    unsigned error = lodepng_decode_memory_into(
+        tile.pixels.data(), tile.pixels.size(), pageSize * 4, &width, &height,
+        file.data(), file.size(), LCT_RGBA, 8);
+    if (error == 0 && (int)width == pageSize && (int)height == pageSize)
+      return tile;
+    if (error == 0 || error == 117) // túl kicsi vagy túl nagy
+      printf("%s: tile size must be %d\n", path.string().c_str(), pageSize);
+    tile.pixels.clear();
+    return tile;
+  }
+
+  void LoaderLoop() {
+    traceThreadName("VirtualTexture loader");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wakeLoader.wait(lock, [this] {
+        return quit ||
+               (!loadQueue.empty() && (int)loaded.size() < maxPendingLoads);
+      });
+      if (quit)
+        return;
+      int key = loadQueue.front();
+      loadQueue.pop_front();
+      lock.unlock();
+      Tile tile = LoadTile(key); // dekódolás zár nélkül
+      lock.lock();
+      loaded.push_back(std::move(tile));
+    }
+  }
+
+  void Touch(int slot) {
+    slotStamp[slot] = feedbackStamp;
+    if (slot > 0) // a 0. lap a gyökér csempe, sosem kerül ki
+      lru.splice(lru.end(), lru, lruPos[slot]);
+  }
+
+  void Upload(int slot, const std::vector<unsigned char> &pixels) {
+    TRACE_SCOPE("VirtualTexture::Upload");
+    glBindTexture(GL_TEXTURE_2D, cacheId);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheSide) * pageSize,
+                    (slot / cacheSide) * pageSize, pageSize, pageSize, GL_RGBA,
+                    GL_UNSIGNED_BYTE, &pixels[0]);
+  }
+
+  void RequestVisible(const unsigned char *feedback, int count) {
+    feedbackStamp++;
+    std::unordered_set<int> seen;
+    std::vector<int> wanted;
+    for (int i = 0; i < count; i++) {
+      const unsigned char *p = &feedback[4 * i];
+      if (p[2] == 255) // háttér
+        continue;
+      int mip = std::min((int)p[2] + mipBias, mipCount - 1);
+      int x = p[0] | ((p[3] >> 4) << 8), y = p[1] | ((p[3] & 15) << 8);
+      // a szülők is kellenek, hogy legyen mire visszaesni
+      for (; mip < mipCount; mip++, x >>= 1, y >>= 1) {
+        int key = Key(x, y, mip);
+        if (!seen.insert(key).second)
+          break;
+        auto it = resident.find(key);
+        if (it != resident.end())
+          Touch(it->second);
+        else if (!missing.count(key) && !requested.count(key))
+          wanted.push_back(key);
+      }
+    }
+    int slots = cacheSide * cacheSide;
+    if (saturated)
+      mipBias = std::min(mipBias + 1, mipCount - 1);
+    else if (mipBias > 0 && (int)seen.size() * 8 <= slots)
+      mipBias--;
+    saturated = false;
+    if (wanted.empty())
+      return;
+    // durvább szintek előre
+    std::sort(wanted.begin(), wanted.end(),
+              [](int a, int b) { return KeyMip(a) > KeyMip(b); });
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int key : wanted) {
+      loadQueue.push_back(key);
+      requested.insert(key);
+    }
+    while ((int)loadQueue.size() > maxPendingLoads) { // elavult kérések
+      requested.erase(loadQueue.front());
+      loadQueue.pop_front();
+    }
+    wakeLoader.notify_one();
+  }
+
+  bool ReadFeedback() {
+    bool any = false;
+    for (int n = 0; n < readbackFrames; n++) {
+      int i = (writeIndex + n) % readbackFrames; // legrégebbi először
+      if (!fence[i])
+        continue;
+      GLenum state = glClientWaitSync(fence[i], 0, 0);
+      if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+        break;
+      glDeleteSync(fence[i]);
+      fence[i] = 0;
+      int count = pboWidth[i] * pboHeight[i];
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+      void *data =
+          glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * 4, GL_MAP_READ_BIT);
+      if (data) {
+        RequestVisible((const unsigned char *)data, count);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        any = true;
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    return any;
+  }
+
+  bool UploadLoaded() {
+    std::vector<Tile> tiles;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      int n = std::min((int)loaded.size(), maxUploadsPerFrame);
+      tiles.assign(std::make_move_iterator(loaded.begin()),
+                   std::make_move_iterator(loaded.begin() + n));
+      loaded.erase(loaded.begin(), loaded.begin() + n);
+      if (n > 0)
+        wakeLoader.notify_one();
+    }
+    bool uploaded = false;
+    for (Tile &tile : tiles) {
+      requested.erase(tile.key);
+      if (tile.pixels.empty()) {
+        missing.insert(tile.key);
+        continue;
+      }
+      int slot = lru.front(); // kilakoltatás
+      if (slotStamp[slot] == feedbackStamp) {
+        saturated = true; // a legrégebbi lap is látható, nem dobjuk ki
+        continue;
+      }
+      if (slotKey[slot] >= 0) {
+        int evicted = slotKey[slot];
+        resident.erase(evicted);
+        UpdatePageTable(evicted);
+      }
+      slotKey[slot] = tile.key;
+      resident[tile.key] = slot;
+      Touch(slot);
+      Upload(slot, tile.pixels);
+      UpdatePageTable(tile.key);
+      uploaded = true;
+    }
+    return uploaded;
+  }
+
+  unsigned int PageEntry(int slot, int mip) const {
+    return (slot % cacheSide) | (slot / cacheSide) << 8 | mip << 16 |
+           0xffu << 24;
+  }
+
+  // A csempe bekerülése vagy kikerülése után csak a csempe alatti bejegyzések
+  // változnak: minden bejegyzés a legközelebbi rezidens ősre mutat, és a
+  // finomabb szinteken a saját szintjükre mutató bejegyzések maradnak.
+  void UpdatePageTable(int key) {
+    int top = KeyMip(key);
+    auto it = resident.find(key);
+    glBindTexture(GL_TEXTURE_2D, pageTableId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (int mip = top; mip >= 0; mip--) {
+      int side = pages >> mip, n = 1 << (top - mip);
+      int x0 = KeyX(key) << (top - mip), y0 = KeyY(key) << (top - mip);
+      std::vector<unsigned int> &level = table[mip];
+      for (int y = y0; y < y0 + n; y++)
+        for (int x = x0; x < x0 + n; x++) {
+          unsigned int &entry = level[y * side + x];
+          if (mip == top && it != resident.end())
+            entry = PageEntry(it->second, mip);
+          else if (mip == top || (int)(entry >> 16 & 0xff) != mip)
+            entry = table[mip + 1][(y >> 1) * (side >> 1) + (x >> 1)];
+        }
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, side);
+      glTexSubImage2D(GL_TEXTURE_2D, mip, x0, y0, n, n, GL_RGBA,
+                      GL_UNSIGNED_BYTE, &level[y0 * side + x0]);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  }
+
+public:
+  // GLSL függvények a fragmens árnyalóba: vtSample() rajzoláshoz,
+  // vtFeedback() a visszacsatolási menethez
+  static constexpr const char *shaderSource = R"(
+    uniform sampler2D vtPageTable;
+    uniform sampler2D vtCache;
+    uniform vec4 vtParams;        // lapok, lapméret, cache oldal, max mip
+    uniform float vtFeedbackBias; // log2(visszacsatolási kicsinyítés)
+
+    float vtMip(vec2 uv, float bias) {
+        vec2 texel = uv * vtParams.x * vtParams.y;
+        vec2 dx = dFdx(texel), dy = dFdy(texel);
+        float mip = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - bias;
+        return clamp(floor(mip), 0.0, vtParams.w);
+    }
+
+    vec4 vtSample(vec2 uv) {
+        float mip = vtMip(uv, 0.0);
+        ivec2 page = ivec2(clamp(uv, 0.0, 1.0) * (vtParams.x / exp2(mip) - 0.001));
+        vec3 entry = texelFetch(vtPageTable, page, int(mip)).rgb * 255.0;
+        vec2 inPage = fract(uv * vtParams.x / exp2(entry.b));
+        inPage = (inPage * (vtParams.y - 1.0) + 0.5) / vtParams.y;
+        return textureLod(vtCache, (entry.rg + inPage) / vtParams.z, 0.0);
+    }
+
+    vec4 vtFeedback(vec2 uv) {
+        float mip = vtMip(uv, vtFeedbackBias);
+        ivec2 page = ivec2(clamp(uv, 0.0, 1.0) * (vtParams.x / exp2(mip) - 0.001));
+        float high = float((page.x >> 8) * 16 + (page.y >> 8));
+        return vec4(float(page.x & 255), float(page.y & 255), mip, high) / 255.0;
+    }
+  )";
+
+  VirtualTexture(const fs::path &_tileDir, int _cacheSide = 16)
+      : tileDir(_tileDir), cacheSide(_cacheSide) {
+    // szintek száma a könyvtárszerkezetből
+    mipCount = 0;
+    std::error_code error;
+    for (auto &entry : fs::directory_iterator(tileDir, error)) {
+      std::string name = entry.path().filename().string();
+      if (entry.is_directory() && !name.empty() &&
+          name.find_first_not_of("0123456789") == std::string::npos)
+        mipCount = std::max(mipCount, std::stoi(name) + 1);
+    }
+    if (mipCount == 0 || mipCount > 13) {
+      printf("%s: no tile levels found\n", tileDir.string().c_str());
+      mipCount = 1;
+    }
+    pages = 1 << (mipCount - 1);
+
+    // a gyökér csempe szinkron töltődik, ez adja a lapméretet
+    fs::path rootPath = tileDir / std::to_string(mipCount - 1) / "0_0.png";
+    unsigned int width = 0, height = 0;
+    std::vector<unsigned char> file;
+    lodepng::load_file(file, rootPath.string());
+    LodePNGState state; // a lapméret a fejlécből jön
+    lodepng_state_init(&state);
+    lodepng_inspect(&width, &height, &state, file.data(), file.size());
+    lodepng_state_cleanup(&state);
+    pageSize = (width > 0 && width == height) ? (int)width : 128;
+    std::vector<unsigned char> root(pageSize * pageSize * 4, 0);
+    if ((int)width != pageSize ||
+        lodepng_decode_memory_into(root.data(), root.size(), pageSize * 4,
+                                   &width, &height, file.data(), file.size(),
+                                   LCT_RGBA, 8) != 0) {
+      std::fill(root.begin(), root.end(), 0);
+      printf("%s cannot be loaded\n", rootPath.string().c_str());
+    }
+
+    glGenTextures(1, &cacheId);
+    glBindTexture(GL_TEXTURE_2D, cacheId);
+    labelObject(GL_TEXTURE, cacheId, "VirtualTexture cache");
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSide * pageSize,
+                 cacheSide * pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &pageTableId);
+    glBindTexture(GL_TEXTURE_2D, pageTableId);
+    labelObject(GL_TEXTURE, pageTableId, "VirtualTexture page table");
+    // kezdetben minden bejegyzés a gyökér csempére mutat
+    table.resize(mipCount);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (int mip = 0; mip < mipCount; mip++) {
+      int side = pages >> mip;
+      table[mip].assign(side * side, PageEntry(0, mipCount - 1));
+      glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, side, side, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, &table[mip][0]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    int slots = cacheSide * cacheSide;
+    slotKey.assign(slots, -1);
+    slotStamp.assign(slots, -1);
+    lruPos.resize(slots);
+    for (int slot = 1; slot < slots; slot++)
+      lruPos[slot] = lru.insert(lru.end(), slot);
+    slotKey[0] = Key(0, 0, mipCount - 1);
+    resident[slotKey[0]] = 0;
+    Upload(0, root);
+
+    glGenBuffers(readbackFrames, pbo);
+    loader = std::thread(&VirtualTexture::LoaderLoop, this);
+  }
+
+  // Visszacsatolási menet kezdete: a hívó ezután a vtFeedback()-et használó
+  // programmal rajzolja ki a virtuálisan textúrázott geometriát
+  void BeginFeedback(GPUProgram *feedbackProgram) {
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+    int width = std::max(1, savedViewport[2] / feedbackScale);
+    int height = std::max(1, savedViewport[3] / feedbackScale);
+    if (width != feedbackWidth || height != feedbackHeight) {
+      if (feedbackFbo == 0) {
+        glGenFramebuffers(1, &feedbackFbo);
+        glGenTextures(1, &feedbackColor);
+      }
+      feedbackWidth = width;
+      feedbackHeight = height;
+      glBindTexture(GL_TEXTURE_2D, feedbackColor);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glBindFramebuffer(GL_FRAMEBUFFER, feedbackFbo);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_2D, feedbackColor, 0);
+      labelObject(GL_TEXTURE, feedbackColor, "VirtualTexture feedback");
+      labelObject(GL_FRAMEBUFFER, feedbackFbo, "VirtualTexture feedback");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFbo);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+    glClearColor(1, 1, 1, 1); // 255 a mip helyén: háttér
+    glClear(GL_COLOR_BUFFER_BIT);
+    feedbackProgram->Use();
+    feedbackProgram->setUniform(vec4((float)pages, (float)pageSize,
+                                     (float)cacheSide, (float)(mipCount - 1)),
+                                "vtParams");
+    feedbackProgram->setUniform(log2f((float)feedbackScale), "vtFeedbackBias");
+  }
+
+  // Visszacsatolás vége: visszaolvasás PBO-ba, várakozás nélkül
+  void EndFeedback() {
+    int i = writeIndex;
+    if (fence[i]) // a gyűrű tele, a legrégebbi eredmény elvész
+      glDeleteSync(fence[i]);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    if (pboWidth[i] != feedbackWidth || pboHeight[i] != feedbackHeight) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, feedbackWidth * feedbackHeight * 4,
+                   NULL, GL_STREAM_READ);
+      pboWidth[i] = feedbackWidth;
+      pboHeight[i] = feedbackHeight;
+    }
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA,
+                 GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    writeIndex = (writeIndex + 1) % readbackFrames;
+    glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2],
+               savedViewport[3]);
+  }
+
+  // Képkockánként hívandó: kérések, feltöltés, laptábla; igaz, ha változott
+  bool Update() {
+    ReadFeedback();
+    return UploadLoaded();
+  }
+
+  // Van-e még úton lévő csempe vagy feldolgozatlan visszaolvasás
+  bool Busy() {
+    for (GLsync f : fence)
+      if (f)
+        return true;
+    return !requested.empty();
+  }
+
+  void Bind(GPUProgram *program, int textureUnit) {
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindTexture(GL_TEXTURE_2D, pageTableId);
+    glActiveTexture(GL_TEXTURE0 + textureUnit + 1);
+    glBindTexture(GL_TEXTURE_2D, cacheId);
+    program->setUniform(textureUnit, "vtPageTable");
+    program->setUniform(textureUnit + 1, "vtCache");
+    program->setUniform(vec4((float)pages, (float)pageSize, (float)cacheSide,
+                             (float)(mipCount - 1)),
+                        "vtParams");
+  }
+
+  ~VirtualTexture() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wakeLoader.notify_one();
+    loader.join();
+    for (GLsync f : fence)
+      if (f)
+        glDeleteSync(f);
+    glDeleteBuffers(readbackFrames, pbo);
+    if (feedbackFbo > 0) {
+      glDeleteFramebuffers(1, &feedbackFbo);
+      glDeleteTextures(1, &feedbackColor);
+    }
+    glDeleteTextures(1, &pageTableId);
+    glDeleteTextures(1, &cacheId);
+  }
+};
+#endif
+
 enum MouseButton { MOUSE_LEFT, MOUSE_MIDDLE, MOUSE_RIGHT };
 enum SpecialKeys {
   KEY_RIGHT = 262,
@@ -410,6 +1559,32 @@ enum SpecialKeys {
   KEY_UP = 265
 };
 bool pollKey(int key);
+// Nyers kurzorpozíció; a mozgások képkockánként egy onMouseMotion hívássá
+// vonódnak össze, az összes minta a mouseSamples-ből érhető el
+struct MotionSample {
+  double x, y;
+  double time; // mp
+};
+
+enum CaptureFormat { CAPTURE_PNG, CAPTURE_RAW };
+// Lemaradáskor: a maradék idő elvész (lassul), vagy később pótoljuk
+enum CatchUpPolicy { CATCHUP_DROP, CATCHUP_SPREAD };
+
+// Mérési pont a profilozónak: a blokk végéig tartó CPU (és GPU) idő,
+// nyomkövetéskor egyben trace esemény is
+struct ProfileScope {
+  const char *name;
+  int index = -1;
+  uint64_t start = 0;
+  ProfileScope(const char *name, bool gpu);
+  ~ProfileScope();
+};
+#define PROFILE_CPU(name)                                                      \
+  ProfileScope SCOPE_CONCAT(profileScope, __LINE__)(name, false)
+#define PROFILE_GPU(name)                                                      \
+  ProfileScope SCOPE_CONCAT(profileScope, __LINE__)(name, true)
+
+struct Job; // a feladatrendszer egysége, a glApp::createJob adja
 
 //---------------------------
 class glApp {
@@ -422,6 +1597,55 @@ public:
         unsigned int winHeight, // Alkalmaz�i ablak felbont�sa
         const char *caption);   // Megfog�cs�k sz�vege
   void refreshScreen();         // Ablak �rv�nytelen�t�se
+  // Csak egy téglalap sérült (képpont, bal felső sarokból, mint az egérnél):
+  // a sérülések uniója ollóval rajzolódik újra, a többi a megőrzött hátsó
+  // pufferből marad. Az onDisplay ilyenkor ne kapcsolja ki az ollót.
+  void refreshScreen(int x, int y, int width, int height);
+  // Képkockák mentése: PBO gyűrű, kódolás háttérszálakon
+  void startCapture(const char *directory, CaptureFormat format = CAPTURE_PNG,
+                    int workers = 0);
+  void stopCapture();
+  // Üresjárat: animáció és időzítő nélkül a keretrendszer eseményre vár
+  void startAnimation();         // folyamatos onTimeElapsed hívások kellenek
+  void stopAnimation();          // párja a startAnimation-nek
+  void setTimer(float delay);    // ébresztés legkésőbb delay mp múlva
+  float cpuUtilization() const;  // fő szál terhelése az előző képkockában [0, 1]
+  // Rögzített lépésű szimuláció: onSimulate ticksPerSecond-szor másodpercenként,
+  // képkockánként legfeljebb maxSubsteps lépés
+  void setSimulationRate(double ticksPerSecond, int maxSubsteps = 8,
+                         CatchUpPolicy policy = CATCHUP_DROP);
+  float interpolationAlpha() const; // két szimulációs lépés között [0, 1]
+  // GL debug mód: debug környezet, a driver üzenetei (teljesítmény
+  // figyelmeztetések, hibák) forrás és azonosító szerint összesítve, kilépéskor
+  // a topCount leggyakoribb teljesítmény figyelmeztetés. A konstruktorból
+  // hívva már a környezet is debug módú, később csak a visszahívás települ.
+  void enableDebugOutput(int topCount = 10);
+  // Profilozó: GL_TIME_ELAPSED lekérdezések, min/átlag/p99 kijelzés, CSV
+  void enableProfiler(bool overlay = true, const char *csvFile = nullptr);
+  void disableProfiler();
+  // Renderszál: a GL hívások glCommands() listába kerülnek, amit egy külön
+  // szál játszik le, mialatt az alkalmazás már a következő képkockán dolgozik.
+  // A konstruktorból hívva az alkalmazás vállalja, hogy az onInitialization
+  // után csak glCommands()-on át rajzol; a szálat ekkor a --render-thread
+  // kapcsoló indítja, más alkalmazásnál és --headless mellett a kapcsoló hiba.
+  void enableRenderThread();
+  // Feladatrendszer: munkalopó szálkészlet magonként egy szállal (az első
+  // használatkor indul). Feladat a fő szálon vagy feladatból indítható; a
+  // szülő akkor kész, ha minden gyereke is kész.
+  Job *createJob(std::function<void()> work, Job *parent = nullptr);
+  void runJob(Job *job);
+  void waitJob(const Job *job); // várakozás közben más feladatokat végez
+  // body(b, e) legfeljebb grain hosszú [b, e) darabokra, párhuzamosan
+  void parallelFor(int begin, int end, int grain,
+                   const std::function<void(int, int)> &body);
+  int jobWorkers(); // a szálak száma a fő szállal együtt
+  // Megjelenítés: 0 vsync nélkül, 1 vsync, -1 adaptív (ha támogatott)
+  void setSwapInterval(int interval);
+  void setFrameRateLimit(float framesPerSecond); // 0: nincs korlát
+  // Bemenet -> megjelenítés késleltetés eloszlása kilépéskor
+  void enableLatencyStats();
+  // A képkocka összes nyers kurzorpozíciója az összevont mozgások mögött
+  const std::vector<MotionSample> &mouseSamples() const;
   // Esem�nykezel�k
   virtual void onInitialization() {}    // Inicializ�ci�
   virtual void onDisplay() {}           // Ablak �rv�nytelen
@@ -433,5 +1657,7 @@ public:
   // Eg�r mozgat�s lenyomott gombbal
   virtual void onMouseMotion(int pX, int pY) {}
   // Telik az id�
-  virtual void onTimeElapsed(float startTime, float endTime) {}
+  virtual void onTimeElapsed(double startTime, double endTime) {}
+  // Rögzített szimulációs lépés
+  virtual void onSimulate(double dt) {}
 };
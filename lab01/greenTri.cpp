@@ -36,7 +36,9 @@ class PointsApp : public glApp {
     int firstLine = -1;       
 
 public:
-    PointsApp() : glApp("PointsApp") {}
+    PointsApp() : glApp("PointsApp") {
+        enableRenderThread(); // minden rajzolás glCommands()-on át megy
+    }
 
     void onInitialization() {
         points = new Geometry<vec2>();
@@ -116,6 +118,13 @@ public:
         lines->updateGPU();
     }
     
+    //új pont: csak a környékét kell újrarajzolni (10 pixeles pont)
+    void refreshPoint(vec2 p) {
+        int pX = (int)((p.x + 1.0f) / 2.0f * windowWidth);
+        int pY = (int)((1.0f - p.y) / 2.0f * windowHeight);
+        refreshScreen(pX - 8, pY - 8, 16, 16);
+    }
+
     int findClosestLine(float ndcX, float ndcY) {
         float minDist = 0.1f;
         int closest = -1;
@@ -180,6 +189,8 @@ public:
             points->Vtx().push_back(mousePos);
             points->updateGPU();
             printf("Pont: %.2f, %.2f\n", mousePos.x, mousePos.y);
+            refreshPoint(mousePos);
+            return;
         }
         else if (currentKey == 'l') {
             drawLine(mousePos.x, mousePos.y);
@@ -210,6 +221,7 @@ public:
                             points->Vtx().push_back(intersection);
                             points->updateGPU();
                             printf("Metszet: %.2f, %.2f\n", intersection.x, intersection.y);
+                            refreshPoint(intersection);
                         } else {
                             printf("Párhuzamos egyenesek\n");
                         }
@@ -220,6 +232,7 @@ public:
                     firstLine = -1;
                 }
             }
+            return; //a kiválasztás nem látszik, a metszéspont már frissült
         }
         
         refreshScreen();
@@ -241,12 +254,12 @@ public:
     }
 
     void onDisplay() override {
-        glClearColor(0.5f, 0.5f, 0.5f, 0);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glViewport(0, 0, windowWidth, windowHeight);
+        glCommands().ClearColor(0.5f, 0.5f, 0.5f, 0);
+        glCommands().Clear(GL_COLOR_BUFFER_BIT);
+        glCommands().Viewport(0, 0, windowWidth, windowHeight);
         
-        glPointSize(10.0f);
-        glLineWidth(3.0f);
+        glCommands().PointSize(10.0f);
+        glCommands().LineWidth(3.0f);
     
         lines->Draw(gpuProgram, GL_LINES, vec3(0.0f, 1.0f, 1.0f));
       
@@ -202,6 +202,113 @@ Example: if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83);
   return;\
 }
 
+/*
+x86 SIMD support: the intrinsics are compiled per function with a target attribute (GCC, Clang)
+or unconditionally (MSVC), so no special compiler flags are needed. lodepng_cpu_features tells
+which of them the running CPU (and OS, for the AVX registers) supports.
+*/
+#if defined(LODEPNG_COMPILE_SIMD) && (defined(__GNUC__) || defined(_MSC_VER)) &&\
+    (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define LODEPNG_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LODEPNG_TARGET(isa) /*MSVC allows all intrinsics everywhere*/
+#else
+#include <cpuid.h>
+#define LODEPNG_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define LODEPNG_CPU_SSE2 1u
+#define LODEPNG_CPU_SSSE3 2u
+#define LODEPNG_CPU_SSE41 4u
+#define LODEPNG_CPU_PCLMUL 8u
+#define LODEPNG_CPU_AVX2 16u
+
+static void lodepng_cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)subleaf);
+  regs[0] = (unsigned)r[0]; regs[1] = (unsigned)r[1]; regs[2] = (unsigned)r[2]; regs[3] = (unsigned)r[3];
+#else
+  regs[0] = regs[1] = regs[2] = regs[3] = 0;
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned lodepng_detect_cpu_features(void) {
+  unsigned regs[4], features = 0, maxleaf;
+  lodepng_cpuid(0, 0, regs);
+  maxleaf = regs[0];
+  if(maxleaf < 1) return 0;
+  lodepng_cpuid(1, 0, regs);
+  if(regs[3] & (1u << 26)) features |= LODEPNG_CPU_SSE2;
+  if(regs[2] & (1u << 9)) features |= LODEPNG_CPU_SSSE3;
+  if(regs[2] & (1u << 19)) features |= LODEPNG_CPU_SSE41;
+  if(regs[2] & (1u << 1)) features |= LODEPNG_CPU_PCLMUL;
+  /*AVX2 also needs the OS to save the YMM registers: OSXSAVE, then XCR0 bits 1 and 2*/
+  if(maxleaf >= 7 && (regs[2] & (1u << 27))) {
+    unsigned xcr0;
+#ifdef _MSC_VER
+    xcr0 = (unsigned)_xgetbv(0);
+#else
+    unsigned edx;
+    __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+    (void)edx;
+#endif
+    lodepng_cpuid(7, 0, regs);
+    if((xcr0 & 6u) == 6u && (regs[1] & (1u << 5))) features |= LODEPNG_CPU_AVX2;
+  }
+  return features;
+}
+
+/*computed on first use. Tests may clear bits to force the portable or a narrower code path. The threads
+of the parallel deflate can make the first call at the same time, so it is atomic where there are threads.*/
+#if defined(__cplusplus) && (__cplusplus >= 201103L)
+#include <atomic>
+static std::atomic<unsigned> lodepng_cpu_feature_mask(~0u);
+#else /*C and C++98 builds have no threads*/
+static unsigned lodepng_cpu_feature_mask = ~0u;
+#endif
+
+static unsigned lodepng_cpu_features(void) {
+  unsigned features = lodepng_cpu_feature_mask;
+  if(features == ~0u) {
+    features = lodepng_detect_cpu_features();
+    lodepng_cpu_feature_mask = features;
+  }
+  return features;
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+/*
+Threads, for the parallel deflate. They need C++11 std::thread, lodepng_parallel_for hides them from the C code.
+*/
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_ENCODER) &&\
+    defined(__cplusplus) && (__cplusplus >= 201103L)
+#define LODEPNG_THREADS
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*calls job(context, i) for every i below count, spread over up to threads threads including the calling one*/
+static void lodepng_parallel_for(size_t count, unsigned threads, void (*job)(void*, size_t), void* context) {
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  auto work = [&]() {
+    for(size_t i = next++; i < count; i = next++) job(context, i);
+  };
+  if(threads > count) threads = (unsigned)count;
+  try {
+    for(unsigned t = 1; t < threads; ++t) workers.emplace_back(work);
+  } catch(...) {
+    /*no more threads available, the ones started and this one still do all jobs*/
+  }
+  work();
+  for(std::thread& worker : workers) worker.join();
+}
+#endif /*LODEPNG_THREADS*/
+
 /*
 About uivector, ucvector and string:
 -All of them wrap dynamic arrays or text strings in a similar way.
@@ -462,7 +569,7 @@ typedef struct {
   size_t size; /*size of data in bytes*/
   size_t bitsize; /*size of data in bits, end of valid bp values, should be 8*size*/
   size_t bp;
-  unsigned buffer; /*buffer for reading bits. NOTE: 'unsigned' must support at least 32 bits*/
+  size_t buffer; /*buffer for reading bits. NOTE: must support at least 32 bits, 64 are used where size_t has them*/
 } LodePNGBitReader;
 
 /* data size argument is in bytes. Returns error if size too large causing overflow */
@@ -558,10 +665,34 @@ static LODEPNG_INLINE void ensureBits32(LodePNGBitReader* reader, size_t nbits)
   (void)nbits;
 }
 
+/*amount of bits ensureBitsWide guarantees: 56 with a 64-bit size_t, 32 otherwise*/
+#define WIDEBITS (sizeof(size_t) >= 8 ? 56u : 32u)
+
+/*See ensureBits documentation above. This one ensures up to WIDEBITS bits, enough for a full length and distance
+pair in inflate. Away from the end of the data this is one 8-byte little endian read and a shift.*/
+static LODEPNG_INLINE void ensureBitsWide(LodePNGBitReader* reader) {
+  size_t start = reader->bp >> 3u;
+  size_t size = reader->size;
+  if(sizeof(size_t) < 8) {
+    ensureBits32(reader, 32);
+  } else if(start + 8u <= size) {
+    const unsigned char* p = &reader->data[start];
+    unsigned lo = (unsigned)p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u) | ((unsigned)p[3] << 24u);
+    unsigned hi = (unsigned)p[4] | ((unsigned)p[5] << 8u) | ((unsigned)p[6] << 16u) | ((unsigned)p[7] << 24u);
+    /*two shifts of 16 so that this still compiles without warnings where size_t has 32 bits*/
+    reader->buffer = ((((size_t)hi << 16u) << 16u) | lo) >> (reader->bp & 7u);
+  } else {
+    size_t i;
+    reader->buffer = 0;
+    for(i = 0; start + i < size; ++i) reader->buffer |= (size_t)reader->data[start + i] << (i * 8u);
+    reader->buffer >>= (reader->bp & 7u);
+  }
+}
+
 /* Get bits without advancing the bit pointer. Must have enough bits available with ensureBits. Max nbits is 31. */
 static LODEPNG_INLINE unsigned peekBits(LodePNGBitReader* reader, size_t nbits) {
   /* The shift allows nbits to be only up to 31. */
-  return reader->buffer & ((1u << nbits) - 1u);
+  return (unsigned)(reader->buffer & ((1u << nbits) - 1u));
 }
 
 /* Must have enough bits available with ensureBits */
@@ -578,11 +709,13 @@ static LODEPNG_INLINE unsigned readBits(LodePNGBitReader* reader, size_t nbits)
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
+/*reverses the lowest num bits of bits, num must be at most 16*/
 static unsigned reverseBits(unsigned bits, unsigned num) {
-  /*TODO: implement faster lookup table based version when needed*/
-  unsigned i, result = 0;
-  for(i = 0; i < num; i++) result |= ((bits >> (num - i - 1u)) & 1u) << i;
-  return result;
+  bits = ((bits & 0x5555u) << 1u) | ((bits >> 1u) & 0x5555u);
+  bits = ((bits & 0x3333u) << 2u) | ((bits >> 2u) & 0x3333u);
+  bits = ((bits & 0x0f0fu) << 4u) | ((bits >> 4u) & 0x0f0fu);
+  bits = ((bits & 0x00ffu) << 8u) | ((bits >> 8u) & 0x00ffu);
+  return bits >> (16u - num);
 }
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -636,6 +769,7 @@ typedef struct HuffmanTree {
   /* for reading only */
   unsigned char* table_len; /*length of symbol from lookup table, or max length if secondary lookup needed*/
   unsigned short* table_value; /*value of symbol from lookup table, or pointer to secondary table if needed*/
+  unsigned* table_fast; /*literal/length tree in inflate only: whole symbols per lookup, see HuffmanTree_makeFastTable*/
 } HuffmanTree;
 
 static void HuffmanTree_init(HuffmanTree* tree) {
@@ -643,6 +777,7 @@ static void HuffmanTree_init(HuffmanTree* tree) {
   tree->lengths = 0;
   tree->table_len = 0;
   tree->table_value = 0;
+  tree->table_fast = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree) {
@@ -650,6 +785,7 @@ static void HuffmanTree_cleanup(HuffmanTree* tree) {
   lodepng_free(tree->lengths);
   lodepng_free(tree->table_len);
   lodepng_free(tree->table_value);
+  lodepng_free(tree->table_fast);
 }
 
 /* amount of bits for first huffman table lookup (aka root bits), see HuffmanTree_makeTable and huffmanDecodeSymbol.*/
@@ -1084,6 +1220,59 @@ static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree*
     return codetree->table_value[value];
   }
 }
+
+/*
+The fast table of the literal/length tree resolves, in one lookup of FASTBITS bits, what would otherwise take one or
+two huffmanDecodeSymbol calls plus a readBits: two literals in a row, or a length symbol together with its extra bits.
+Each entry holds the total amount of bits in bits 0-3 (0 if the slow path must be taken), the kind in bits 4-5 and
+the literal byte(s) or the length value from bit 8.
+*/
+#define FASTBITS 11u
+#define FAST_LITERAL 0u
+#define FAST_LITERAL2 1u
+#define FAST_LENGTH 2u
+
+/*huffmanDecodeSymbol on the bits of an integer, the symbol length goes to len*/
+static unsigned huffmanDecodeBits(const HuffmanTree* codetree, unsigned bits, unsigned* len) {
+  unsigned code = bits & ((1u << FIRSTBITS) - 1u);
+  unsigned l = codetree->table_len[code];
+  unsigned value = codetree->table_value[code];
+  if(l <= FIRSTBITS) {
+    *len = l;
+    return value;
+  }
+  value += (bits >> FIRSTBITS) & ((1u << (l - FIRSTBITS)) - 1u);
+  *len = codetree->table_len[value];
+  return codetree->table_value[value];
+}
+
+static unsigned HuffmanTree_makeFastTable(HuffmanTree* tree) {
+  unsigned i;
+  tree->table_fast = (unsigned*)lodepng_malloc((1u << FASTBITS) * sizeof(*tree->table_fast));
+  if(!tree->table_fast) return 83; /*alloc fail*/
+  for(i = 0; i != (1u << FASTBITS); ++i) {
+    unsigned l, l2, entry = 0;
+    unsigned symbol = huffmanDecodeBits(tree, i, &l);
+    if(l <= FASTBITS) {
+      if(symbol <= 255) {
+        unsigned symbol2 = huffmanDecodeBits(tree, i >> l, &l2);
+        if(symbol2 <= 255 && l + l2 <= FASTBITS) {
+          entry = (l + l2) | (FAST_LITERAL2 << 4u) | (symbol << 8u) | (symbol2 << 16u);
+        } else {
+          entry = l | (FAST_LITERAL << 4u) | (symbol << 8u);
+        }
+      } else if(symbol >= FIRST_LENGTH_CODE_INDEX && symbol <= LAST_LENGTH_CODE_INDEX) {
+        unsigned numextrabits = LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX];
+        if(l + numextrabits <= FASTBITS) {
+          unsigned length = LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX] + ((i >> l) & ((1u << numextrabits) - 1u));
+          entry = (l + numextrabits) | (FAST_LENGTH << 4u) | (length << 8u);
+        }
+      } /*the end code and invalid symbols always take the slow path*/
+    }
+    tree->table_fast[i] = entry;
+  }
+  return 0;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -1096,10 +1285,35 @@ static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree*
 Returns error code.*/
 static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d) {
   unsigned error = generateFixedLitLenTree(tree_ll);
+  if(!error) error = HuffmanTree_makeFastTable(tree_ll);
   if(error) return error;
   return generateFixedDistanceTree(tree_d);
 }
 
+#if defined(__cplusplus) && (__cplusplus >= 201103L)
+/*the fixed trees never change, so with C++11 (which makes initialization of function statics thread safe) they are
+made once and shared by all inflate calls and never freed. Without it, every fixed block makes its own.*/
+#define LODEPNG_STATIC_FIXED_TREES
+typedef struct FixedTreesInflate {
+  HuffmanTree tree_ll;
+  HuffmanTree tree_d;
+  unsigned error;
+} FixedTreesInflate;
+
+static FixedTreesInflate makeFixedTreesInflate(void) {
+  FixedTreesInflate trees;
+  HuffmanTree_init(&trees.tree_ll);
+  HuffmanTree_init(&trees.tree_d);
+  trees.error = getTreeInflateFixed(&trees.tree_ll, &trees.tree_d);
+  return trees;
+}
+
+static const FixedTreesInflate* getFixedTreesInflate(void) {
+  static const FixedTreesInflate trees = makeFixedTreesInflate();
+  return &trees;
+}
+#endif /*LODEPNG_STATIC_FIXED_TREES*/
+
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
 static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
                                       LodePNGBitReader* reader) {
@@ -1234,57 +1448,101 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
-static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype, size_t max_output_size) {
+/*get the trees of a Huffman block, btype must be 1 or 2. ll and d point to tree_ll and tree_d, or to the shared
+fixed trees. tree_ll and tree_d must be initialized and are cleaned up by the caller in either case.*/
+static unsigned getTreesInflate(HuffmanTree* tree_ll, HuffmanTree* tree_d, const HuffmanTree** ll,
+                                const HuffmanTree** d, LodePNGBitReader* reader, unsigned btype) {
+  unsigned error;
+  *ll = tree_ll;
+  *d = tree_d;
+  if(btype == 1) {
+#ifdef LODEPNG_STATIC_FIXED_TREES
+    const FixedTreesInflate* fixed = getFixedTreesInflate();
+    *ll = &fixed->tree_ll;
+    *d = &fixed->tree_d;
+    return fixed->error;
+#else /*LODEPNG_STATIC_FIXED_TREES*/
+    return getTreeInflateFixed(tree_ll, tree_d);
+#endif /*LODEPNG_STATIC_FIXED_TREES*/
+  }
+  error = getTreeInflateDynamic(tree_ll, tree_d, reader);
+  if(!error) error = HuffmanTree_makeFastTable(tree_ll);
+  return error;
+}
+
+/*
+Decodes symbols of a Huffman block until its end code, which sets done. Also returns early, with done still 0, once
+the bit pointer reaches stop_bp or the output size reaches stop_size, so the streaming decoder can wait for input or
+hand out the output first. One iteration reads at most 64 bits, so with stop_bp 64 bits before the end of the
+available input this never reads past it.
+*/
+static unsigned inflateHuffmanSymbols(ucvector* out, LodePNGBitReader* reader,
+                                      const HuffmanTree* ll, const HuffmanTree* d,
+                                      size_t stop_bp, size_t stop_size, size_t max_output_size, int* done) {
   unsigned error = 0;
-  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
-  HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  const size_t reserved_size = 260; /* must be at least 258 for max length, and a few extra for adding a few extra literals */
-  int done = 0;
+  /* must be at least 258 for max length plus 7 for the 8-byte steps of the match copy below */
+  const size_t reserved_size = 266;
 
   if(!ucvector_reserve(out, out->size + reserved_size)) return 83; /*alloc fail*/
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
+  while(!error && !*done && reader->bp < stop_bp && out->size < stop_size) /*decode symbols until end code*/ {
+    /*length of the match to copy, or 0 if this iteration only output literals or ended the block*/
+    size_t length = 0;
+    unsigned entry;
+    /* with a 64-bit buffer one refill covers the worst case of a whole iteration: 15 bits for the length symbol,
+    5 extra, 15 for the distance symbol and 13 extra. With a 32-bit buffer the distance part refills again.*/
+    ensureBitsWide(reader);
+    entry = ll->table_fast[peekBits(reader, FASTBITS)];
+    if((entry & 15u) && ((entry >> 4u) & 3u) != FAST_LENGTH) {
+      /*runs of literals: keep decoding from the same refill while the next lookup still has all its bits. At most
+      2 bytes per bit of the buffer, so this stays within reserved_size*/
+      /*local copies: the byte stores could otherwise alias the reader and out fields, forcing reloads*/
+      size_t buffer = reader->buffer, used = 0;
+      unsigned char* dst = out->data + out->size;
+      do {
+        buffer >>= (entry & 15u);
+        used += entry & 15u;
+        *dst++ = (unsigned char)(entry >> 8u);
+        if(((entry >> 4u) & 3u) == FAST_LITERAL2) *dst++ = (unsigned char)(entry >> 16u);
+        if(used + FASTBITS > WIDEBITS) break;
+        entry = ll->table_fast[buffer & ((1u << FASTBITS) - 1u)];
+      } while((entry & 15u) && ((entry >> 4u) & 3u) != FAST_LENGTH);
+      reader->buffer = buffer;
+      reader->bp += used;
+      out->size = (size_t)(dst - out->data);
+    } else if(entry & 15u) {
+      advanceBits(reader, entry & 15u);
+      length = entry >> 8u;
+    } else {
+      /*code_ll is literal, length or end code*/
+      unsigned code_ll = huffmanDecodeSymbol(reader, ll);
+      if(code_ll <= 255) /*literal symbol*/ {
+        out->data[out->size++] = (unsigned char)code_ll;
+      } else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/ {
+        /*part 1: get length base*/
+        unsigned numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
+        length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+
+        /*part 2: get extra bits and add the value of that to length*/
+        if(numextrabits_l != 0) {
+          /* bits already ensured above */
+          length += readBits(reader, numextrabits_l);
+        }
+      } else if(code_ll == 256) {
+        *done = 1; /*end code, finish the loop*/
+      } else /*if(code_ll == INVALIDSYMBOL)*/ {
+        ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      }
+    }
 
-  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
-  else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
-
-
-  while(!error && !done) /*decode all symbols until end reached, breaks at end code*/ {
-    /*code_ll is literal, length or end code*/
-    unsigned code_ll;
-    /* ensure enough bits for 2 huffman code reads (15 bits each): if the first is a literal, a second literal is read at once. This
-    appears to be slightly faster, than ensuring 20 bits here for 1 huffman symbol and the potential 5 extra bits for the length symbol.*/
-    ensureBits32(reader, 30);
-    code_ll = huffmanDecodeSymbol(reader, &tree_ll);
-    if(code_ll <= 255) {
-      /*slightly faster code path if multiple literals in a row*/
-      out->data[out->size++] = (unsigned char)code_ll;
-      code_ll = huffmanDecodeSymbol(reader, &tree_ll);
-    }
-    if(code_ll <= 255) /*literal symbol*/ {
-      out->data[out->size++] = (unsigned char)code_ll;
-    } else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/ {
+    if(length != 0) {
       unsigned code_d, distance;
-      unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, backward, length;
-
-      /*part 1: get length base*/
-      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
-
-      /*part 2: get extra bits and add the value of that to length*/
-      numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(numextrabits_l != 0) {
-        /* bits already ensured above */
-        ensureBits25(reader, 5);
-        length += readBits(reader, numextrabits_l);
-      }
+      unsigned numextrabits_d; /*extra bits for distance*/
+      size_t start, backward;
 
       /*part 3: get distance code*/
-      ensureBits32(reader, 28); /* up to 15 for the huffman symbol, up to 13 for the extra bits */
-      code_d = huffmanDecodeSymbol(reader, &tree_d);
+      if(WIDEBITS < 48) ensureBits32(reader, 28); /* up to 15 for the huffman symbol, up to 13 for the extra bits */
+      code_d = huffmanDecodeSymbol(reader, d);
       if(code_d > 29) {
         if(code_d <= 31) {
           ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
@@ -1307,20 +1565,25 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
       backward = start - distance;
 
       out->size += length;
-      if(distance < length) {
+      if(distance >= 8) {
+        /*8 bytes at a time, possibly writing up to 7 bytes past the end (within reserved_size). Also correct when
+        source and destination overlap, since each step only reads bytes at least 8 before the ones it writes*/
+        unsigned char* dst = out->data + start;
+        const unsigned char* src = out->data + backward;
+        const unsigned char* end = dst + length;
+        do {
+          lodepng_memcpy(dst, src, 8);
+          dst += 8;
+          src += 8;
+        } while(dst < end);
+      } else if(distance == 1) {
+        lodepng_memset(out->data + start, out->data[backward], length);
+      } else {
         size_t forward;
-        lodepng_memcpy(out->data + start, out->data + backward, distance);
-        start += distance;
-        for(forward = distance; forward < length; ++forward) {
+        for(forward = 0; forward < length; ++forward) {
           out->data[start++] = out->data[backward++];
         }
-      } else {
-        lodepng_memcpy(out->data + start, out->data + backward, length);
       }
-    } else if(code_ll == 256) {
-      done = 1; /*end code, finish the loop*/
-    } else /*if(code_ll == INVALIDSYMBOL)*/ {
-      ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
     }
     if(out->allocsize - out->size < reserved_size) {
       if(!ucvector_reserve(out, out->size + reserved_size)) ERROR_BREAK(83); /*alloc fail*/
@@ -1337,6 +1600,25 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
     }
   }
 
+  return error;
+}
+
+/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
+static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
+                                    unsigned btype, size_t max_output_size) {
+  unsigned error;
+  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
+  HuffmanTree tree_d; /*the huffman tree for distance codes*/
+  const HuffmanTree* ll;
+  const HuffmanTree* d;
+  int done = 0;
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+
+  error = getTreesInflate(&tree_ll, &tree_d, &ll, &d, reader, btype);
+  if(!error) error = inflateHuffmanSymbols(out, reader, ll, d, (size_t)(-1), (size_t)(-1), max_output_size, &done);
+
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
 
@@ -1353,7 +1635,7 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
   bytepos = (reader->bp + 7u) >> 3u;
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(bytepos + 4 >= size) return 52; /*error, bit pointer will jump past memory*/
+  if(bytepos + 4 > size) return 52; /*error, bit pointer will jump past memory*/
   LEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
   NLEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
 
@@ -1733,6 +2015,109 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*hash of the 4 bytes at pos for LCL_FAST, a multiplicative hash to HASH_NUM_VALUES values*/
+static unsigned getHash4(const unsigned char* data, size_t pos) {
+  unsigned value = (unsigned)data[pos] | ((unsigned)data[pos + 1] << 8u) |
+                   ((unsigned)data[pos + 2] << 16u) | ((unsigned)data[pos + 3] << 24u);
+  return (((value * 2654435761u) & 0xffffffffu) >> 16u) & HASH_BIT_MASK;
+}
+
+/*
+LZ77 for LCL_FAST. hash->head maps the hash of 4 bytes to the last circular pos where they were seen. There is one
+probe per position and the first match is taken, without chains or lazy matching. A stale or colliding entry can
+only give a shorter match, since the bytes are compared anyway.
+*/
+static unsigned encodeLZ77Fast(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                               unsigned windowsize, unsigned minmatch) {
+  size_t pos = inpos;
+  unsigned error = 0;
+
+  if(windowsize == 0 || windowsize > 32768) return 60; /*error: windowsize smaller/larger than allowed*/
+  if((windowsize & (windowsize - 1)) != 0) return 90; /*error: must be power of two*/
+  if(minmatch < 4) minmatch = 4;
+
+  while(pos < insize) {
+    size_t length = 0, distance = 0;
+    if(pos + 4 <= insize) {
+      unsigned hashval = getHash4(in, pos);
+      int hashpos = hash->head[hashval];
+      hash->head[hashval] = (int)(pos & (windowsize - 1));
+      if(hashpos >= 0) {
+        distance = (pos - (size_t)hashpos) & (windowsize - 1);
+        if(distance != 0 && distance <= pos) {
+          const unsigned char* foreptr = &in[pos];
+          const unsigned char* backptr = &in[pos - distance];
+          const unsigned char* lastptr = &in[LODEPNG_MIN(insize, pos + MAX_SUPPORTED_DEFLATE_LENGTH)];
+          while(foreptr != lastptr && *backptr == *foreptr) {
+            ++backptr;
+            ++foreptr;
+          }
+          length = (size_t)(foreptr - &in[pos]);
+        }
+      }
+    }
+
+    if(length >= minmatch) {
+      size_t end = pos + length;
+      addLengthDistance(out, length, distance);
+      /*the skipped positions go in the table too, but without searching*/
+      for(++pos; pos < end; ++pos) {
+        if(pos + 4 <= insize) hash->head[getHash4(in, pos)] = (int)(pos & (windowsize - 1));
+      }
+    } else {
+      if(!uivector_push_back(out, in[pos])) ERROR_BREAK(83 /*alloc fail*/);
+      ++pos;
+    }
+  }
+
+  return error;
+}
+
+/*LZ77 for LCL_RLE: only matches at distance 1, which are the runs of one byte value*/
+static unsigned encodeRLE(uivector* out, const unsigned char* in, size_t inpos, size_t insize, unsigned minmatch) {
+  size_t pos = inpos;
+  unsigned error = 0;
+
+  if(minmatch < 3) minmatch = 3;
+
+  while(pos < insize) {
+    size_t length = 0;
+    if(pos > 0) {
+      const unsigned char* foreptr = &in[pos];
+      const unsigned char* lastptr = &in[LODEPNG_MIN(insize, pos + MAX_SUPPORTED_DEFLATE_LENGTH)];
+      unsigned char value = in[pos - 1];
+      while(foreptr != lastptr && *foreptr == value) ++foreptr;
+      length = (size_t)(foreptr - &in[pos]);
+    }
+
+    if(length >= minmatch) {
+      addLengthDistance(out, length, 1);
+      pos += length;
+    } else {
+      if(!uivector_push_back(out, in[pos])) ERROR_BREAK(83 /*alloc fail*/);
+      ++pos;
+    }
+  }
+
+  return error;
+}
+
+/*whether the settings use LZ77 at all, or only Huffman code the literals*/
+static unsigned useLZ77(const LodePNGCompressSettings* settings) {
+  return settings->use_lz77 && settings->level != LCL_HUFFMAN_ONLY;
+}
+
+/*LZ77 with the match finder of settings->level*/
+static unsigned encodeLZ77Level(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                                const LodePNGCompressSettings* settings) {
+  switch(settings->level) {
+    case LCL_FAST: return encodeLZ77Fast(out, hash, in, inpos, insize, settings->windowsize, settings->minmatch);
+    case LCL_RLE: return encodeRLE(out, in, inpos, insize, settings->minmatch);
+    default: return encodeLZ77(out, hash, in, inpos, insize, settings->windowsize,
+                               settings->minmatch, settings->nicematch, settings->lazymatching);
+  }
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
 static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
@@ -1741,6 +2126,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
 
   size_t i, numdeflateblocks = (datasize + 65534u) / 65535u;
   size_t datapos = 0;
+  if(numdeflateblocks == 0) numdeflateblocks = 1; /*one empty final block if there is no input*/
   for(i = 0; i != numdeflateblocks; ++i) {
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
@@ -1858,9 +2244,8 @@ static unsigned deflateDynamic(LodePNGBitWriter* writer, Hash* hash,
     lodepng_memset(frequencies_d, 0, 30 * sizeof(*frequencies_d));
     lodepng_memset(frequencies_cl, 0, NUM_CODE_LENGTH_CODES * sizeof(*frequencies_cl));
 
-    if(settings->use_lz77) {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+    if(useLZ77(settings)) {
+      error = encodeLZ77Level(&lz77_encoded, hash, data, datapos, dataend, settings);
       if(error) break;
     } else {
       if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
@@ -2042,11 +2427,10 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
     writeBits(writer, 1, 1); /*first bit of BTYPE*/
     writeBits(writer, 0, 1); /*second bit of BTYPE*/
 
-    if(settings->use_lz77) /*LZ77 encoded*/ {
+    if(useLZ77(settings)) /*LZ77 encoded*/ {
       uivector lz77_encoded;
       uivector_init(&lz77_encoded);
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      error = encodeLZ77Level(&lz77_encoded, hash, data, datapos, dataend, settings);
       if(!error) writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
       uivector_cleanup(&lz77_encoded);
     } else /*no LZ77, but still will be Huffman compressed*/ {
@@ -2065,6 +2449,156 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
+#ifdef LODEPNG_THREADS
+/*
+Parallel deflate, in the way of pigz: the input is cut in chunks that threads compress independently. The hash of
+each chunk is primed with the window before it, so matches still reach back into the previous chunk. All chunks but
+the last end with an empty stored block, a zlib sync flush, which puts them on a byte boundary so they can simply be
+concatenated. A chunk is as large as the largest block of lodepng_deflatev, and the output does not depend on the
+number of threads.
+*/
+#define DEFLATE_CHUNK_SIZE 262144u
+
+static unsigned adler32(const unsigned char* data, unsigned len);
+
+typedef struct DeflateChunk {
+  ucvector out;
+  unsigned adler;
+  unsigned error;
+} DeflateChunk;
+
+typedef struct DeflateChunks {
+  const unsigned char* in;
+  size_t insize;
+  const LodePNGCompressSettings* settings;
+  DeflateChunk* chunks;
+} DeflateChunks;
+
+/*the number of threads to deflate with, 1 if the input is too small to split or the settings can't be split*/
+static unsigned deflateThreads(size_t insize, const LodePNGCompressSettings* settings) {
+  unsigned threads = settings->threads;
+  unsigned windowsize = settings->windowsize;
+  if(settings->btype != 1 && settings->btype != 2) return 1;
+  /*leave invalid window sizes to lodepng_deflatev, which reports them*/
+  if(windowsize == 0 || windowsize > 32768 || (windowsize & (windowsize - 1)) != 0) return 1;
+  if(insize <= DEFLATE_CHUNK_SIZE) return 1;
+  if(threads == 0) threads = std::thread::hardware_concurrency();
+  return threads ? threads : 1;
+}
+
+static unsigned deflateChunk(ucvector* out, const unsigned char* in, size_t start, size_t end,
+                             const LodePNGCompressSettings* settings, unsigned final) {
+  unsigned error;
+  Hash hash;
+  LodePNGBitWriter writer;
+  LodePNGBitWriter_init(&writer, out);
+
+  error = hash_init(&hash, settings->windowsize);
+  if(!error && useLZ77(settings) && settings->level == LCL_FAST) {
+    /*fill the table with the window before the chunk, as encodeLZ77Fast would have left it*/
+    size_t pos = start > settings->windowsize ? start - settings->windowsize : 0;
+    for(; pos < start && pos + 4 <= end; ++pos) {
+      hash.head[getHash4(in, pos)] = (int)(pos & (settings->windowsize - 1));
+    }
+  } else if(!error && useLZ77(settings) && settings->level == LCL_DEFAULT) {
+    /*fill the hash chains with the window before the chunk, as encodeLZ77 would have left them*/
+    size_t pos = start > settings->windowsize ? start - settings->windowsize : 0;
+    unsigned numzeros = 0;
+    for(; pos < start; ++pos) {
+      unsigned hashval = getHash(in, end, pos);
+      if(hashval == 0) {
+        if(numzeros == 0) numzeros = countZeros(in, end, pos);
+        else if(pos + numzeros > end || in[pos + numzeros - 1] != 0) --numzeros;
+      } else {
+        numzeros = 0;
+      }
+      updateHashChain(&hash, pos & (settings->windowsize - 1), hashval, (unsigned short)numzeros);
+    }
+  }
+
+  if(!error) {
+    if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
+    else error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+  }
+  if(!error && !final) {
+    /*sync flush: BFINAL 0 and BTYPE 00, then LEN 0 and NLEN 65535 from the next byte on*/
+    writeBits(&writer, 0, 3);
+    if(!ucvector_resize(out, out->size + 4)) {
+      error = 83; /*alloc fail*/
+    } else {
+      out->data[out->size - 4] = 0;
+      out->data[out->size - 3] = 0;
+      out->data[out->size - 2] = 255;
+      out->data[out->size - 1] = 255;
+    }
+  }
+
+  hash_cleanup(&hash);
+  return error;
+}
+
+static void deflateChunkJob(void* context, size_t i) {
+  DeflateChunks* chunks = (DeflateChunks*)context;
+  DeflateChunk* chunk = &chunks->chunks[i];
+  size_t start = i * DEFLATE_CHUNK_SIZE;
+  size_t end = LODEPNG_MIN(start + DEFLATE_CHUNK_SIZE, chunks->insize);
+  chunk->error = deflateChunk(&chunk->out, chunks->in, start, end, chunks->settings, end == chunks->insize);
+  chunk->adler = adler32(chunks->in + start, (unsigned)(end - start));
+}
+
+/*Returns the Adler-32 of the concatenation of two pieces of data, given their Adler-32 and the size of the second*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2) {
+  unsigned rem = (unsigned)(len2 % 65521u);
+  unsigned s1 = adler1 & 0xffffu;
+  unsigned s2 = (rem * s1) % 65521u;
+  s1 += (adler2 & 0xffffu) + 65521u - 1u;
+  s2 += ((adler1 >> 16u) & 0xffffu) + ((adler2 >> 16u) & 0xffffu) + 65521u - rem;
+  if(s1 >= 65521u) s1 -= 65521u;
+  if(s1 >= 65521u) s1 -= 65521u;
+  if(s2 >= 65521u * 2u) s2 -= 65521u * 2u;
+  if(s2 >= 65521u) s2 -= 65521u;
+  return (s2 << 16u) | s1;
+}
+
+/*deflates with the given number of threads, and also gives the Adler-32 of the input if adler is not NULL*/
+static unsigned deflateParallel(ucvector* out, unsigned* adler, const unsigned char* in, size_t insize,
+                                const LodePNGCompressSettings* settings, unsigned threads) {
+  unsigned error = 0;
+  size_t i, total = out->size;
+  size_t numchunks = (insize + DEFLATE_CHUNK_SIZE - 1u) / DEFLATE_CHUNK_SIZE;
+  DeflateChunks chunks;
+  chunks.in = in;
+  chunks.insize = insize;
+  chunks.settings = settings;
+  chunks.chunks = (DeflateChunk*)lodepng_malloc(numchunks * sizeof(DeflateChunk));
+  if(!chunks.chunks) return 83; /*alloc fail*/
+  for(i = 0; i != numchunks; ++i) chunks.chunks[i].out = ucvector_init(NULL, 0);
+
+  lodepng_parallel_for(numchunks, threads, deflateChunkJob, &chunks);
+
+  for(i = 0; i != numchunks; ++i) {
+    if(!error) error = chunks.chunks[i].error;
+    total += chunks.chunks[i].out.size;
+  }
+  if(!error && !ucvector_reserve(out, total)) error = 83; /*alloc fail*/
+  if(adler) *adler = 1u;
+  for(i = 0; i != numchunks; ++i) {
+    DeflateChunk* chunk = &chunks.chunks[i];
+    if(!error) {
+      lodepng_memcpy(out->data + out->size, chunk->out.data, chunk->out.size);
+      out->size += chunk->out.size;
+      if(adler) {
+        size_t size = LODEPNG_MIN((size_t)DEFLATE_CHUNK_SIZE, insize - i * DEFLATE_CHUNK_SIZE);
+        *adler = adler32_combine(*adler, chunk->adler, size);
+      }
+    }
+    lodepng_free(chunk->out.data);
+  }
+  lodepng_free(chunks.chunks);
+  return error;
+}
+#endif /*LODEPNG_THREADS*/
+
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
                                  const LodePNGCompressSettings* settings) {
   unsigned error = 0;
@@ -2072,6 +2606,11 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   Hash hash;
   LodePNGBitWriter writer;
 
+#ifdef LODEPNG_THREADS
+  unsigned threads = deflateThreads(insize, settings);
+  if(threads > 1) return deflateParallel(out, 0, in, insize, settings, threads);
+#endif /*LODEPNG_THREADS*/
+
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
@@ -2084,7 +2623,8 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     if(blocksize > 262144) blocksize = 262144;
   }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
+  /*one empty final block if there is no input, blocksize is then 0 for btype 1*/
+  numdeflateblocks = blocksize ? (insize + blocksize - 1) / blocksize : 1;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
   error = hash_init(&hash, settings->windowsize);
@@ -2134,9 +2674,98 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+#ifdef LODEPNG_X86_SIMD
+/*
+Adler-32 over 32-byte blocks: s1 gets the byte sums (psadbw), s2 the byte sums weighted by 32..1 (pmaddubsw) plus
+32 times the s1 of all previous blocks, accumulated in ps and multiplied in at the end. As in the scalar version,
+the sums are reduced modulo 65521 at least every 5552 bytes.
+*/
+LODEPNG_TARGET("ssse3")
+static unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data, size_t blocks) {
+  unsigned s1 = adler & 0xffffu;
+  unsigned s2 = (adler >> 16u) & 0xffffu;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  while(blocks != 0) {
+    size_t n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m128i ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i vs1 = zero;
+    __m128i vs2 = _mm_cvtsi32_si128((int)s2);
+    blocks -= n;
+    do {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      ps = _mm_add_epi32(ps, vs1);
+      vs1 = _mm_add_epi32(vs1, _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+    } while(--n);
+    vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(ps, 5));
+    vs1 = _mm_add_epi32(vs1, _mm_shuffle_epi32(vs1, _MM_SHUFFLE(1, 0, 3, 2)));
+    vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(2, 3, 0, 1)));
+    vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(vs1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(vs2) % 65521u;
+  }
+  return (s2 << 16u) | s1;
+}
+
+/*same as update_adler32_ssse3 with one 32-byte register per block*/
+LODEPNG_TARGET("avx2")
+static unsigned update_adler32_avx2(unsigned adler, const unsigned char* data, size_t blocks) {
   unsigned s1 = adler & 0xffffu;
   unsigned s2 = (adler >> 16u) & 0xffffu;
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  while(blocks != 0) {
+    size_t n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m256i ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i vs1 = zero;
+    __m256i vs2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m128i sum1, sum2;
+    blocks -= n;
+    do {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      ps = _mm256_add_epi32(ps, vs1);
+      vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+      vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      data += 32;
+    } while(--n);
+    vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(ps, 5));
+    sum1 = _mm_add_epi32(_mm256_castsi256_si128(vs1), _mm256_extracti128_si256(vs1, 1));
+    sum2 = _mm_add_epi32(_mm256_castsi256_si128(vs2), _mm256_extracti128_si256(vs2, 1));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(sum1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(sum2) % 65521u;
+  }
+  return (s2 << 16u) | s1;
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+  unsigned s1, s2;
+
+#ifdef LODEPNG_X86_SIMD
+  if(len >= 64u) {
+    unsigned features = lodepng_cpu_features();
+    if(features & LODEPNG_CPU_AVX2) adler = update_adler32_avx2(adler, data, len / 32u);
+    else if(features & LODEPNG_CPU_SSSE3) adler = update_adler32_ssse3(adler, data, len / 32u);
+    if(features & (LODEPNG_CPU_AVX2 | LODEPNG_CPU_SSSE3)) {
+      data += len & ~31u;
+      len &= 31u;
+    }
+  }
+#endif /*LODEPNG_X86_SIMD*/
+
+  s1 = adler & 0xffffu;
+  s2 = (adler >> 16u) & 0xffffu;
 
   while(len != 0u) {
     unsigned i;
@@ -2216,6 +2845,205 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
   return error;
 }
 
+/*
+Incremental zlib decompression, for the streaming PNG decoder. Input is pushed in pieces of any size, and each run
+decodes as far as the input allows. A run that is not final stops 8 bytes before the end of the input inside Huffman
+blocks, and waits for 600 bytes before reading a block header, which is more than the largest dynamic block header,
+so that no read ever needs bytes that were not pushed yet. Output before outpos was taken by the caller, of that only
+the last 32768 bytes are kept as the window for the distances of later matches.
+*/
+/*like memmove, for the case where dst is before src which is the only one needed here*/
+static void lodepng_memmove(void* dst, const void* src, size_t size) {
+  size_t i;
+  for(i = 0; i < size; i++) ((char*)dst)[i] = ((const char*)src)[i];
+}
+
+typedef enum ZlibStreamStage {
+  ZSTREAM_HEADER, /*waiting for the 2-byte zlib header*/
+  ZSTREAM_BLOCK, /*waiting for the header of the next deflate block*/
+  ZSTREAM_STORED, /*copying the bytes of a stored block*/
+  ZSTREAM_HUFFMAN, /*decoding the symbols of a Huffman block*/
+  ZSTREAM_ADLER, /*waiting for the adler32 checksum*/
+  ZSTREAM_DONE
+} ZlibStreamStage;
+
+typedef struct ZlibStream {
+  ucvector in; /*input not consumed yet, bp is the bit position in it*/
+  size_t bp;
+  ucvector out;
+  size_t outpos; /*the output before this was taken by the caller*/
+  size_t adlerpos; /*the output before this is included in adler*/
+  unsigned adler;
+  ZlibStreamStage stage;
+  unsigned BFINAL;
+  unsigned stored; /*bytes left to copy of the stored block*/
+  HuffmanTree tree_ll;
+  HuffmanTree tree_d;
+  const HuffmanTree* ll;
+  const HuffmanTree* d;
+  const LodePNGDecompressSettings* settings;
+} ZlibStream;
+
+static void ZlibStream_init(ZlibStream* z, const LodePNGDecompressSettings* settings) {
+  z->in = ucvector_init(NULL, 0);
+  z->bp = 0;
+  z->out = ucvector_init(NULL, 0);
+  z->outpos = z->adlerpos = 0;
+  z->adler = 1u;
+  z->stage = ZSTREAM_HEADER;
+  z->BFINAL = 0;
+  z->stored = 0;
+  HuffmanTree_init(&z->tree_ll);
+  HuffmanTree_init(&z->tree_d);
+  z->ll = z->d = 0;
+  z->settings = settings;
+}
+
+static void ZlibStream_cleanup(ZlibStream* z) {
+  lodepng_free(z->in.data);
+  lodepng_free(z->out.data);
+  HuffmanTree_cleanup(&z->tree_ll);
+  HuffmanTree_cleanup(&z->tree_d);
+}
+
+/*appends input, after dropping the bytes that were consumed already*/
+static unsigned ZlibStream_push(ZlibStream* z, const unsigned char* in, size_t insize) {
+  size_t consumed = z->bp >> 3u;
+  if(consumed) {
+    lodepng_memmove(z->in.data, z->in.data + consumed, z->in.size - consumed);
+    z->in.size -= consumed;
+    z->bp &= 7u;
+  }
+  if(!insize) return 0;
+  if(!ucvector_reserve(&z->in, z->in.size + insize)) return 83; /*alloc fail*/
+  lodepng_memcpy(z->in.data + z->in.size, in, insize);
+  z->in.size += insize;
+  return 0;
+}
+
+/*drops the output that was taken, except for the 32768 bytes of the window*/
+static void ZlibStream_compact(ZlibStream* z) {
+  if(z->outpos > 65536u) {
+    size_t shift = z->outpos - 32768u;
+    lodepng_memmove(z->out.data, z->out.data + shift, z->out.size - shift);
+    z->out.size -= shift;
+    z->outpos -= shift;
+    z->adlerpos -= shift;
+  }
+}
+
+/*
+Decodes as much of the pushed input as possible. Stops early with *full set once the output reaches stop_size, so
+the caller can take it first. Set final when all input was pushed, then missing input is an error like in
+lodepng_zlib_decompress instead of a reason to wait.
+*/
+static unsigned ZlibStream_run(ZlibStream* z, size_t stop_size, int final, int* full) {
+  unsigned error = 0;
+  LodePNGBitReader reader;
+  *full = 0;
+  error = LodePNGBitReader_init(&reader, z->in.data, z->in.size);
+  reader.bp = z->bp;
+
+  while(!error && z->stage != ZSTREAM_DONE) {
+    size_t avail = z->in.size - (reader.bp >> 3u); /*bytes available from the byte containing bp*/
+    if(z->out.size >= stop_size) {
+      *full = 1;
+      break;
+    }
+    if(z->stage == ZSTREAM_HEADER) {
+      unsigned CM, CINFO, FDICT;
+      const unsigned char* in = z->in.data;
+      if(z->in.size < 2) {
+        if(final) error = 53; /*error, size of zlib data too small*/
+        break;
+      }
+      /*see lodepng_zlib_decompressv for these checks*/
+      if((in[0] * 256 + in[1]) % 31 != 0) ERROR_BREAK(24);
+      CM = in[0] & 15;
+      CINFO = (in[0] >> 4) & 15;
+      FDICT = (in[1] >> 5) & 1;
+      if(CM != 8 || CINFO > 7) ERROR_BREAK(25);
+      if(FDICT != 0) ERROR_BREAK(26);
+      reader.bp = 16;
+      z->stage = ZSTREAM_BLOCK;
+    } else if(z->stage == ZSTREAM_BLOCK) {
+      unsigned BTYPE;
+      if(!final && avail < 600) break; /*wait for more input*/
+      if(reader.bitsize - reader.bp < 3) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+      ensureBits9(&reader, 3);
+      z->BFINAL = readBits(&reader, 1);
+      BTYPE = readBits(&reader, 2);
+      if(BTYPE == 3) {
+        ERROR_BREAK(20); /*error: invalid BTYPE*/
+      } else if(BTYPE == 0) {
+        /*see inflateNoCompression*/
+        size_t bytepos = (reader.bp + 7u) >> 3u;
+        unsigned LEN, NLEN;
+        if(bytepos + 4 > z->in.size) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+        LEN = (unsigned)z->in.data[bytepos] + ((unsigned)z->in.data[bytepos + 1] << 8u);
+        NLEN = (unsigned)z->in.data[bytepos + 2] + ((unsigned)z->in.data[bytepos + 3] << 8u);
+        if(!z->settings->ignore_nlen && LEN + NLEN != 65535) ERROR_BREAK(21); /*error: NLEN is not one's complement of LEN*/
+        reader.bp = (bytepos + 4) << 3u;
+        z->stored = LEN;
+        z->stage = ZSTREAM_STORED;
+      } else {
+        error = getTreesInflate(&z->tree_ll, &z->tree_d, &z->ll, &z->d, &reader, BTYPE);
+        z->stage = ZSTREAM_HUFFMAN;
+      }
+    } else if(z->stage == ZSTREAM_STORED) {
+      size_t amount = z->stored;
+      size_t bytepos = reader.bp >> 3u;
+      if(amount > avail) {
+        /*a preview may stop inside the block, before the end of its data*/
+        if(final && avail < stop_size - z->out.size) ERROR_BREAK(23); /*error: reading outside of in buffer*/
+        amount = avail;
+      }
+      if(amount > stop_size - z->out.size) amount = stop_size - z->out.size;
+      if(!amount && z->stored) break; /*wait for more input*/
+      if(!ucvector_reserve(&z->out, z->out.size + amount)) ERROR_BREAK(83); /*alloc fail*/
+      if(amount) lodepng_memcpy(z->out.data + z->out.size, z->in.data + bytepos, amount);
+      z->out.size += amount;
+      reader.bp = (bytepos + amount) << 3u;
+      z->stored -= (unsigned)amount;
+      if(!z->stored) z->stage = z->BFINAL ? ZSTREAM_ADLER : ZSTREAM_BLOCK;
+    } else if(z->stage == ZSTREAM_HUFFMAN) {
+      int done = 0;
+      size_t stop_bp = final ? (size_t)(-1) : (z->in.size > 8 ? (z->in.size - 8) << 3u : 0);
+      error = inflateHuffmanSymbols(&z->out, &reader, z->ll, z->d, stop_bp, stop_size, 0, &done);
+      if(error) break;
+      if(done) {
+        HuffmanTree_cleanup(&z->tree_ll);
+        HuffmanTree_cleanup(&z->tree_d);
+        HuffmanTree_init(&z->tree_ll);
+        HuffmanTree_init(&z->tree_d);
+        z->stage = z->BFINAL ? ZSTREAM_ADLER : ZSTREAM_BLOCK;
+      } else if(z->out.size < stop_size) {
+        break; /*wait for more input*/
+      }
+    } else /*if(z->stage == ZSTREAM_ADLER)*/ {
+      size_t bytepos = (reader.bp + 7u) >> 3u;
+      if(!z->settings->ignore_adler32) {
+        if(bytepos + 4 > z->in.size) {
+          if(final) error = 58; /*error, the checksum is missing*/
+          break;
+        }
+        z->adler = update_adler32(z->adler, z->out.data + z->adlerpos, (unsigned)(z->out.size - z->adlerpos));
+        z->adlerpos = z->out.size;
+        if(z->adler != lodepng_read32bitInt(&z->in.data[bytepos])) ERROR_BREAK(58); /*error, adler checksum not correct*/
+        reader.bp = (bytepos + 4) << 3u;
+      }
+      z->stage = ZSTREAM_DONE;
+    }
+  }
+
+  z->bp = reader.bp;
+  if(!z->settings->ignore_adler32 && z->out.size != z->adlerpos) {
+    z->adler = update_adler32(z->adler, z->out.data + z->adlerpos, (unsigned)(z->out.size - z->adlerpos));
+    z->adlerpos = z->out.size;
+  }
+  return error;
+}
+
 /*expected_size is expected output size, to avoid intermediate allocations. Set to 0 if not known. */
 static unsigned zlib_decompress(unsigned char** out, size_t* outsize, size_t expected_size,
                                 const unsigned char* in, size_t insize, const LodePNGDecompressSettings* settings) {
@@ -2252,7 +3080,19 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned error;
   unsigned char* deflatedata = 0;
   size_t deflatesize = 0;
-
+  unsigned ADLER32 = 0, have_adler = 0;
+
+#ifdef LODEPNG_THREADS
+  /*the threads also compute the checksum of their chunks*/
+  unsigned threads = settings->custom_deflate ? 1 : deflateThreads(insize, settings);
+  if(threads > 1) {
+    ucvector v = ucvector_init(NULL, 0);
+    error = deflateParallel(&v, &ADLER32, in, insize, settings, threads);
+    deflatedata = v.data;
+    deflatesize = v.size;
+    have_adler = 1;
+  } else
+#endif /*LODEPNG_THREADS*/
   error = deflate(&deflatedata, &deflatesize, in, insize, settings);
 
   *out = NULL;
@@ -2264,7 +3104,6 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   }
 
   if(!error) {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
     /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
     unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
     unsigned FLEVEL = 0;
@@ -2272,6 +3111,7 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
     unsigned CMFFLG = 256 * CMF + FDICT * 32 + FLEVEL * 64;
     unsigned FCHECK = 31 - CMFFLG % 31;
     CMFFLG += FCHECK;
+    if(!have_adler) ADLER32 = adler32(in, (unsigned)insize);
 
     (*out)[0] = (unsigned char)(CMFFLG >> 8);
     (*out)[1] = (unsigned char)(CMFFLG & 255);
@@ -2332,13 +3172,15 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings) {
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->level = LCL_DEFAULT;
+  settings->threads = 1;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, LCL_DEFAULT, 1, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2654,10 +3496,89 @@ static const unsigned lodepng_crc32_table7[256] = {
   0x2c8e0fffu, 0xe0240f61u, 0x6eab0882u, 0xa201081cu, 0xa8c40105u, 0x646e019bu, 0xeae10678u, 0x264b06e6u
 };
 
-/* Computes the cyclic redundancy check as used by PNG chunks*/
-unsigned lodepng_crc32(const unsigned char* data, size_t length) {
+#ifdef LODEPNG_X86_SIMD
+/*
+CRC32 by folding with carry-less multiplication, from "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+Instruction" (Intel). Four 128-bit lanes are folded 64 bytes at a time, then into one lane, which is reduced to 64
+and then 32 bits with a Barrett reduction. The constants are for the bit reflected PNG/zlib polynomial, written
+as 32-bit halves: k1 = 0x1c6e41596, k2 = 0x154442bd4, k3 = 0x1751997d0, k4 = 0xccaa009e, k5 = 0x163cd6124,
+polynomial 0x1db710641 and mu 0x1f7011641.
+r is the running, not inverted, CRC. length must be a multiple of 16 and at least 64.
+*/
+LODEPNG_TARGET("sse2,pclmul")
+static unsigned lodepng_crc32_pclmul(unsigned r, const unsigned char* data, size_t length) {
+  const __m128i k1k2 = _mm_setr_epi32(0x54442bd4, 0x1, (int)0xc6e41596u, 0x1);
+  const __m128i k3k4 = _mm_setr_epi32(0x751997d0, 0x1, (int)0xccaa009eu, 0x0);
+  const __m128i k5 = _mm_setr_epi32(0x63cd6124, 0x1, 0x0, 0x0);
+  const __m128i poly = _mm_setr_epi32((int)0xdb710641u, 0x1, (int)0xf7011641u, 0x1);
+  const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x0, x1, x2, x3, x4, x5;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128((int)r));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+  data += 64;
+  length -= 64;
+
+  /*fold the 4 lanes in parallel*/
+  while(length >= 64) {
+    x0 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), x0);
+    x0 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), x0);
+    x0 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), x0);
+    x0 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), x0);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)(data + 16)));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)(data + 32)));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)(data + 48)));
+    data += 64;
+    length -= 64;
+  }
+
+  /*fold the lanes into one, then the remaining 16-byte blocks*/
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+  while(length >= 16) {
+    x2 = _mm_loadu_si128((const __m128i*)data);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    data += 16;
+    length -= 16;
+  }
+
+  /*128 to 64 bits*/
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), x2);
+
+  /*Barrett reduction to 32 bits*/
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+/*updates the running, not inverted, CRC r with more data*/
+static unsigned lodepng_crc32_update(unsigned r, const unsigned char* data, size_t length) {
   /*Using the Slicing by Eight algorithm*/
-  unsigned r = 0xffffffffu;
+#ifdef LODEPNG_X86_SIMD
+  if(length >= 64 && (lodepng_cpu_features() & LODEPNG_CPU_PCLMUL)) {
+    size_t amount = length & ~(size_t)15u;
+    r = lodepng_crc32_pclmul(r, data, amount);
+    data += amount;
+    length -= amount;
+  }
+#endif /*LODEPNG_X86_SIMD*/
   while(length >= 8) {
     r = lodepng_crc32_table7[(data[0] ^ (r & 0xffu))] ^
         lodepng_crc32_table6[(data[1] ^ ((r >> 8) & 0xffu))] ^
@@ -2673,7 +3594,12 @@ unsigned lodepng_crc32(const unsigned char* data, size_t length) {
   while(length--) {
     r = lodepng_crc32_table0[(r ^ *data++) & 0xffu] ^ (r >> 8);
   }
-  return r ^ 0xffffffffu;
+  return r;
+}
+
+/* Computes the cyclic redundancy check as used by PNG chunks*/
+unsigned lodepng_crc32(const unsigned char* data, size_t length) {
+  return lodepng_crc32_update(0xffffffffu, data, length) ^ 0xffffffffu;
 }
 #else /* LODEPNG_COMPILE_CRC */
 /*in this case, the function is only declared here, and must be defined externally
@@ -3792,16 +4718,197 @@ static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned s
   }
 }
 
-unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
-                         const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
-                         unsigned w, unsigned h) {
-  size_t i;
-  ColorTree tree;
-  size_t numpixels = (size_t)w * (size_t)h;
-  unsigned error = 0;
-
-  if(mode_in->colortype == LCT_PALETTE && !mode_in->palette) {
-    return 107; /* error: must provide palette if input mode is palette */
+/*
+Conversion kernels for the most common pairs of color modes, picked once per lodepng_convert call by
+getConvertKernel. They give the same bytes as the generic code above. in and out must not overlap.
+*/
+typedef void (*ConvertKernel)(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                              size_t numpixels, const LodePNGColorMode* mode_in);
+
+/*palette with 1, 2 or 4 bits per index to RGBA 8-bit: a whole input byte at a time instead of bit by bit*/
+static void convertPaletteLowToRGBA8(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                     size_t numpixels, const LodePNGColorMode* mode_in) {
+  unsigned bits = mode_in->bitdepth;
+  unsigned mask = (1u << bits) - 1u;
+  size_t perbyte = 8u / bits;
+  size_t i = 0;
+  for(; i + perbyte <= numpixels; i += perbyte) {
+    unsigned value = *in++;
+    unsigned shift = 8u;
+    size_t k;
+    for(k = 0; k != perbyte; ++k) {
+      shift -= bits;
+      /*out of bounds of palette not checked: see lodepng_color_mode_alloc_palette.*/
+      lodepng_memcpy(&out[(i + k) * 4], &mode_in->palette[((value >> shift) & mask) * 4], 4);
+    }
+  }
+  if(i != numpixels) {
+    unsigned value = *in;
+    unsigned shift = 8u;
+    for(; i != numpixels; ++i) {
+      shift -= bits;
+      lodepng_memcpy(&out[i * 4], &mode_in->palette[((value >> shift) & mask) * 4], 4);
+    }
+  }
+}
+
+#ifdef LODEPNG_X86_SIMD
+/*The loops of these kernels stop early enough that the 16 byte loads and stores stay within the image, the
+remaining pixels are done one by one.*/
+LODEPNG_TARGET("ssse3")
+static void convertRGB8ToRGBA8SSSE3(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                    size_t numpixels, const LodePNGColorMode* mode_in) {
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_setr_epi8(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+  (void)mode_in;
+  for(; i + 6 <= numpixels; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&in[i * 3]);
+    _mm_storeu_si128((__m128i*)&out[i * 4], _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha));
+  }
+  for(; i != numpixels; ++i) {
+    lodepng_memcpy(&out[i * 4], &in[i * 3], 3);
+    out[i * 4 + 3] = 255;
+  }
+}
+
+LODEPNG_TARGET("ssse3")
+static void convertRGBA8ToRGB8SSSE3(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                    size_t numpixels, const LodePNGColorMode* mode_in) {
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  (void)mode_in;
+  /*the last 4 bytes of each store are overwritten by the next one*/
+  for(; i + 6 <= numpixels; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&in[i * 4]);
+    _mm_storeu_si128((__m128i*)&out[i * 3], _mm_shuffle_epi8(x, shuffle));
+  }
+  for(; i != numpixels; ++i) lodepng_memcpy(&out[i * 3], &in[i * 4], 3);
+}
+
+LODEPNG_TARGET("ssse3")
+static void convertGrey8ToRGBA8SSSE3(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                     size_t numpixels, const LodePNGColorMode* mode_in) {
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1);
+  const __m128i alpha = _mm_setr_epi8(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+  (void)mode_in;
+  for(; i + 16 <= numpixels; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&in[i]);
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 16],
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(x, 4), shuffle), alpha));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 32],
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(x, 8), shuffle), alpha));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 48],
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(x, 12), shuffle), alpha));
+  }
+  for(; i != numpixels; ++i) {
+    out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i];
+    out[i * 4 + 3] = 255;
+  }
+}
+
+LODEPNG_TARGET("ssse3")
+static void convertGreyAlpha8ToRGBA8SSSE3(unsigned char* LODEPNG_RESTRICT out,
+                                          const unsigned char* LODEPNG_RESTRICT in,
+                                          size_t numpixels, const LodePNGColorMode* mode_in) {
+  size_t i = 0;
+  const __m128i lo = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+  const __m128i hi = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+  (void)mode_in;
+  for(; i + 8 <= numpixels; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&in[i * 2]);
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_shuffle_epi8(x, lo));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_shuffle_epi8(x, hi));
+  }
+  for(; i != numpixels; ++i) {
+    out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i * 2 + 0];
+    out[i * 4 + 3] = in[i * 2 + 1];
+  }
+}
+
+/*16-bit to 8-bit with the same channels keeps the most significant, first, byte of each big endian sample*/
+LODEPNG_TARGET("sse2")
+static void convertHighBytesSSE2(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                 size_t numbytes) {
+  size_t i = 0;
+  const __m128i low = _mm_set1_epi16(255);
+  for(; i + 16 <= numbytes; i += 16) {
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 2 + 0]), low);
+    __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 2 + 16]), low);
+    _mm_storeu_si128((__m128i*)&out[i], _mm_packus_epi16(a, b));
+  }
+  for(; i != numbytes; ++i) out[i] = in[i * 2];
+}
+
+static void convertRGBA16ToRGBA8SSE2(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                     size_t numpixels, const LodePNGColorMode* mode_in) {
+  (void)mode_in;
+  convertHighBytesSSE2(out, in, numpixels * 4u);
+}
+
+static void convertRGB16ToRGB8SSE2(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                   size_t numpixels, const LodePNGColorMode* mode_in) {
+  (void)mode_in;
+  convertHighBytesSSE2(out, in, numpixels * 3u);
+}
+
+/*palette expansion with a gather from the palette, which always has room for 256 colors*/
+LODEPNG_TARGET("avx2")
+static void convertPalette8ToRGBA8AVX2(unsigned char* LODEPNG_RESTRICT out, const unsigned char* LODEPNG_RESTRICT in,
+                                       size_t numpixels, const LodePNGColorMode* mode_in) {
+  size_t i = 0;
+  const int* palette = (const int*)mode_in->palette;
+  for(; i + 8 <= numpixels; i += 8) {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&in[i]));
+    _mm256_storeu_si256((__m256i*)&out[i * 4], _mm256_i32gather_epi32(palette, index, 4));
+  }
+  for(; i != numpixels; ++i) lodepng_memcpy(&out[i * 4], &mode_in->palette[in[i] * 4], 4);
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+/*returns the kernel for converting mode_in to mode_out, or NULL if the generic code must do it*/
+static ConvertKernel getConvertKernel(const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in) {
+  LodePNGColorType in = mode_in->colortype;
+  unsigned bits = mode_in->bitdepth;
+#ifdef LODEPNG_X86_SIMD
+  unsigned features = lodepng_cpu_features();
+#endif /*LODEPNG_X86_SIMD*/
+  if(mode_out->bitdepth != 8) return 0;
+  if(mode_out->colortype == LCT_RGBA) {
+    if(in == LCT_PALETTE && bits < 8) return convertPaletteLowToRGBA8;
+#ifdef LODEPNG_X86_SIMD
+    if(in == LCT_PALETTE && bits == 8 && (features & LODEPNG_CPU_AVX2)) return convertPalette8ToRGBA8AVX2;
+    /*the color key makes some pixels transparent, left to the generic code*/
+    if(in == LCT_RGB && bits == 8 && !mode_in->key_defined && (features & LODEPNG_CPU_SSSE3)) {
+      return convertRGB8ToRGBA8SSSE3;
+    }
+    if(in == LCT_GREY && bits == 8 && !mode_in->key_defined && (features & LODEPNG_CPU_SSSE3)) {
+      return convertGrey8ToRGBA8SSSE3;
+    }
+    if(in == LCT_GREY_ALPHA && bits == 8 && (features & LODEPNG_CPU_SSSE3)) return convertGreyAlpha8ToRGBA8SSSE3;
+    if(in == LCT_RGBA && bits == 16 && (features & LODEPNG_CPU_SSE2)) return convertRGBA16ToRGBA8SSE2;
+#endif /*LODEPNG_X86_SIMD*/
+  } else if(mode_out->colortype == LCT_RGB) {
+#ifdef LODEPNG_X86_SIMD
+    if(in == LCT_RGBA && bits == 8 && (features & LODEPNG_CPU_SSSE3)) return convertRGBA8ToRGB8SSSE3;
+    if(in == LCT_RGB && bits == 16 && (features & LODEPNG_CPU_SSE2)) return convertRGB16ToRGB8SSE2;
+#endif /*LODEPNG_X86_SIMD*/
+  }
+  return 0;
+}
+
+unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
+                         const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                         unsigned w, unsigned h) {
+  size_t i;
+  ColorTree tree;
+  size_t numpixels = (size_t)w * (size_t)h;
+  unsigned error = 0;
+
+  if(mode_in->colortype == LCT_PALETTE && !mode_in->palette) {
+    return 107; /* error: must provide palette if input mode is palette */
   }
 
   if(lodepng_color_mode_equal(mode_out, mode_in)) {
@@ -3839,7 +4946,10 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
   }
 
   if(!error) {
-    if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16) {
+    ConvertKernel kernel = getConvertKernel(mode_out, mode_in);
+    if(kernel) {
+      kernel(out, in, numpixels, mode_in);
+    } else if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16) {
       for(i = 0; i != numpixels; ++i) {
         unsigned short r = 0, g = 0, b = 0, a = 0;
         getPixelColorRGBA16(&r, &g, &b, &a, in, i, mode_in);
@@ -4377,6 +5487,158 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_X86_SIMD
+/*
+SIMD versions of the filters of unfilterScanline. Same aliasing rules: recon may equal scanline or lie before it
+(in-place Adam7), so every loop loads its input before storing and never stores past the bytes it consumed.
+Sub, Average and Paeth depend on the pixel to the left, so only Up benefits from wider AVX2 registers.
+*/
+LODEPNG_TARGET("sse2")
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i p = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(s, p));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+LODEPNG_TARGET("avx2")
+static void unfilterUpAVX2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length) {
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+    __m256i p = _mm256_loadu_si256((const __m256i*)&precon[i]);
+    _mm256_storeu_si256((__m256i*)&recon[i], _mm256_add_epi8(s, p));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+/*prefix sum of 4 pixels per register, plus the last pixel of the previous register broadcast to all of them*/
+LODEPNG_TARGET("sse2")
+static void unfilterSub4SSE2(unsigned char* recon, const unsigned char* scanline, size_t length) {
+  size_t i = 0;
+  __m128i last = _mm_setzero_si128();
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi8(x, last);
+    _mm_storeu_si128((__m128i*)&recon[i], x);
+    last = _mm_shuffle_epi32(x, 0xFF);
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + (i < 4 ? 0 : recon[i - 4]);
+}
+
+/*as above with 4 RGB pixels (12 bytes) per register; only those 12 bytes are stored*/
+LODEPNG_TARGET("ssse3")
+static void unfilterSub3SSSE3(unsigned char* recon, const unsigned char* scanline, size_t length) {
+  size_t i = 0;
+  __m128i last = _mm_setzero_si128();
+  const __m128i broadcast = _mm_setr_epi8(9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, -1, -1, -1, -1);
+  for(; i + 16 <= length; i += 12) {
+    unsigned tail;
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+    x = _mm_add_epi8(x, last);
+    _mm_storel_epi64((__m128i*)&recon[i], x);
+    tail = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+    lodepng_memcpy(&recon[i + 8], &tail, 4);
+    last = _mm_shuffle_epi8(x, broadcast);
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + (i < 3 ? 0 : recon[i - 3]);
+}
+
+/*bytewidth is 3 or 4; only that many bytes are read and written*/
+LODEPNG_TARGET("sse2")
+static __m128i loadPixelSSE2(const unsigned char* p, size_t bytewidth) {
+  unsigned v = p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  if(bytewidth == 4) v |= (unsigned)p[3] << 24u;
+  return _mm_cvtsi32_si128((int)v);
+}
+
+LODEPNG_TARGET("sse2")
+static void storePixelSSE2(unsigned char* p, __m128i x, size_t bytewidth) {
+  unsigned v = (unsigned)_mm_cvtsi128_si32(x);
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8u);
+  p[2] = (unsigned char)(v >> 16u);
+  if(bytewidth == 4) p[3] = (unsigned char)(v >> 24u);
+}
+
+/*(a + b) >> 1 from the rounding-up pavgb by subtracting the carry bit*/
+LODEPNG_TARGET("sse2")
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length) {
+  size_t i;
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = loadPixelSSE2(&precon[i], bytewidth);
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(avg, loadPixelSSE2(&scanline[i], bytewidth));
+    storePixelSSE2(&recon[i], a, bytewidth);
+  }
+}
+
+/*paethPredictor on all channels of a pixel at once, in 16-bit lanes, with the same tie breaking*/
+LODEPNG_TARGET("sse2")
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length) {
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixelSSE2(&scanline[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc, pred, smaller;
+    pc = _mm_add_epi16(pa, pb);
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    smaller = _mm_cmplt_epi16(pb, pa);
+    pred = _mm_or_si128(_mm_andnot_si128(smaller, a), _mm_and_si128(smaller, b));
+    smaller = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+    pred = _mm_or_si128(_mm_andnot_si128(smaller, pred), _mm_and_si128(smaller, c));
+    a = _mm_and_si128(_mm_add_epi16(x, pred), _mm_set1_epi16(255));
+    storePixelSSE2(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*returns 1 if the scanline was unfiltered, 0 if the portable code must handle it*/
+static unsigned unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                     size_t bytewidth, unsigned char filterType, size_t length) {
+  unsigned features = lodepng_cpu_features();
+  if(!(features & LODEPNG_CPU_SSE2)) return 0;
+  switch(filterType) {
+    case 1:
+      if(bytewidth == 4) unfilterSub4SSE2(recon, scanline, length);
+      else if(bytewidth == 3 && (features & LODEPNG_CPU_SSSE3)) unfilterSub3SSSE3(recon, scanline, length);
+      else return 0;
+      return 1;
+    case 2:
+      if(!precon) return 0;
+      if(features & LODEPNG_CPU_AVX2) unfilterUpAVX2(recon, scanline, precon, length);
+      else unfilterUpSSE2(recon, scanline, precon, length);
+      return 1;
+    case 3:
+      if(!precon || (bytewidth != 3 && bytewidth != 4)) return 0;
+      unfilterAverageSSE2(recon, scanline, precon, bytewidth, length);
+      return 1;
+    case 4:
+      if(!precon || (bytewidth != 3 && bytewidth != 4)) return 0;
+      unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+      return 1;
+    default: return 0;
+  }
+}
+#endif /*LODEPNG_X86_SIMD*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length) {
   /*
@@ -4389,6 +5651,9 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_X86_SIMD
+  if(unfilterScanlineSIMD(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /*LODEPNG_X86_SIMD*/
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -5169,6 +6434,110 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
   return error;
 }
 
+/*
+Reads a chunk other than IHDR, IDAT and IEND into the state. critical_pos tells where unknown chunks are remembered
+(1 = after IHDR, 2 = after PLTE, 3 = after IDAT) and is updated by PLTE. The CRC is checked here for known chunks.
+Returns error code.
+*/
+static unsigned decodeChunk(LodePNGState* state, const unsigned char* chunk, unsigned* critical_pos) {
+  unsigned error = 0;
+  unsigned unknown = 0;
+  unsigned chunkLength = lodepng_chunk_length(chunk);
+  const unsigned char* data = lodepng_chunk_data_const(chunk);
+  if(lodepng_chunk_type_equals(chunk, "PLTE")) {
+    /*palette chunk (PLTE)*/
+    error = readChunk_PLTE(&state->info_png.color, data, chunkLength);
+    if(error) return error;
+    *critical_pos = 2;
+  } else if(lodepng_chunk_type_equals(chunk, "tRNS")) {
+    /*palette transparency chunk (tRNS). Even though this one is an ancillary chunk , it is still compiled
+    in without 'LODEPNG_COMPILE_ANCILLARY_CHUNKS' because it contains essential color information that
+    affects the alpha channel of pixels. */
+    error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
+    if(error) return error;
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    /*background color chunk (bKGD)*/
+  } else if(lodepng_chunk_type_equals(chunk, "bKGD")) {
+    error = readChunk_bKGD(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "tEXt")) {
+    /*text chunk (tEXt)*/
+    if(state->decoder.read_text_chunks) {
+      error = readChunk_tEXt(&state->info_png, data, chunkLength);
+      if(error) return error;
+    }
+  } else if(lodepng_chunk_type_equals(chunk, "zTXt")) {
+    /*compressed text chunk (zTXt)*/
+    if(state->decoder.read_text_chunks) {
+      error = readChunk_zTXt(&state->info_png, &state->decoder, data, chunkLength);
+      if(error) return error;
+    }
+  } else if(lodepng_chunk_type_equals(chunk, "iTXt")) {
+    /*international text chunk (iTXt)*/
+    if(state->decoder.read_text_chunks) {
+      error = readChunk_iTXt(&state->info_png, &state->decoder, data, chunkLength);
+      if(error) return error;
+    }
+  } else if(lodepng_chunk_type_equals(chunk, "tIME")) {
+    error = readChunk_tIME(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "pHYs")) {
+    error = readChunk_pHYs(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "gAMA")) {
+    error = readChunk_gAMA(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "cHRM")) {
+    error = readChunk_cHRM(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "sRGB")) {
+    error = readChunk_sRGB(&state->info_png, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "iCCP")) {
+    error = readChunk_iCCP(&state->info_png, &state->decoder, data, chunkLength);
+    if(error) return error;
+  } else if(lodepng_chunk_type_equals(chunk, "sBIT")) {
+    error = readChunk_sBIT(&state->info_png, data, chunkLength);
+    if(error) return error;
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  } else /*it's not an implemented chunk type, so ignore it: skip over the data*/ {
+    /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
+    if(!state->decoder.ignore_critical && !lodepng_chunk_ancillary(chunk)) {
+      return 69;
+    }
+
+    unknown = 1;
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    if(state->decoder.remember_unknown_chunks) {
+      error = lodepng_chunk_append(&state->info_png.unknown_chunks_data[*critical_pos - 1],
+                                   &state->info_png.unknown_chunks_size[*critical_pos - 1], chunk);
+      if(error) return error;
+    }
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  }
+
+  if(!state->decoder.ignore_crc && !unknown) /*check CRC if wanted, only on known chunk types*/ {
+    if(lodepng_chunk_check_crc(chunk)) return 57; /*invalid CRC*/
+  }
+  return 0;
+}
+
+/*size of all scanlines of the image including filter bytes, the decompressed size of the IDAT chunks*/
+static size_t getExpectedIdatSize(unsigned w, unsigned h, const LodePNGInfo* info_png) {
+  unsigned bpp = lodepng_get_bpp(&info_png->color);
+  size_t expected_size = 0;
+  if(info_png->interlace_method == 0) return lodepng_get_raw_size_idat(w, h, bpp);
+  /*Adam-7 interlaced: expected size is the sum of the 7 sub-images sizes*/
+  expected_size += lodepng_get_raw_size_idat((w + 7) >> 3, (h + 7) >> 3, bpp);
+  if(w > 4) expected_size += lodepng_get_raw_size_idat((w + 3) >> 3, (h + 7) >> 3, bpp);
+  expected_size += lodepng_get_raw_size_idat((w + 3) >> 2, (h + 3) >> 3, bpp);
+  if(w > 2) expected_size += lodepng_get_raw_size_idat((w + 1) >> 2, (h + 3) >> 2, bpp);
+  expected_size += lodepng_get_raw_size_idat((w + 1) >> 1, (h + 1) >> 2, bpp);
+  if(w > 1) expected_size += lodepng_get_raw_size_idat((w + 0) >> 1, (h + 1) >> 1, bpp);
+  expected_size += lodepng_get_raw_size_idat((w + 0), (h + 0) >> 1, bpp);
+  return expected_size;
+}
+
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
@@ -5182,11 +6551,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   size_t outsize = 0;
 
   /*for unknown chunk order*/
-  unsigned unknown = 0;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-
 
   /* safe output values in case error happens */
   *out = 0;
@@ -5232,8 +6597,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
     data = lodepng_chunk_data_const(chunk);
 
-    unknown = 0;
-
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT")) {
       size_t newsize;
@@ -5241,87 +6604,19 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       if(newsize > insize) CERROR_BREAK(state->error, 95);
       lodepng_memcpy(idat + idatsize, data, chunkLength);
       idatsize += chunkLength;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     } else if(lodepng_chunk_type_equals(chunk, "IEND")) {
       /*IEND chunk*/
       IEND = 1;
-    } else if(lodepng_chunk_type_equals(chunk, "PLTE")) {
-      /*palette chunk (PLTE)*/
-      state->error = readChunk_PLTE(&state->info_png.color, data, chunkLength);
-      if(state->error) break;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      critical_pos = 2;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    } else if(lodepng_chunk_type_equals(chunk, "tRNS")) {
-      /*palette transparency chunk (tRNS). Even though this one is an ancillary chunk , it is still compiled
-      in without 'LODEPNG_COMPILE_ANCILLARY_CHUNKS' because it contains essential color information that
-      affects the alpha channel of pixels. */
-      state->error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
-      if(state->error) break;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      /*background color chunk (bKGD)*/
-    } else if(lodepng_chunk_type_equals(chunk, "bKGD")) {
-      state->error = readChunk_bKGD(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "tEXt")) {
-      /*text chunk (tEXt)*/
-      if(state->decoder.read_text_chunks) {
-        state->error = readChunk_tEXt(&state->info_png, data, chunkLength);
-        if(state->error) break;
-      }
-    } else if(lodepng_chunk_type_equals(chunk, "zTXt")) {
-      /*compressed text chunk (zTXt)*/
-      if(state->decoder.read_text_chunks) {
-        state->error = readChunk_zTXt(&state->info_png, &state->decoder, data, chunkLength);
-        if(state->error) break;
-      }
-    } else if(lodepng_chunk_type_equals(chunk, "iTXt")) {
-      /*international text chunk (iTXt)*/
-      if(state->decoder.read_text_chunks) {
-        state->error = readChunk_iTXt(&state->info_png, &state->decoder, data, chunkLength);
-        if(state->error) break;
-      }
-    } else if(lodepng_chunk_type_equals(chunk, "tIME")) {
-      state->error = readChunk_tIME(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "pHYs")) {
-      state->error = readChunk_pHYs(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "gAMA")) {
-      state->error = readChunk_gAMA(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "cHRM")) {
-      state->error = readChunk_cHRM(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "sRGB")) {
-      state->error = readChunk_sRGB(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "iCCP")) {
-      state->error = readChunk_iCCP(&state->info_png, &state->decoder, data, chunkLength);
-      if(state->error) break;
-    } else if(lodepng_chunk_type_equals(chunk, "sBIT")) {
-      state->error = readChunk_sBIT(&state->info_png, data, chunkLength);
+    } else {
+      /*all other chunks, decodeChunk also checks their CRC*/
+      state->error = decodeChunk(state, chunk, &critical_pos);
       if(state->error) break;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    } else /*it's not an implemented chunk type, so ignore it: skip over the data*/ {
-      /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
-      if(!state->decoder.ignore_critical && !lodepng_chunk_ancillary(chunk)) {
-        CERROR_BREAK(state->error, 69);
-      }
-
-      unknown = 1;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      if(state->decoder.remember_unknown_chunks) {
-        state->error = lodepng_chunk_append(&state->info_png.unknown_chunks_data[critical_pos - 1],
-                                            &state->info_png.unknown_chunks_size[critical_pos - 1], chunk);
-        if(state->error) break;
-      }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+      chunk = lodepng_chunk_next_const(chunk, in + insize);
+      continue;
     }
 
-    if(!state->decoder.ignore_crc && !unknown) /*check CRC if wanted, only on known chunk types*/ {
+    if(!state->decoder.ignore_crc) /*check CRC if wanted*/ {
       if(lodepng_chunk_check_crc(chunk)) CERROR_BREAK(state->error, 57); /*invalid CRC*/
     }
 
@@ -5335,21 +6630,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   if(!state->error) {
     /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
     If the decompressed size does not match the prediction, the image must be corrupt.*/
-    if(state->info_png.interlace_method == 0) {
-      unsigned bpp = lodepng_get_bpp(&state->info_png.color);
-      expected_size = lodepng_get_raw_size_idat(*w, *h, bpp);
-    } else {
-      unsigned bpp = lodepng_get_bpp(&state->info_png.color);
-      /*Adam-7 interlaced: expected size is the sum of the 7 sub-images sizes*/
-      expected_size = 0;
-      expected_size += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, bpp);
-      if(*w > 4) expected_size += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, bpp);
-      expected_size += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, bpp);
-      if(*w > 2) expected_size += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, bpp);
-      expected_size += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, bpp);
-      if(*w > 1) expected_size += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, bpp);
-      expected_size += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, bpp);
-    }
+    expected_size = getExpectedIdatSize(*w, *h, &state->info_png);
 
     state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &state->decoder.zlibsettings);
   }
@@ -5405,6 +6686,516 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+
+typedef enum LodePNGStreamStage {
+  STREAM_SIGNATURE, /*collecting the signature and the IHDR chunk*/
+  STREAM_CHUNK, /*collecting the length and type of the next chunk*/
+  STREAM_BODY, /*collecting a whole chunk to decode it at once*/
+  STREAM_IDAT, /*passing the data of an IDAT chunk on to inflate*/
+  STREAM_IDAT_CRC, /*collecting the CRC of an IDAT chunk*/
+  STREAM_END /*after IEND*/
+} LodePNGStreamStage;
+
+struct LodePNGStreamDecoder {
+  LodePNGState* state;
+  LodePNGRowCallback callback;
+  void* user;
+  LodePNGStreamStage stage;
+  ucvector buf; /*the bytes being collected in the current stage*/
+  size_t need; /*size buf must reach to finish the current stage*/
+  unsigned remaining; /*data bytes left of the current IDAT chunk*/
+  unsigned crc; /*running CRC of the current IDAT chunk*/
+  unsigned deferred; /*error in the data of the current IDAT chunk, given once its CRC shows whether that is 57*/
+  unsigned critical_pos; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
+  unsigned started; /*whether the first IDAT chunk was reached and the fields below are set up*/
+  unsigned convert; /*whether rows are converted to info_raw*/
+  unsigned w, h;
+  unsigned scale; /*1, or 2, 4 or 8 for a preview, see lodepng_stream_decoder_set_scale*/
+  unsigned outw, outh; /*size of the image given to the callback, reduced by scale*/
+  unsigned y; /*next row given to the callback*/
+  unsigned line; /*next scanline to unfilter, of a non-interlaced image*/
+  size_t prefix; /*for a preview of an interlaced image, the inflated size of its passes, else 0*/
+  size_t bytewidth; /*bytes per pixel for the filters, at least 1*/
+  size_t linebytes; /*bytes per scanline, excluding the filter byte*/
+  size_t expected; /*size of all scanlines together, including filter bytes*/
+  size_t window; /*how much output to decode before taking the rows out*/
+  unsigned char* rows; /*room for two unfiltered scanlines: the previous and the current one*/
+  unsigned char* converted; /*room for one row in the color type of info_raw*/
+  unsigned char* sampled; /*room for one reduced row of a preview*/
+  ZlibStream zlib;
+};
+
+/*whether IDAT data can be passed on before its whole chunk is there, that needs CRC of parts*/
+static unsigned streamIdatDirect(const LodePNGStreamDecoder* dec) {
+#ifdef LODEPNG_COMPILE_CRC
+  (void)dec;
+  return 1;
+#else /*LODEPNG_COMPILE_CRC*/
+  return dec->state->decoder.ignore_crc;
+#endif /*LODEPNG_COMPILE_CRC*/
+}
+
+/*the number of Adam7 passes that hold all pixels of a preview with this scale*/
+static unsigned previewPasses(unsigned scale) {
+  return scale == 8 ? 1 : scale == 4 ? 3 : 5;
+}
+
+/*copies the pixel of bpp bits at bit ibp of in to bit obp of out*/
+static void copyPixelBits(unsigned char* out, size_t obp, const unsigned char* in, size_t ibp, unsigned bpp) {
+  if(bpp >= 8) {
+    lodepng_memcpy(&out[obp / 8u], &in[ibp / 8u], bpp / 8u);
+  } else {
+    unsigned b;
+    for(b = 0; b != bpp; ++b) setBitOfReversedStream(&obp, out, readBitFromReversedStream(&ibp, in));
+  }
+}
+
+/*at the first IDAT chunk: checks the chunks so far and sets up the output like lodepng_decode does*/
+static unsigned streamStart(LodePNGStreamDecoder* dec) {
+  LodePNGState* state = dec->state;
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  size_t rowsize;
+  dec->started = 1;
+  if(state->info_png.color.colortype == LCT_PALETTE && !state->info_png.color.palette) {
+    return 106; /* error: PNG file must have PLTE chunk if color type is palette */
+  }
+  dec->convert = state->decoder.color_convert && !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color);
+  if(!state->decoder.color_convert) {
+    CERROR_TRY_RETURN(lodepng_color_mode_copy(&state->info_raw, &state->info_png.color));
+  } else if(dec->convert && !(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+            && !(state->info_raw.bitdepth == 8)) {
+    return 56; /*unsupported color mode conversion*/
+  }
+
+  dec->bytewidth = (bpp + 7u) / 8u;
+  dec->linebytes = lodepng_get_raw_size_idat(dec->w, 1, bpp) - 1u;
+  dec->expected = getExpectedIdatSize(dec->w, dec->h, &state->info_png);
+  dec->window = LODEPNG_MAX((size_t)65536u, 2u * (dec->linebytes + 1u));
+  dec->outw = (dec->w + dec->scale - 1u) / dec->scale;
+  dec->outh = (dec->h + dec->scale - 1u) / dec->scale;
+  if(dec->scale != 1) {
+    dec->sampled = (unsigned char*)lodepng_malloc(lodepng_get_raw_size_idat(dec->outw, 1, bpp) - 1u);
+    if(!dec->sampled) return 83; /*alloc fail*/
+    if(state->info_png.interlace_method == 1) {
+      unsigned passw[7], passh[7];
+      size_t filter_passstart[8], padded_passstart[8], passstart[8];
+      Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, dec->w, dec->h, bpp);
+      dec->prefix = filter_passstart[previewPasses(dec->scale)];
+    }
+  }
+  rowsize = lodepng_get_raw_size(dec->w, 1, &state->info_raw);
+  dec->rows = (unsigned char*)lodepng_malloc(2u * dec->linebytes);
+  dec->converted = (unsigned char*)lodepng_malloc(LODEPNG_MAX(rowsize, dec->linebytes));
+  if(!dec->rows || !dec->converted) return 83; /*alloc fail*/
+  return 0;
+}
+
+/*gives row y to the callback, row is byte aligned in the color type of the PNG*/
+static unsigned streamOutputRow(LodePNGStreamDecoder* dec, const unsigned char* row) {
+  LodePNGState* state = dec->state;
+  size_t rowsize = dec->linebytes;
+  if(dec->scale != 1) rowsize = lodepng_get_raw_size_idat(dec->outw, 1, lodepng_get_bpp(&state->info_png.color)) - 1u;
+  if(dec->convert) {
+    CERROR_TRY_RETURN(lodepng_convert(dec->converted, row, &state->info_raw, &state->info_png.color, dec->outw, 1));
+    row = dec->converted;
+    rowsize = lodepng_get_raw_size(dec->outw, 1, &state->info_raw);
+  }
+  if(dec->callback(dec->user, row, rowsize, dec->y, dec->outw, dec->outh)) return 116; /*aborted by the callback*/
+  ++dec->y;
+  return 0;
+}
+
+/*unfilters and outputs all complete scanlines of the inflated data, for non-interlaced images*/
+static unsigned streamRows(LodePNGStreamDecoder* dec) {
+  ZlibStream* z = &dec->zlib;
+  while(z->out.size - z->outpos >= dec->linebytes + 1u) {
+    const unsigned char* scanline = z->out.data + z->outpos;
+    unsigned char* recon = dec->rows + (dec->line & 1u) * dec->linebytes;
+    const unsigned char* precon = dec->line ? dec->rows + ((dec->line + 1u) & 1u) * dec->linebytes : 0;
+    if(dec->line == dec->h) return 91; /*decompressed size doesn't match prediction*/
+    CERROR_TRY_RETURN(unfilterScanline(recon, scanline + 1, precon, dec->bytewidth, scanline[0], dec->linebytes));
+    z->outpos += dec->linebytes + 1u;
+    if(dec->scale == 1) {
+      CERROR_TRY_RETURN(streamOutputRow(dec, recon));
+    } else if(dec->line % dec->scale == 0) {
+      /*a preview keeps every scale-th pixel of every scale-th row*/
+      unsigned bpp = lodepng_get_bpp(&dec->state->info_png.color);
+      unsigned x;
+      dec->sampled[lodepng_get_raw_size_idat(dec->outw, 1, bpp) - 2u] = 0; /*zero the padding bits*/
+      for(x = 0; x != dec->outw; ++x) {
+        copyPixelBits(dec->sampled, (size_t)x * bpp, recon, (size_t)x * dec->scale * bpp, bpp);
+      }
+      CERROR_TRY_RETURN(streamOutputRow(dec, dec->sampled));
+    }
+    ++dec->line;
+  }
+  if(dec->line == dec->h && z->out.size != z->outpos) return 91; /*decompressed size doesn't match prediction*/
+  ZlibStream_compact(z);
+  return 0;
+}
+
+/*outputs the rows of an interlaced image, once all its scanlines are inflated*/
+static unsigned streamRowsInterlaced(LodePNGStreamDecoder* dec) {
+  LodePNGState* state = dec->state;
+  unsigned error;
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  size_t rowbits = (size_t)dec->w * bpp;
+  unsigned char* image = (unsigned char*)lodepng_malloc(lodepng_get_raw_size(dec->w, dec->h, &state->info_png.color));
+  if(!image) return 83; /*alloc fail*/
+  error = postProcessScanlines(image, dec->zlib.out.data, dec->w, dec->h, &state->info_png);
+  while(!error && dec->y < dec->h) {
+    if(rowbits % 8u == 0) {
+      error = streamOutputRow(dec, image + dec->y * (rowbits / 8u));
+    } else {
+      /*the image has no padding bits, move the row to a byte boundary and zero the padding bits after it*/
+      size_t i, bp = dec->y * rowbits, obp = 0;
+      dec->rows[dec->linebytes - 1u] = 0;
+      for(i = 0; i != rowbits; ++i) setBitOfReversedStream(&obp, dec->rows, readBitFromReversedStream(&bp, image));
+      error = streamOutputRow(dec, dec->rows);
+    }
+  }
+  lodepng_free(image);
+  return error;
+}
+
+/*outputs a preview of an interlaced image from its first passes, once those are inflated*/
+static unsigned streamRowsPreview(LodePNGStreamDecoder* dec) {
+  unsigned passw[7], passh[7];
+  size_t filter_passstart[8], padded_passstart[8], passstart[8];
+  unsigned bpp = lodepng_get_bpp(&dec->state->info_png.color);
+  unsigned numpasses = previewPasses(dec->scale);
+  unsigned char* data = dec->zlib.out.data;
+  unsigned i, x;
+
+  Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, dec->w, dec->h, bpp);
+  /*in place like postProcessScanlines, the padding bits of the pass rows are skipped below instead of removed*/
+  for(i = 0; i != numpasses; ++i) {
+    CERROR_TRY_RETURN(unfilter(&data[padded_passstart[i]], &data[filter_passstart[i]], passw[i], passh[i], bpp));
+  }
+  while(dec->y < dec->outh) {
+    size_t py = (size_t)dec->y * dec->scale;
+    dec->sampled[lodepng_get_raw_size_idat(dec->outw, 1, bpp) - 2u] = 0; /*zero the padding bits*/
+    for(x = 0; x != dec->outw; ++x) {
+      size_t px = (size_t)x * dec->scale, linebits;
+      /*the pass that has this pixel, one of the first numpasses since the coordinates are multiples of scale*/
+      for(i = 0; i + 1u < numpasses; ++i) {
+        if(px % ADAM7_DX[i] == ADAM7_IX[i] && py % ADAM7_DY[i] == ADAM7_IY[i]) break;
+      }
+      linebits = ((passw[i] * bpp + 7u) / 8u) * 8u;
+      copyPixelBits(dec->sampled, (size_t)x * bpp, &data[padded_passstart[i]],
+                    (py - ADAM7_IY[i]) / ADAM7_DY[i] * linebits + (px - ADAM7_IX[i]) / ADAM7_DX[i] * bpp, bpp);
+    }
+    CERROR_TRY_RETURN(streamOutputRow(dec, dec->sampled));
+  }
+  return 0;
+}
+
+/*inflates the pushed IDAT data and outputs the completed rows, final when no more IDAT data can follow*/
+static unsigned streamInflate(LodePNGStreamDecoder* dec, int final) {
+  ZlibStream* z = &dec->zlib;
+  unsigned interlaced = dec->state->info_png.interlace_method != 0;
+  int full = 1;
+  while(full) {
+    /*interlaced images are kept whole, one byte more than expected is enough to know it's too much*/
+    size_t stop_size = dec->prefix ? dec->prefix : interlaced ? dec->expected + 1u : z->outpos + dec->window;
+    CERROR_TRY_RETURN(ZlibStream_run(z, stop_size, final, &full));
+    if(dec->prefix) {
+      if(z->out.size >= dec->prefix) {
+        /*the preview has all its passes, the rest of the file is not needed*/
+        dec->stage = STREAM_END;
+        return streamRowsPreview(dec);
+      }
+    } else if(interlaced) {
+      if(z->out.size > dec->expected) return 91; /*decompressed size doesn't match prediction*/
+    } else {
+      CERROR_TRY_RETURN(streamRows(dec));
+    }
+  }
+  if(final) {
+    if(z->stage != ZSTREAM_DONE) return 52; /*error, the zlib data ended early*/
+    if(dec->prefix) return 91; /*the data ended before the passes of the preview*/
+    if(interlaced) {
+      if(z->out.size != dec->expected) return 91; /*decompressed size doesn't match prediction*/
+      CERROR_TRY_RETURN(streamRowsInterlaced(dec));
+    } else if(dec->line != dec->h) {
+      return 91; /*decompressed size doesn't match prediction*/
+    }
+    if(dec->y != dec->outh) return 91; /*decompressed size doesn't match prediction*/
+  }
+  return 0;
+}
+
+/*handles the bytes collected in buf once it reached the needed size*/
+static unsigned streamCollected(LodePNGStreamDecoder* dec) {
+  LodePNGState* state = dec->state;
+  unsigned char* buf = dec->buf.data;
+  if(dec->stage == STREAM_SIGNATURE) {
+    CERROR_TRY_RETURN(lodepng_inspect(&dec->w, &dec->h, state, buf, dec->buf.size));
+    if(lodepng_pixel_overflow(dec->w, dec->h, &state->info_png.color, &state->info_raw)) {
+      return 92; /*overflow possible due to amount of pixels*/
+    }
+    dec->stage = STREAM_CHUNK;
+    dec->need = 8;
+  } else if(dec->stage == STREAM_CHUNK) {
+    unsigned chunkLength = lodepng_chunk_length(buf);
+    /*error: chunk length larger than the max PNG chunk size*/
+    if(chunkLength > 2147483647) return 63;
+    if(lodepng_chunk_type_equals(buf, "IDAT")) {
+      if(!dec->started) CERROR_TRY_RETURN(streamStart(dec));
+      dec->critical_pos = 3;
+    }
+    if(lodepng_chunk_type_equals(buf, "IDAT") && streamIdatDirect(dec)) {
+#ifdef LODEPNG_COMPILE_CRC
+      dec->crc = lodepng_crc32_update(0xffffffffu, buf + 4, 4);
+#endif /*LODEPNG_COMPILE_CRC*/
+      dec->remaining = chunkLength;
+      dec->stage = chunkLength ? STREAM_IDAT : STREAM_IDAT_CRC;
+      dec->need = 4;
+      dec->buf.size = 0;
+      return 0;
+    }
+    dec->stage = STREAM_BODY;
+    dec->need = (size_t)chunkLength + 12u;
+    return 0; /*keep the chunk header in buf*/
+  } else if(dec->stage == STREAM_BODY) {
+    if(lodepng_chunk_type_equals(buf, "IDAT")) {
+      if(!state->decoder.ignore_crc && lodepng_chunk_check_crc(buf)) return 57; /*invalid CRC*/
+      CERROR_TRY_RETURN(ZlibStream_push(&dec->zlib, buf + 8, dec->buf.size - 12u));
+      CERROR_TRY_RETURN(streamInflate(dec, 0));
+      if(dec->stage == STREAM_END) return 0; /*a preview that is complete*/
+    } else if(lodepng_chunk_type_equals(buf, "IEND")) {
+      if(!state->decoder.ignore_crc && lodepng_chunk_check_crc(buf)) return 57; /*invalid CRC*/
+      dec->stage = STREAM_END;
+      if(!dec->started) CERROR_TRY_RETURN(streamStart(dec));
+      return streamInflate(dec, 1);
+    } else {
+      CERROR_TRY_RETURN(decodeChunk(state, buf, &dec->critical_pos));
+    }
+    dec->stage = STREAM_CHUNK;
+    dec->need = 8;
+  } else if(dec->stage == STREAM_IDAT_CRC) {
+#ifdef LODEPNG_COMPILE_CRC
+    if(!state->decoder.ignore_crc && (dec->crc ^ 0xffffffffu) != lodepng_read32bitInt(buf)) {
+      return 57; /*invalid CRC*/
+    }
+#endif /*LODEPNG_COMPILE_CRC*/
+    if(dec->deferred) return dec->deferred;
+    dec->stage = STREAM_CHUNK;
+    dec->need = 8;
+  }
+  dec->buf.size = 0;
+  return 0;
+}
+
+static unsigned streamPush(LodePNGStreamDecoder* dec, const unsigned char* in, size_t insize) {
+  while(insize && dec->stage != STREAM_END) {
+    size_t amount;
+    if(dec->stage == STREAM_IDAT) {
+      /*pass on at most 64 KiB at once, so the inflate input stays small even if the pieces pushed are large*/
+      amount = LODEPNG_MIN(LODEPNG_MIN(insize, (size_t)dec->remaining), (size_t)65536u);
+#ifdef LODEPNG_COMPILE_CRC
+      if(!dec->state->decoder.ignore_crc) dec->crc = lodepng_crc32_update(dec->crc, in, amount);
+#endif /*LODEPNG_COMPILE_CRC*/
+      if(!dec->deferred) {
+        unsigned error = ZlibStream_push(&dec->zlib, in, amount);
+        if(!error) error = streamInflate(dec, 0);
+        /*the data is inflated before its CRC is known. A damaged chunk gives 57 like with lodepng_decode, so its
+        error waits for the CRC, unless CRCs are ignored or the callback aborted*/
+        if(error == 116 || dec->state->decoder.ignore_crc) return error;
+        dec->deferred = error;
+      }
+      if(dec->stage == STREAM_END) return 0; /*a preview that is complete*/
+      dec->remaining -= (unsigned)amount;
+      if(!dec->remaining) dec->stage = STREAM_IDAT_CRC;
+    } else {
+      amount = LODEPNG_MIN(insize, dec->need - dec->buf.size);
+      if(!ucvector_reserve(&dec->buf, dec->buf.size + amount)) return 83; /*alloc fail*/
+      lodepng_memcpy(dec->buf.data + dec->buf.size, in, amount);
+      dec->buf.size += amount;
+      if(dec->buf.size == dec->need) CERROR_TRY_RETURN(streamCollected(dec));
+    }
+    in += amount;
+    insize -= amount;
+  }
+  return 0;
+}
+
+unsigned lodepng_stream_decoder_create(LodePNGStreamDecoder** decoder, LodePNGState* state,
+                                       LodePNGRowCallback callback, void* user) {
+  LodePNGStreamDecoder* dec = (LodePNGStreamDecoder*)lodepng_malloc(sizeof(LodePNGStreamDecoder));
+  *decoder = dec;
+  if(!dec) return 83; /*alloc fail*/
+  dec->state = state;
+  dec->callback = callback;
+  dec->user = user;
+  dec->stage = STREAM_SIGNATURE;
+  dec->buf = ucvector_init(NULL, 0);
+  dec->need = 33; /*the signature and the IHDR chunk*/
+  dec->remaining = 0;
+  dec->crc = dec->deferred = 0;
+  dec->critical_pos = 1;
+  dec->started = dec->convert = 0;
+  dec->w = dec->h = dec->y = dec->line = 0;
+  dec->scale = 1;
+  dec->outw = dec->outh = 0;
+  dec->bytewidth = dec->linebytes = dec->expected = dec->window = dec->prefix = 0;
+  dec->rows = dec->converted = dec->sampled = 0;
+  ZlibStream_init(&dec->zlib, &state->decoder.zlibsettings);
+  state->error = 0;
+  return 0;
+}
+
+unsigned lodepng_stream_decoder_push(LodePNGStreamDecoder* decoder, const unsigned char* in, size_t insize) {
+  if(!decoder->state->error) decoder->state->error = streamPush(decoder, in, insize);
+  return decoder->state->error;
+}
+
+unsigned lodepng_stream_decoder_finish(LodePNGStreamDecoder* decoder) {
+  LodePNGStreamDecoder* dec = decoder;
+  LodePNGState* state = dec->state;
+  if(state->error || dec->stage == STREAM_END) return state->error;
+  if(dec->stage == STREAM_SIGNATURE) {
+    /*gives the error for a too small file, it can't succeed with less than 33 bytes*/
+    state->error = lodepng_inspect(&dec->w, &dec->h, state, dec->buf.data, dec->buf.size);
+    if(!state->error) state->error = 27;
+  } else if(dec->prefix && !dec->deferred) {
+    /*a preview of an interlaced image only needs its passes, the inflate above kept some of the data back because
+    more could follow. Without ignore_end, a file cut off before the end of the passes still misses its IEND*/
+    state->error = streamInflate(dec, 1);
+    if(state->error && !state->decoder.ignore_end) state->error = 30;
+    dec->stage = STREAM_END;
+  } else if(!state->decoder.ignore_end) {
+    state->error = 30; /*the IEND chunk is missing*/
+  } else if(dec->deferred) {
+    state->error = dec->deferred; /*the CRC that could have shown damage is missing*/
+  } else {
+    if(!dec->started) state->error = streamStart(dec);
+    if(!state->error) state->error = streamInflate(dec, 1);
+    dec->stage = STREAM_END;
+  }
+  return state->error;
+}
+
+void lodepng_stream_decoder_destroy(LodePNGStreamDecoder* decoder) {
+  if(!decoder) return;
+  lodepng_free(decoder->buf.data);
+  lodepng_free(decoder->rows);
+  lodepng_free(decoder->converted);
+  lodepng_free(decoder->sampled);
+  ZlibStream_cleanup(&decoder->zlib);
+  lodepng_free(decoder);
+}
+
+unsigned lodepng_stream_decoder_set_scale(LodePNGStreamDecoder* decoder, unsigned scale) {
+  if(decoder->started || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) return 118;
+  decoder->scale = scale;
+  return 0;
+}
+
+unsigned lodepng_stream_decoder_done(const LodePNGStreamDecoder* decoder) {
+  return decoder->stage == STREAM_END;
+}
+
+typedef struct DecodeIntoTarget {
+  unsigned char* out;
+  size_t pitch;
+} DecodeIntoTarget;
+
+static unsigned decodeIntoRow(void* user, const unsigned char* row, size_t rowsize,
+                              unsigned y, unsigned w, unsigned h) {
+  const DecodeIntoTarget* target = (const DecodeIntoTarget*)user;
+  lodepng_memcpy(target->out + (size_t)y * target->pitch, row, rowsize);
+  (void)w;
+  (void)h;
+  return 0;
+}
+
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t pitch, unsigned* w, unsigned* h,
+                             LodePNGState* state, const unsigned char* in, size_t insize) {
+  LodePNGStreamDecoder* decoder;
+  DecodeIntoTarget target;
+  const LodePNGColorMode* color;
+  size_t rowsize, needed;
+  unsigned error;
+
+  state->error = lodepng_inspect(w, h, state, in, insize);
+  if(state->error) return state->error;
+  if(lodepng_pixel_overflow(*w, *h, &state->info_png.color, &state->info_raw)) {
+    CERROR_RETURN_ERROR(state->error, 92); /*overflow possible due to amount of pixels*/
+  }
+  /*check the buffer before anything is written to it*/
+  color = state->decoder.color_convert ? &state->info_raw : &state->info_png.color;
+  rowsize = lodepng_get_raw_size(*w, 1, color);
+  if(pitch < rowsize || lodepng_mulofl(pitch, *h - 1u, &needed) || lodepng_addofl(needed, rowsize, &needed)
+     || outsize < needed) {
+    CERROR_RETURN_ERROR(state->error, 117);
+  }
+
+  target.out = out;
+  target.pitch = pitch;
+  error = lodepng_stream_decoder_create(&decoder, state, decodeIntoRow, &target);
+  if(error) CERROR_RETURN_ERROR(state->error, error);
+  error = lodepng_stream_decoder_push(decoder, in, insize);
+  if(!error) error = lodepng_stream_decoder_finish(decoder);
+  lodepng_stream_decoder_destroy(decoder);
+  return error;
+}
+
+unsigned lodepng_decode_preview(unsigned char** out, unsigned* w, unsigned* h, unsigned scale,
+                                LodePNGState* state, const unsigned char* in, size_t insize) {
+  LodePNGStreamDecoder* decoder;
+  DecodeIntoTarget target;
+  size_t rowsize;
+  unsigned error;
+
+  *out = 0;
+  state->error = lodepng_inspect(w, h, state, in, insize);
+  if(state->error) return state->error;
+  if(scale != 1 && scale != 2 && scale != 4 && scale != 8) CERROR_RETURN_ERROR(state->error, 118);
+  if(lodepng_pixel_overflow(*w, *h, &state->info_png.color, &state->info_raw)) {
+    CERROR_RETURN_ERROR(state->error, 92); /*overflow possible due to amount of pixels*/
+  }
+  *w = (*w + scale - 1u) / scale;
+  *h = (*h + scale - 1u) / scale;
+  rowsize = lodepng_get_raw_size(*w, 1, state->decoder.color_convert ? &state->info_raw : &state->info_png.color);
+  *out = (unsigned char*)lodepng_malloc(rowsize * *h);
+  if(!*out) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
+
+  target.out = *out;
+  target.pitch = rowsize;
+  error = lodepng_stream_decoder_create(&decoder, state, decodeIntoRow, &target);
+  if(!error) error = lodepng_stream_decoder_set_scale(decoder, scale);
+  if(!error) error = lodepng_stream_decoder_push(decoder, in, insize);
+  if(!error) error = lodepng_stream_decoder_finish(decoder);
+  lodepng_stream_decoder_destroy(decoder);
+  if(error) {
+    lodepng_free(*out);
+    *out = 0;
+  }
+  state->error = error;
+  return error;
+}
+
+unsigned lodepng_decode_memory_into(unsigned char* out, size_t outsize, size_t pitch, unsigned* w, unsigned* h,
+                                    const unsigned char* in, size_t insize,
+                                    LodePNGColorType colortype, unsigned bitdepth) {
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  /*disable reading things that this function doesn't output*/
+  state.decoder.read_text_chunks = 0;
+  state.decoder.remember_unknown_chunks = 0;
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  error = lodepng_decode_into(out, outsize, pitch, w, h, &state, in, insize);
+  lodepng_state_cleanup(&state);
+  return error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth) {
   unsigned error;
@@ -5845,9 +7636,119 @@ static unsigned addChunk_sBIT(ucvector* out, const LodePNGInfo* info) {
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+#ifdef LODEPNG_X86_SIMD
+/*
+SIMD versions of filterScanline and of the scores of the adaptive filter strategies. Unlike unfiltering, filtering
+only reads the unfiltered scanlines, so Sub, Average and Paeth work on 16 bytes at once too. The results are the
+same bytes as the portable code gives.
+*/
+/*paethPredictor in 16-bit lanes, with the same tie breaking*/
+LODEPNG_TARGET("sse2")
+static __m128i paethPredictorSSE2(__m128i a, __m128i b, __m128i c) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc, pred, smaller;
+  pc = _mm_add_epi16(pa, pb);
+  pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+  pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+  pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+  smaller = _mm_cmplt_epi16(pb, pa);
+  pred = _mm_or_si128(_mm_andnot_si128(smaller, a), _mm_and_si128(smaller, b));
+  smaller = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+  return _mm_or_si128(_mm_andnot_si128(smaller, pred), _mm_and_si128(smaller, c));
+}
+
+/*filters from byte bytewidth on, with a previous scanline; returns where the portable code must continue*/
+LODEPNG_TARGET("sse2")
+static size_t filterScanlineSSE2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                 size_t length, size_t bytewidth, unsigned char filterType) {
+  size_t i = bytewidth;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+    __m128i pred;
+    if(filterType == 1) {
+      pred = a;
+    } else if(filterType == 2) {
+      pred = b;
+    } else if(filterType == 3) {
+      /*(a + b) >> 1 from the rounding-up pavgb by subtracting the carry bit*/
+      pred = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    } else {
+      __m128i c = _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]);
+      __m128i lo = paethPredictorSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                      _mm_unpacklo_epi8(c, zero));
+      __m128i hi = paethPredictorSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                      _mm_unpackhi_epi8(c, zero));
+      pred = _mm_packus_epi16(lo, hi);
+    }
+    _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(x, pred));
+  }
+  return i;
+}
+
+/*the low 64-bit lane as size_t, _mm_cvtsi128_si64 is not available on 32-bit x86*/
+LODEPNG_TARGET("sse2")
+static size_t sumLanesSSE2(__m128i sum) {
+  size_t lo = (unsigned)_mm_cvtsi128_si32(sum);
+  size_t hi = (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(sum, 4));
+  return lo + hi * 65536u * 65536u;
+}
+
+/*the minimum sum score: sum of min(s, 255 - s) (the absolute value as signed byte), or of s for filter type 0*/
+LODEPNG_TARGET("sse2")
+static size_t filterSumSSE2(const unsigned char* data, size_t length, unsigned char type, size_t* done) {
+  size_t i = 0;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(-1);
+  __m128i sum = zero;
+  for(; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)&data[i]);
+    if(type != 0) s = _mm_min_epu8(s, _mm_xor_si128(s, ones));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(s, zero));
+  }
+  *done = i;
+  return sumLanesSSE2(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum)));
+}
+
+LODEPNG_TARGET("avx2")
+static size_t filterSumAVX2(const unsigned char* data, size_t length, unsigned char type, size_t* done) {
+  size_t i = 0;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi8(-1);
+  __m256i sum = zero;
+  __m128i sum128;
+  for(; i + 32 <= length; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)&data[i]);
+    if(type != 0) s = _mm256_min_epu8(s, _mm256_xor_si256(s, ones));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(s, zero));
+  }
+  *done = i;
+  sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  return sumLanesSSE2(_mm_add_epi64(sum128, _mm_unpackhi_epi64(sum128, sum128)));
+}
+#endif /*LODEPNG_X86_SIMD*/
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType) {
   size_t i;
+#ifdef LODEPNG_X86_SIMD
+  if(prevline && filterType >= 1 && filterType <= 4 && (lodepng_cpu_features() & LODEPNG_CPU_SSE2)) {
+    size_t start = length < bytewidth ? length : bytewidth;
+    size_t end = filterScanlineSSE2(out, scanline, prevline, length, bytewidth, filterType);
+    /*the first pixel has no left neighbour, a and c are 0 there*/
+    for(i = 0; i != start; ++i) out[i] = scanline[i] - (filterType == 1 ? 0 : filterType == 3 ? prevline[i] >> 1 :
+                                                       prevline[i]);
+    for(i = end; i < length; ++i) {
+      unsigned char a = scanline[i - bytewidth], b = prevline[i], c = prevline[i - bytewidth];
+      out[i] = scanline[i] - (filterType == 1 ? a : filterType == 2 ? b : filterType == 3 ? ((a + b) >> 1) :
+                              paethPredictor(a, b, c));
+    }
+    return;
+  }
+#endif /*LODEPNG_X86_SIMD*/
   switch(filterType) {
     case 0: /*None*/
       for(i = 0; i != length; ++i) out[i] = scanline[i];
@@ -5910,56 +7811,67 @@ static size_t ilog2i(size_t i) {
   return i * l + ((i - (((size_t)1) << l)) << 1u);
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
-  /*
-  For PNG filter method 0
-  out must be a buffer with as size: h + (w * h * bpp + 7u) / 8u, because there are
-  the scanlines with 1 extra byte per scanline
-  */
-
-  unsigned bpp = lodepng_get_bpp(color);
-  /*the width of a scanline in bytes, not including the filter type*/
-  size_t linebytes = lodepng_get_raw_size_idat(w, 1, bpp) - 1u;
+/*the score of LFS_MINSUM, lower is better. Filter type 0 isn't a difference, so its bytes are summed unsigned,
+the others as the absolute value of the signed byte*/
+static size_t filterSum(const unsigned char* data, size_t length, unsigned char type) {
+  size_t i = 0, sum = 0;
+#ifdef LODEPNG_X86_SIMD
+  unsigned features = lodepng_cpu_features();
+  if(features & LODEPNG_CPU_AVX2) sum = filterSumAVX2(data, length, type, &i);
+  else if(features & LODEPNG_CPU_SSE2) sum = filterSumSSE2(data, length, type, &i);
+#endif /*LODEPNG_X86_SIMD*/
+  if(type == 0) {
+    for(; i != length; ++i) sum += data[i];
+  } else {
+    /*For differences, each byte should be treated as signed, values above 127 are negative
+    (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
+    This means filtertype 0 is almost never chosen, but that is justified.*/
+    for(; i != length; ++i) sum += data[i] < 128 ? data[i] : (255U - data[i]);
+  }
+  return sum;
+}
+
+/*the score of LFS_ENTROPY, higher is better. The histogram is counted in 4 interleaved tables, so that runs of
+one value (common after filtering) don't stall on incrementing the same counter over and over*/
+static size_t filterEntropy(const unsigned char* data, size_t length, unsigned char type) {
+  unsigned count[4][256];
+  size_t i = 0, sum = 0;
+  lodepng_memset(count, 0, sizeof(count));
+  for(; i + 4 <= length; i += 4) {
+    ++count[0][data[i + 0]];
+    ++count[1][data[i + 1]];
+    ++count[2][data[i + 2]];
+    ++count[3][data[i + 3]];
+  }
+  for(; i != length; ++i) ++count[0][data[i]];
+  ++count[0][type]; /*the filter type itself is part of the scanline*/
+  for(i = 0; i != 256; ++i) {
+    sum += ilog2i(count[0][i] + count[1][i] + count[2][i] + count[3][i]);
+  }
+  return sum;
+}
 
-  /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
-  size_t bytewidth = (bpp + 7u) / 8u;
-  const unsigned char* prevline = 0;
-  unsigned x, y;
+/*filters the rows y0 to y1 (excluding) of filter below, with the strategy for all of them*/
+static unsigned filterRows(unsigned char* out, const unsigned char* in, size_t linebytes, size_t bytewidth,
+                           unsigned y0, unsigned y1, LodePNGFilterStrategy strategy,
+                           const LodePNGEncoderSettings* settings) {
+  const unsigned char* prevline = y0 ? &in[(y0 - 1u) * linebytes] : 0;
+  unsigned y;
   unsigned error = 0;
-  LodePNGFilterStrategy strategy = settings->filter_strategy;
-
-  /*
-  There is a heuristic called the minimum sum of absolute differences heuristic, suggested by the PNG standard:
-   *  If the image type is Palette, or the bit depth is smaller than 8, then do not filter the image (i.e.
-      use fixed filtering, with the filter None).
-   * (The other case) If the image type is Grayscale or RGB (with or without Alpha), and the bit depth is
-     not smaller than 8, then use adaptive filtering heuristic as follows: independently for each row, apply
-     all five filters and select the filter that produces the smallest sum of absolute values per row.
-  This heuristic is used if filter strategy is LFS_MINSUM and filter_palette_zero is true.
-
-  If filter_palette_zero is true and filter_strategy is not LFS_MINSUM, the above heuristic is followed,
-  but for "the other case", whatever strategy filter_strategy is set to instead of the minimum sum
-  heuristic is used.
-  */
-  if(settings->filter_palette_zero &&
-     (color->colortype == LCT_PALETTE || color->bitdepth < 8)) strategy = LFS_ZERO;
-
-  if(bpp == 0) return 31; /*error: invalid color type*/
 
   if(strategy >= LFS_ZERO && strategy <= LFS_FOUR) {
     unsigned char type = (unsigned char)strategy;
-    for(y = 0; y != h; ++y) {
+    for(y = y0; y != y1; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       out[outindex] = type; /*filter type byte*/
       filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, type);
       prevline = &in[inindex];
     }
-  } else if(strategy == LFS_MINSUM) {
+  } else if(strategy == LFS_MINSUM || strategy == LFS_ENTROPY) {
     /*adaptive filtering*/
     unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
+    size_t bestScore = 0;
     unsigned char type, bestType = 0;
 
     for(type = 0; type != 5; ++type) {
@@ -5968,82 +7880,37 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     if(!error) {
-      for(y = 0; y != h; ++y) {
+      for(y = y0; y != y1; ++y) {
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
-          size_t sum = 0;
           filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          if(type == 0) {
-            for(x = 0; x != linebytes; ++x) sum += (unsigned char)(attempt[type][x]);
+          if(strategy == LFS_MINSUM) {
+            size_t sum = filterSum(attempt[type], linebytes, type);
+            /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
+            if(type == 0 || sum < bestScore) {
+              bestType = type;
+              bestScore = sum;
+            }
           } else {
-            for(x = 0; x != linebytes; ++x) {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type][x];
-              sum += s < 128 ? s : (255U - s);
+            size_t sum = filterEntropy(attempt[type], linebytes, type);
+            if(type == 0 || sum > bestScore) {
+              bestType = type;
+              bestScore = sum;
             }
           }
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum < smallest) {
-            bestType = type;
-            smallest = sum;
-          }
-        }
-
-        prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
-      }
-    }
-
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
-  } else if(strategy == LFS_ENTROPY) {
-    unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t bestSum = 0;
-    unsigned type, bestType = 0;
-    unsigned count[256];
-
-    for(type = 0; type != 5; ++type) {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) error = 83; /*alloc fail*/
-    }
-
-    if(!error) {
-      for(y = 0; y != h; ++y) {
-        /*try the 5 filter types*/
-        for(type = 0; type != 5; ++type) {
-          size_t sum = 0;
-          filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
-          lodepng_memset(count, 0, 256 * sizeof(*count));
-          for(x = 0; x != linebytes; ++x) ++count[attempt[type][x]];
-          ++count[type]; /*the filter type itself is part of the scanline*/
-          for(x = 0; x != 256; ++x) {
-            sum += ilog2i(count[x]);
-          }
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum > bestSum) {
-            bestType = type;
-            bestSum = sum;
-          }
         }
 
         prevline = &in[y * linebytes];
 
         /*now fill the out values*/
         out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
+        lodepng_memcpy(&out[y * (linebytes + 1) + 1], attempt[bestType], linebytes);
       }
     }
 
     for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   } else if(strategy == LFS_PREDEFINED) {
-    for(y = 0; y != h; ++y) {
+    for(y = y0; y != y1; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       unsigned char type = settings->predefined_filters[y];
@@ -6071,12 +7938,14 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     images only, so disable it*/
     zlibsettings.custom_zlib = 0;
     zlibsettings.custom_deflate = 0;
+    /*the rows are already spread over the threads*/
+    zlibsettings.threads = 1;
     for(type = 0; type != 5; ++type) {
       attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
       if(!attempt[type]) error = 83; /*alloc fail*/
     }
     if(!error) {
-      for(y = 0; y != h; ++y) /*try the 5 filter types*/ {
+      for(y = y0; y != y1; ++y) /*try the 5 filter types*/ {
         for(type = 0; type != 5; ++type) {
           unsigned testsize = (unsigned)linebytes;
           /*if(testsize > 8) testsize /= 8;*/ /*it already works good enough by testing a part of the row*/
@@ -6094,7 +7963,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
         }
         prevline = &in[y * linebytes];
         out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
+        lodepng_memcpy(&out[y * (linebytes + 1) + 1], attempt[bestType], linebytes);
       }
     }
     for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
@@ -6104,6 +7973,99 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   return error;
 }
 
+#ifdef LODEPNG_THREADS
+/*
+The choice of filter of a row only depends on the unfiltered row and the one above it, so bands of rows can be
+filtered on separate threads with the same result.
+*/
+typedef struct FilterBands {
+  unsigned char* out;
+  const unsigned char* in;
+  size_t linebytes, bytewidth;
+  unsigned h, bandrows;
+  LodePNGFilterStrategy strategy;
+  const LodePNGEncoderSettings* settings;
+  unsigned* errors;
+} FilterBands;
+
+static void filterBandJob(void* context, size_t i) {
+  FilterBands* bands = (FilterBands*)context;
+  unsigned y0 = (unsigned)i * bands->bandrows;
+  unsigned y1 = bands->h - y0 > bands->bandrows ? y0 + bands->bandrows : bands->h;
+  bands->errors[i] = filterRows(bands->out, bands->in, bands->linebytes, bands->bytewidth, y0, y1,
+                                bands->strategy, bands->settings);
+}
+#endif /*LODEPNG_THREADS*/
+
+static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+  /*
+  For PNG filter method 0
+  out must be a buffer with as size: h + (w * h * bpp + 7u) / 8u, because there are
+  the scanlines with 1 extra byte per scanline
+  */
+
+  unsigned bpp = lodepng_get_bpp(color);
+  /*the width of a scanline in bytes, not including the filter type*/
+  size_t linebytes = lodepng_get_raw_size_idat(w, 1, bpp) - 1u;
+
+  /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
+  size_t bytewidth = (bpp + 7u) / 8u;
+  LodePNGFilterStrategy strategy = settings->filter_strategy;
+
+  /*
+  There is a heuristic called the minimum sum of absolute differences heuristic, suggested by the PNG standard:
+   *  If the image type is Palette, or the bit depth is smaller than 8, then do not filter the image (i.e.
+      use fixed filtering, with the filter None).
+   * (The other case) If the image type is Grayscale or RGB (with or without Alpha), and the bit depth is
+     not smaller than 8, then use adaptive filtering heuristic as follows: independently for each row, apply
+     all five filters and select the filter that produces the smallest sum of absolute values per row.
+  This heuristic is used if filter strategy is LFS_MINSUM and filter_palette_zero is true.
+
+  If filter_palette_zero is true and filter_strategy is not LFS_MINSUM, the above heuristic is followed,
+  but for "the other case", whatever strategy filter_strategy is set to instead of the minimum sum
+  heuristic is used.
+  */
+  if(settings->filter_palette_zero &&
+     (color->colortype == LCT_PALETTE || color->bitdepth < 8)) strategy = LFS_ZERO;
+
+  if(bpp == 0) return 31; /*error: invalid color type*/
+
+#ifdef LODEPNG_THREADS
+  /*only the adaptive strategies do enough work per byte to be worth the threads*/
+  if(settings->zlibsettings.threads != 1 &&
+     (strategy == LFS_MINSUM || strategy == LFS_ENTROPY || strategy == LFS_BRUTE_FORCE)) {
+    unsigned threads = settings->zlibsettings.threads;
+    FilterBands bands;
+    size_t i, numbands;
+    unsigned error = 0;
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    bands.out = out;
+    bands.in = in;
+    bands.linebytes = linebytes;
+    bands.bytewidth = bytewidth;
+    bands.h = h;
+    /*bands of about 64 KiB of input, enough to spread over the threads and small enough to balance them*/
+    bands.bandrows = linebytes >= 65536u ? 1u : (unsigned)(65536u / (linebytes + 1u));
+    bands.strategy = strategy;
+    bands.settings = settings;
+    numbands = (h + bands.bandrows - 1u) / bands.bandrows;
+    if(threads > 1 && numbands > 1) {
+      bands.errors = (unsigned*)lodepng_malloc(numbands * sizeof(unsigned));
+      if(!bands.errors) return 83; /*alloc fail*/
+      lodepng_parallel_for(numbands, threads, filterBandJob, &bands);
+      for(i = 0; i != numbands; ++i) {
+        if(!error) error = bands.errors[i];
+      }
+      lodepng_free(bands.errors);
+      return error;
+    }
+  }
+#endif /*LODEPNG_THREADS*/
+
+  return filterRows(out, in, linebytes, bytewidth, 0, h, strategy, settings);
+}
+
 static void addPaddingBits(unsigned char* out, const unsigned char* in,
                            size_t olinebits, size_t ilinebits, unsigned h) {
   /*The opposite of the removePaddingBits function
@@ -6803,6 +8765,9 @@ const char* lodepng_error_text(unsigned code) {
     case 113: return "ICC profile unreasonably large";
     case 114: return "sBIT chunk has wrong size for the color type of the image";
     case 115: return "sBIT value out of range";
+    case 116: return "the row callback of the streaming decoder aborted decoding";
+    case 117: return "the output buffer or pitch given to lodepng_decode_into is too small for the image";
+    case 118: return "the preview scale must be 1, 2, 4 or 8 and be set before the image data";
   }
   return "unknown error code";
 }
@@ -0,0 +1,314 @@
+/*
+Throughput of lodepng's SIMD code paths against the portable ones, of inflate, of each deflate level, and of the
+parallel deflate for 1 to N threads. lodepng.cpp is included directly to reach its static functions, build this
+file on its own: make bench, or ./lodepng_bench image.png to compress that image instead of a generated one.
+*/
+
+#include "lodepng.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#if defined(LODEPNG_COMPILE_ENCODER) && defined(LODEPNG_COMPILE_ZLIB)
+#define BENCH_DEFLATE
+#endif
+
+#if defined(BENCH_DEFLATE) && defined(LODEPNG_COMPILE_DECODER)
+#define BENCH_INFLATE
+#endif
+
+#if defined(LODEPNG_X86_SIMD) || defined(BENCH_DEFLATE)
+static unsigned random_state = 0x12345678u;
+
+static unsigned randomNumber() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+static double now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*MB/s of the best of 5 runs of work, which processes bytes bytes*/
+template<typename F>
+static double throughput(size_t bytes, F work) {
+  double best = 1e30;
+  for(unsigned run = 0; run != 5; ++run) {
+    double start = now();
+    work();
+    double time = now() - start;
+    if(time < best) best = time;
+  }
+  return bytes / best / 1e6;
+}
+#endif /*defined(LODEPNG_X86_SIMD) || defined(BENCH_DEFLATE)*/
+
+#ifdef LODEPNG_X86_SIMD
+static void randomBytes(std::vector<unsigned char>& v, size_t size) {
+  v.resize(size);
+  for(size_t i = 0; i != size; ++i) v[i] = (unsigned char)randomNumber();
+}
+
+/*unfilterScanline per filter type on 8192-pixel rows, 32 MB per run*/
+static void benchUnfilter(unsigned features) {
+  const size_t pixels = 8192, rows = 1024;
+  static const char* names[5] = {"None", "Sub", "Up", "Average", "Paeth"};
+  std::vector<unsigned char> data, out;
+  printf("unfilter, MB/s        portable      SIMD   speedup\n");
+  for(size_t bytewidth = 3; bytewidth <= 4; ++bytewidth) {
+    size_t length = pixels * bytewidth;
+    randomBytes(data, length * rows);
+    out.resize(length * rows);
+    for(unsigned char type = 0; type <= 4; ++type) {
+      double speed[2];
+      for(unsigned simd = 0; simd != 2; ++simd) {
+        lodepng_cpu_feature_mask = simd ? features : 0;
+        speed[simd] = throughput(length * rows, [&]() {
+          for(size_t y = 0; y != rows; ++y) {
+            unfilterScanline(&out[y * length], &data[y * length], y ? &out[(y - 1) * length] : 0,
+                             bytewidth, type, length);
+          }
+        });
+      }
+      printf("  %-7s bytewidth %u %9.0f %9.0f %8.2fx\n", names[type], (unsigned)bytewidth,
+             speed[0], speed[1], speed[1] / speed[0]);
+    }
+  }
+  lodepng_cpu_feature_mask = features;
+}
+
+/*CRC32 and Adler-32 over a 16 MB buffer*/
+static void benchChecksums(unsigned features) {
+  std::vector<unsigned char> data;
+  randomBytes(data, (size_t)1 << 24);
+  volatile unsigned sink = 0;
+  printf("checksums, MB/s       portable      SIMD   speedup\n");
+#ifdef LODEPNG_COMPILE_CRC
+  double crc[2];
+  for(unsigned simd = 0; simd != 2; ++simd) {
+    lodepng_cpu_feature_mask = simd ? features : 0;
+    crc[simd] = throughput(data.size(), [&]() { sink = sink + lodepng_crc32(data.data(), data.size()); });
+  }
+  printf("  CRC32 (16 MB)      %9.0f %9.0f %8.2fx\n", crc[0], crc[1], crc[1] / crc[0]);
+#endif /*LODEPNG_COMPILE_CRC*/
+#ifdef LODEPNG_COMPILE_ZLIB
+  double adler[2];
+  for(unsigned simd = 0; simd != 2; ++simd) {
+    lodepng_cpu_feature_mask = simd ? features : 0;
+    adler[simd] = throughput(data.size(), [&]() { sink = sink + adler32(data.data(), (unsigned)data.size()); });
+  }
+  printf("  Adler-32 (16 MB)   %9.0f %9.0f %8.2fx\n", adler[0], adler[1], adler[1] / adler[0]);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  lodepng_cpu_feature_mask = features;
+}
+
+/*the conversion kernels against the generic code that lodepng_convert uses without them, 4 Mpixel per run*/
+static void benchConvert(unsigned features) {
+  struct Pair {
+    LodePNGColorType in, out;
+    unsigned bitdepth;
+    const char* name;
+  };
+  static const Pair pairs[] = {
+    {LCT_RGB, LCT_RGBA, 8, "RGB8 -> RGBA8"}, {LCT_RGBA, LCT_RGB, 8, "RGBA8 -> RGB8"},
+    {LCT_GREY, LCT_RGBA, 8, "Grey8 -> RGBA8"}, {LCT_GREY_ALPHA, LCT_RGBA, 8, "GA8 -> RGBA8"},
+    {LCT_RGBA, LCT_RGBA, 16, "RGBA16 -> RGBA8"}, {LCT_RGB, LCT_RGB, 16, "RGB16 -> RGB8"},
+    {LCT_PALETTE, LCT_RGBA, 8, "PAL8 -> RGBA8"}, {LCT_PALETTE, LCT_RGBA, 4, "PAL4 -> RGBA8"},
+    {LCT_PALETTE, LCT_RGBA, 1, "PAL1 -> RGBA8"}
+  };
+  const size_t numpixels = (size_t)1 << 22;
+  std::vector<unsigned char> in, out;
+  printf("convert, Mpixel/s      generic    kernel   speedup\n");
+  for(size_t p = 0; p != sizeof(pairs) / sizeof(pairs[0]); ++p) {
+    LodePNGColorMode mode_in = lodepng_color_mode_make(pairs[p].in, pairs[p].bitdepth);
+    LodePNGColorMode mode_out = lodepng_color_mode_make(pairs[p].out, 8);
+    if(pairs[p].in == LCT_PALETTE) {
+      for(unsigned i = 0; i != (1u << pairs[p].bitdepth); ++i) {
+        lodepng_palette_add(&mode_in, (unsigned char)i, (unsigned char)(i * 3), (unsigned char)(i * 7), 255);
+      }
+    }
+    randomBytes(in, lodepng_get_raw_size((unsigned)numpixels, 1, &mode_in));
+    out.resize(lodepng_get_raw_size((unsigned)numpixels, 1, &mode_out));
+    lodepng_cpu_feature_mask = features;
+    ConvertKernel kernel = getConvertKernel(&mode_out, &mode_in);
+    double generic = throughput(numpixels, [&]() {
+      if(pairs[p].out == LCT_RGBA) getPixelColorsRGBA8(out.data(), numpixels, in.data(), &mode_in);
+      else getPixelColorsRGB8(out.data(), numpixels, in.data(), &mode_in);
+    });
+    if(kernel) {
+      double fast = throughput(numpixels, [&]() { kernel(out.data(), in.data(), numpixels, &mode_in); });
+      printf("  %-16s %11.0f %9.0f %8.2fx\n", pairs[p].name, generic, fast, fast / generic);
+    } else {
+      printf("  %-16s %11.0f   no kernel for these features\n", pairs[p].name, generic);
+    }
+    lodepng_color_mode_cleanup(&mode_in);
+    lodepng_color_mode_cleanup(&mode_out);
+  }
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+#ifdef BENCH_DEFLATE
+/*a 2048x2048 RGBA image that compresses about like a photo: smooth gradients with a little noise*/
+static void generateImage(std::vector<unsigned char>& image, unsigned& w, unsigned& h) {
+  w = h = 2048;
+  image.resize((size_t)w * h * 4);
+  for(unsigned y = 0; y != h; ++y)
+  for(unsigned x = 0; x != w; ++x) {
+    unsigned char* p = &image[((size_t)y * w + x) * 4];
+    p[0] = (unsigned char)((x >> 3) + (randomNumber() & 3));
+    p[1] = (unsigned char)((y >> 3) + (randomNumber() & 3));
+    p[2] = (unsigned char)(((x + y) >> 4) + (randomNumber() & 7));
+    p[3] = 255;
+  }
+}
+
+/*deflate alone and the whole PNG encoder for 1 to N threads: time, speedup and the size cost of the chunks*/
+static void benchDeflateThreads(const std::vector<unsigned char>& image, unsigned w, unsigned h) {
+  unsigned maxthreads = std::thread::hardware_concurrency();
+  if(maxthreads < 2) maxthreads = 2; /*to show the size cost even without the cores for a speedup*/
+  double deflate1 = 0, encode1 = 0;
+  size_t size1 = 0;
+  printf("parallel deflate, %ux%u RGBA, %u hardware threads\n", w, h, std::thread::hardware_concurrency());
+  printf("threads  deflate ms  speedup  encode ms  speedup        bytes  size cost\n");
+  for(unsigned threads = 1; threads <= maxthreads; ++threads) {
+    double deflate = 1e30, encode = 1e30;
+    size_t size = 0;
+    for(unsigned run = 0; run != 3; ++run) {
+      LodePNGCompressSettings settings;
+      lodepng_compress_settings_init(&settings);
+      settings.threads = threads;
+      unsigned char* out = 0;
+      size_t outsize = 0;
+      double start = now();
+      lodepng_zlib_compress(&out, &outsize, image.data(), image.size(), &settings);
+      double time = now() - start;
+      if(time < deflate) deflate = time;
+      lodepng_free(out);
+
+      LodePNGState state;
+      lodepng_state_init(&state);
+      state.encoder.zlibsettings.threads = threads;
+      out = 0;
+      start = now();
+      lodepng_encode(&out, &size, image.data(), w, h, &state);
+      time = now() - start;
+      if(time < encode) encode = time;
+      lodepng_free(out);
+      lodepng_state_cleanup(&state);
+    }
+    if(threads == 1) {
+      deflate1 = deflate;
+      encode1 = encode;
+      size1 = size;
+    }
+    printf("%7u %11.1f %7.2fx %10.1f %7.2fx %12u %+9.3f%%\n", threads, 1000 * deflate, deflate1 / deflate,
+           1000 * encode, encode1 / encode, (unsigned)size, 100.0 * ((double)size / size1 - 1.0));
+  }
+}
+#endif /*BENCH_DEFLATE*/
+
+#ifdef BENCH_INFLATE
+/*the filtered scanlines the PNG encoder deflates for this image: its IDAT data inflated again*/
+static std::vector<unsigned char> filteredScanlines(const std::vector<unsigned char>& image, unsigned w, unsigned h) {
+  unsigned char* png = 0;
+  size_t pngsize = 0;
+  std::vector<unsigned char> idat, result;
+  lodepng_encode32(&png, &pngsize, image.data(), w, h);
+  const unsigned char* end = png + pngsize;
+  for(const unsigned char* chunk = png + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end)) {
+    const unsigned char* data = lodepng_chunk_data_const(chunk);
+    if(lodepng_chunk_type_equals(chunk, "IDAT")) idat.insert(idat.end(), data, data + lodepng_chunk_length(chunk));
+  }
+  lodepng_free(png);
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  lodepng_zlib_decompress(&out, &outsize, idat.data(), idat.size(), &lodepng_default_decompress_settings);
+  result.assign(out, out + outsize);
+  lodepng_free(out);
+  return result;
+}
+
+/*lodepng_zlib_decompress of the scanlines deflated with fixed and with dynamic trees, MB/s of output*/
+static void benchInflate(const std::vector<unsigned char>& scanlines) {
+  printf("inflate, %u bytes of filtered scanlines\n", (unsigned)scanlines.size());
+  printf("  block type      compressed      MB/s\n");
+  for(unsigned btype = 1; btype <= 2; ++btype) {
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.btype = btype;
+    unsigned char* deflated = 0;
+    size_t deflatedsize = 0;
+    lodepng_zlib_compress(&deflated, &deflatedsize, scanlines.data(), scanlines.size(), &settings);
+    double speed = throughput(scanlines.size(), [&]() {
+      unsigned char* out = 0;
+      size_t outsize = 0;
+      lodepng_zlib_decompress(&out, &outsize, deflated, deflatedsize, &lodepng_default_decompress_settings);
+      lodepng_free(out);
+    });
+    printf("  %-14s %11u %9.0f\n", btype == 1 ? "fixed" : "dynamic", (unsigned)deflatedsize, speed);
+    lodepng_free(deflated);
+  }
+}
+
+/*each match finder on the scanlines with dynamic trees: MB/s of input, and the size against the default level*/
+static void benchLevels(const std::vector<unsigned char>& scanlines) {
+  static const LodePNGCompressLevel levels[4] = {LCL_DEFAULT, LCL_FAST, LCL_RLE, LCL_HUFFMAN_ONLY};
+  static const char* names[4] = {"LCL_DEFAULT", "LCL_FAST", "LCL_RLE", "LCL_HUFFMAN_ONLY"};
+  size_t size0 = 0;
+  printf("deflate levels, %u bytes of filtered scanlines\n", (unsigned)scanlines.size());
+  printf("  level                  MB/s        bytes    ratio  vs default\n");
+  for(unsigned l = 0; l != 4; ++l) {
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.level = levels[l];
+    size_t size = 0;
+    double speed = throughput(scanlines.size(), [&]() {
+      unsigned char* out = 0;
+      lodepng_zlib_compress(&out, &size, scanlines.data(), scanlines.size(), &settings);
+      lodepng_free(out);
+    });
+    if(l == 0) size0 = size;
+    printf("  %-16s %10.1f %12u %7.2f%% %+10.2f%%\n", names[l], speed, (unsigned)size,
+           100.0 * size / scanlines.size(), 100.0 * ((double)size / size0 - 1.0));
+  }
+}
+#endif /*BENCH_INFLATE*/
+
+int main(int argc, char* argv[]) {
+#ifdef LODEPNG_X86_SIMD
+  unsigned features = lodepng_detect_cpu_features();
+  printf("features %x\n", features);
+  benchUnfilter(features);
+  benchChecksums(features);
+  benchConvert(features);
+#else
+  printf("no SIMD code in this build, nothing to compare\n");
+#endif /*LODEPNG_X86_SIMD*/
+#ifdef BENCH_DEFLATE
+  std::vector<unsigned char> image;
+  unsigned w = 0, h = 0;
+  if(argc > 1) {
+    unsigned error = lodepng::decode(image, w, h, argv[1]);
+    if(error) {
+      printf("%s: %s\n", argv[1], lodepng_error_text(error));
+      return 1;
+    }
+  } else {
+    generateImage(image, w, h);
+  }
+#ifdef BENCH_INFLATE
+  std::vector<unsigned char> scanlines = filteredScanlines(image, w, h);
+  benchInflate(scanlines);
+  benchLevels(scanlines);
+#endif /*BENCH_INFLATE*/
+  benchDeflateThreads(image, w, h);
+#else
+  (void)argc;
+  (void)argv;
+#endif /*BENCH_DEFLATE*/
+  return 0;
+}
@@ -333,11 +333,11 @@ public:
         if (controlPoints.size() < 2) return;
         
         // Görbe kirajzolása sárga színnel
-        glLineWidth(3.0f);
+        glCommands().LineWidth(3.0f);
         splineGeometry->Draw(gpuProgram, GL_LINE_STRIP, vec3(1.0f, 1.0f, 0.0f));
         
         // Kontrollpontok kirajzolása piros négyzetként
-        glPointSize(10.0f);
+        glCommands().PointSize(10.0f);
         pointGeometry->Draw(gpuProgram, GL_POINTS, vec3(1.0f, 0.0f, 0.0f));
     }
 };
@@ -354,6 +354,8 @@ private:
     vec2 position;               
     float angle;                 
     float velocity;              
+    vec2 prevPosition;           // előző szimulációs lépés, interpolációhoz
+    float prevAngle;
     
     void createWheel(float radius) {
         wheel = new Geometry<vec2>();
@@ -427,8 +429,8 @@ public:
         state = WAITING;
         splineParam = 0.0f;  
         wheelRadius = 1.0f;   
-        position = vec2(0, 0);
-        angle = 0.0f;
+        position = prevPosition = vec2(0, 0);
+        angle = prevAngle = 0.0f;
         velocity = 0.0f;
         
         // Kerék és küllők létrehozása
@@ -453,12 +455,16 @@ public:
         position = pathPosition + normal * wheelRadius; // Ez marad az eredeti
         angle = 0.0f;
         velocity = 0.0f;
+        prevPosition = position;
+        prevAngle = angle;
     }
 }
 
 
     
     void Animate(float dt) {
+    prevPosition = position;
+    prevAngle = angle;
     if (state != ROLLING || track->getNumControlPoints() < 2) return;
 
     // Pálya érintő és normál vektorai
@@ -502,21 +508,24 @@ public:
     angle += angularVelocity * dt;
 }
     
-    // Kerék kirajzolása
-    void Draw(GPUProgram* gpuProgram, const mat4& viewMatrix) {
+    // Kerék kirajzolása, alpha: hol tartunk két szimulációs lépés között
+    void Draw(GPUProgram* gpuProgram, const mat4& viewMatrix, float alpha) {
         if (state == WAITING || track->getNumControlPoints() < 2) return;
         
+        vec2 drawPosition = prevPosition + (position - prevPosition) * alpha;
+        float drawAngle = prevAngle + (angle - prevAngle) * alpha;
+        
         // Modell transzformáció beállítása
         mat4 modelMatrix = mat4(1.0f);
-        modelMatrix[3][0] = position.x;
-        modelMatrix[3][1] = position.y;
+        modelMatrix[3][0] = drawPosition.x;
+        modelMatrix[3][1] = drawPosition.y;
         
         // Forgatás külön
         mat4 rotMatrix = mat4(1.0f);
-        rotMatrix[0][0] = cos(angle);
-        rotMatrix[0][1] = sin(angle);
-        rotMatrix[1][0] = -sin(angle);
-        rotMatrix[1][1] = cos(angle);
+        rotMatrix[0][0] = cos(drawAngle);
+        rotMatrix[0][1] = sin(drawAngle);
+        rotMatrix[1][0] = -sin(drawAngle);
+        rotMatrix[1][1] = cos(drawAngle);
         
         modelMatrix = modelMatrix * rotMatrix;
         
@@ -525,11 +534,11 @@ public:
         gpuProgram->setUniform(mvpMatrix, "MVP");
         
         // Kerék kirajzolása
-        glPointSize(1.0f);
+        glCommands().PointSize(1.0f);
         wheel->Draw(gpuProgram, GL_TRIANGLE_FAN, vec3(0, 0, 1));
         
         // Körvonal kirajzolása
-        glLineWidth(2.0f);
+        glCommands().LineWidth(2.0f);
         wheel->Draw(gpuProgram, GL_LINE_LOOP, vec3(1, 1, 1)); 
         
         // Küllők kirajzolása
@@ -548,7 +557,9 @@ class RollerCoasterApp : public glApp {
     Camera *camera;        
     Gondola *gondola;       
 public:
-    RollerCoasterApp() : glApp("Lab02") {}
+    RollerCoasterApp() : glApp("Lab02") {
+        enableRenderThread(); // minden rajzolás glCommands()-on át megy
+    }
 
    void onInitialization() {
     camera = new Camera(vec2(0.0f, 0.0f), worldWidth, worldHeight);
@@ -558,13 +569,16 @@ public:
     gondola = new Gondola(track);
     
     gpuProgram = new GPUProgram(vertSource, fragSource);
+    
+    // 10 ms-os fizikai lépés
+    setSimulationRate(100);
     }
 
     // Ablak újrarajzolás
     void onDisplay() {
-        glClearColor(0, 0, 0, 0);     
-        glClear(GL_COLOR_BUFFER_BIT); 
-        glViewport(0, 0, winWidth, winHeight);
+        glCommands().ClearColor(0, 0, 0, 0);     
+        glCommands().Clear(GL_COLOR_BUFFER_BIT); 
+        glCommands().Viewport(0, 0, winWidth, winHeight);
         
         // MVP mátrix beállítása
         gpuProgram->setUniform(camera->getMVP(), "MVP");
@@ -573,13 +587,15 @@ public:
         track->Draw(gpuProgram);
         
         // Gondola kirajzolása
-        gondola->Draw(gpuProgram, camera->getMVP());
+        gondola->Draw(gpuProgram, camera->getMVP(), interpolationAlpha());
     }
     
     // Billentyűzet kezelése
     void onKeyboard(int key) {
-        if (key == ' ') { // SPACE
+        if (key == ' ' && gondola->getState() == WAITING) { // SPACE
             gondola->Start(); 
+            // Amíg gurul, folyamatos animáció kell
+            if (gondola->getState() == ROLLING) startAnimation();
             refreshScreen();
         }
     }
@@ -598,13 +614,12 @@ public:
         }
     }
     
-    // Idő változása
-    void onTimeElapsed(float tstart, float tend) { 
-        const float dt = 0.01; 
-        for (float t = tstart; t < tend; t += dt) {
-            float Dt = fmin(dt, tend - t);
-            gondola->Animate(Dt);
-        }
+    // Rögzített szimulációs lépés
+    void onSimulate(double dt) { 
+        if (gondola->getState() != ROLLING) return;
+        gondola->Animate((float)dt);
+        // Leesett, nincs több mozgás
+        if (gondola->getState() == FALLEN) stopAnimation();
         refreshScreen();
     }
     
@@ -0,0 +1,842 @@
+/*
+Tests of lodepng's SIMD code paths against the portable ones, and round trips of its deflate and inflate.
+lodepng.cpp is included directly to reach its static functions, build this file on its own: make test
+*/
+
+#include "lodepng.cpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static unsigned failures = 0;
+
+#define CHECK(condition, ...) do {\
+  if(!(condition)) {\
+    ++failures;\
+    if(failures <= 20) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); }\
+  }\
+} while(0)
+
+#if defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_ENCODER) && defined(LODEPNG_COMPILE_DECODER)
+#define TEST_ZLIB
+#endif
+
+#if defined(LODEPNG_X86_SIMD) || defined(TEST_ZLIB)
+static unsigned random_state = 0x12345678u;
+
+static unsigned randomNumber() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+static void randomBytes(std::vector<unsigned char>& v, size_t size) {
+  v.resize(size);
+  for(size_t i = 0; i != size; ++i) v[i] = (unsigned char)randomNumber();
+}
+#endif /*defined(LODEPNG_X86_SIMD) || defined(TEST_ZLIB)*/
+
+#ifdef LODEPNG_X86_SIMD
+/*the feature sets to compare with the portable code: what the CPU has, and narrower subsets of it*/
+static std::vector<unsigned> featureSets() {
+  unsigned all = lodepng_detect_cpu_features();
+  unsigned sets[4] = {all, all & ~LODEPNG_CPU_AVX2, all & (LODEPNG_CPU_SSE2 | LODEPNG_CPU_SSSE3), all & LODEPNG_CPU_SSE2};
+  std::vector<unsigned> result;
+  for(unsigned i = 0; i != 4; ++i) {
+    bool seen = sets[i] == 0;
+    for(unsigned j = 0; j != result.size(); ++j) seen = seen || result[j] == sets[i];
+    if(!seen) result.push_back(sets[i]);
+  }
+  return result;
+}
+
+/*unfilterScanline with the given features against the portable code, bytewidth 1-8, aliased and separate output*/
+static void testUnfilter(unsigned features) {
+  std::vector<unsigned char> scanline, precon, expected, actual;
+  for(size_t bytewidth = 1; bytewidth <= 8; ++bytewidth)
+  for(unsigned char type = 0; type <= 4; ++type)
+  for(unsigned round = 0; round != 200; ++round) {
+    size_t length = bytewidth * (round < 100 ? round + 1 : 1 + randomNumber() % 2000);
+    bool first = round % 7 == 0; /*no previous scanline*/
+    bool aliased = round % 2 == 0; /*recon and scanline the same memory, as when decoding in place*/
+    randomBytes(scanline, length);
+    randomBytes(precon, length);
+    const unsigned char* prev = first ? 0 : precon.data();
+
+    expected = scanline;
+    lodepng_cpu_feature_mask = 0;
+    unfilterScanline(expected.data(), expected.data(), prev, bytewidth, type, length);
+
+    lodepng_cpu_feature_mask = features;
+    if(aliased) {
+      actual = scanline;
+      unfilterScanline(actual.data(), actual.data(), prev, bytewidth, type, length);
+    } else {
+      actual.assign(length, 0);
+      unfilterScanline(actual.data(), scanline.data(), prev, bytewidth, type, length);
+    }
+    CHECK(actual == expected, "unfilter features %x bytewidth %u type %u length %u%s%s", features,
+          (unsigned)bytewidth, type, (unsigned)length, aliased ? " aliased" : "", first ? " first" : "");
+  }
+}
+
+#ifdef LODEPNG_COMPILE_CRC
+/*CRC32 with the given features against the tables, every length up to 2000 at odd offsets*/
+static void testCrc32(unsigned features) {
+  std::vector<unsigned char> data;
+  randomBytes(data, 2000 + 16);
+  for(size_t offset = 1; offset < 16; offset += 2)
+  for(size_t length = 0; length <= 2000; ++length) {
+    lodepng_cpu_feature_mask = 0;
+    unsigned expected = lodepng_crc32(&data[offset], length);
+    lodepng_cpu_feature_mask = features;
+    unsigned actual = lodepng_crc32(&data[offset], length);
+    CHECK(actual == expected, "crc32 features %x offset %u length %u", features, (unsigned)offset, (unsigned)length);
+  }
+}
+#endif /*LODEPNG_COMPILE_CRC*/
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*Adler-32 with the given features against the portable sums, every length up to 2000 at odd offsets and
+continuing a running value, then all-0xff buffers that make the block sums as large as they can get*/
+static void testAdler32(unsigned features) {
+  std::vector<unsigned char> data;
+  randomBytes(data, 2000 + 16);
+  for(size_t offset = 1; offset < 16; offset += 2)
+  for(size_t length = 0; length <= 2000; ++length) {
+    unsigned start = length % 3 ? 1u : (randomNumber() % 65521u) | ((randomNumber() % 65521u) << 16u);
+    lodepng_cpu_feature_mask = 0;
+    unsigned expected = update_adler32(start, &data[offset], (unsigned)length);
+    lodepng_cpu_feature_mask = features;
+    unsigned actual = update_adler32(start, &data[offset], (unsigned)length);
+    CHECK(actual == expected, "adler32 features %x offset %u length %u", features, (unsigned)offset,
+          (unsigned)length);
+  }
+  data.assign((size_t)1 << 24, 255);
+  for(unsigned length = 5550; length <= data.size(); length = length * 3 + 1) {
+    lodepng_cpu_feature_mask = 0;
+    unsigned expected = update_adler32(0xfff0fff0u, &data[1], length - 1);
+    lodepng_cpu_feature_mask = features;
+    unsigned actual = update_adler32(0xfff0fff0u, &data[1], length - 1);
+    CHECK(actual == expected, "adler32 features %x all 0xff length %u", features, length - 1);
+  }
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+struct ConvertPair {
+  LodePNGColorType in, out;
+  unsigned bitdepth; /*of the input, the output is 8-bit*/
+};
+
+/*the pairs getConvertKernel has kernels for*/
+static const ConvertPair convert_pairs[] = {
+  {LCT_RGB, LCT_RGBA, 8}, {LCT_RGBA, LCT_RGB, 8}, {LCT_GREY, LCT_RGBA, 8}, {LCT_GREY_ALPHA, LCT_RGBA, 8},
+  {LCT_RGBA, LCT_RGBA, 16}, {LCT_RGB, LCT_RGB, 16}, {LCT_PALETTE, LCT_RGBA, 8}, {LCT_PALETTE, LCT_RGBA, 4},
+  {LCT_PALETTE, LCT_RGBA, 2}, {LCT_PALETTE, LCT_RGBA, 1}
+};
+
+/*every conversion kernel the given features select against the generic code, with all tail widths*/
+static void testConvert(unsigned features) {
+  std::vector<unsigned char> in, expected, actual;
+  for(size_t p = 0; p != sizeof(convert_pairs) / sizeof(convert_pairs[0]); ++p) {
+    const ConvertPair& pair = convert_pairs[p];
+    LodePNGColorMode mode_in = lodepng_color_mode_make(pair.in, pair.bitdepth);
+    LodePNGColorMode mode_out = lodepng_color_mode_make(pair.out, 8);
+    for(unsigned round = 0; round != 200; ++round) {
+      size_t numpixels = round < 100 ? round : 1 + randomNumber() % 5000;
+      if(pair.in == LCT_PALETTE) {
+        /*sometimes fewer colors than the indices can reach, the rest of the palette stays zero*/
+        unsigned colors = 1 + randomNumber() % (1u << pair.bitdepth);
+        lodepng_palette_clear(&mode_in);
+        for(unsigned i = 0; i != colors; ++i) {
+          unsigned rgba = randomNumber();
+          lodepng_palette_add(&mode_in, rgba & 255, (rgba >> 8) & 255, (rgba >> 16) & 255, rgba >> 24);
+        }
+      }
+      randomBytes(in, lodepng_get_raw_size((unsigned)numpixels, 1, &mode_in));
+      size_t outsize = lodepng_get_raw_size((unsigned)numpixels, 1, &mode_out);
+      expected.assign(outsize, 0);
+      if(pair.out == LCT_RGBA) getPixelColorsRGBA8(expected.data(), numpixels, in.data(), &mode_in);
+      else getPixelColorsRGB8(expected.data(), numpixels, in.data(), &mode_in);
+
+      lodepng_cpu_feature_mask = features;
+      ConvertKernel kernel = getConvertKernel(&mode_out, &mode_in);
+      if(!kernel) break; /*not available with these features*/
+      actual.assign(outsize, 0);
+      kernel(actual.data(), in.data(), numpixels, &mode_in);
+      CHECK(actual == expected, "convert features %x colortype %d bitdepth %u to colortype %d, %u pixels", features,
+            (int)pair.in, pair.bitdepth, (int)pair.out, (unsigned)numpixels);
+    }
+    lodepng_color_mode_cleanup(&mode_in);
+    lodepng_color_mode_cleanup(&mode_out);
+  }
+}
+#endif /*LODEPNG_X86_SIMD*/
+
+#ifdef TEST_ZLIB
+/*data for deflate to chew on: random bytes, runs of one byte, short periods and copies from up to 32 KiB back
+that overlap themselves, so that inflate sees literal runs and every kind of match copy*/
+static void deflateInput(std::vector<unsigned char>& data, size_t size) {
+  data.clear();
+  while(data.size() < size) {
+    size_t length = 1 + randomNumber() % 300;
+    unsigned kind = randomNumber() % 5;
+    if(kind == 0 || data.empty()) {
+      for(size_t i = 0; i != length; ++i) data.push_back((unsigned char)randomNumber());
+    } else if(kind == 1) {
+      data.insert(data.end(), length, (unsigned char)randomNumber());
+    } else if(kind == 2) {
+      for(size_t i = 0; i != length; ++i) data.push_back((unsigned char)(randomNumber() & 7));
+    } else {
+      size_t distance = 1 + (kind == 3 ? randomNumber() % 8 : randomNumber() % 32768) % data.size();
+      for(size_t i = 0; i != length; ++i) data.push_back(data[data.size() - distance]);
+    }
+  }
+  data.resize(size);
+}
+
+static const LodePNGCompressLevel levels[4] = {LCL_DEFAULT, LCL_FAST, LCL_RLE, LCL_HUFFMAN_ONLY};
+
+/*inflate of what deflate made from it, for every block type and level. Then the same stream cut short at
+many points, which must fail: with 51 inside Huffman data, 49 to 52 in dynamic tree headers and between
+blocks, and 23 or 52 in stored blocks*/
+static void testInflate() {
+  static const size_t sizes[] = {0, 1, 2, 7, 100, 5000, 70000, 300000};
+  std::vector<unsigned char> data;
+  for(size_t s = 0; s != sizeof(sizes) / sizeof(sizes[0]); ++s)
+  for(unsigned btype = 0; btype <= 2; ++btype)
+  for(unsigned l = 0; l != (btype ? 4 : 1); ++l) {
+    deflateInput(data, sizes[s]);
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.btype = btype;
+    settings.level = levels[l];
+    unsigned char* deflated = 0;
+    size_t deflatedsize = 0;
+    unsigned error = lodepng_deflate(&deflated, &deflatedsize, data.data(), data.size(), &settings);
+    CHECK(!error, "deflate btype %u level %u size %u: error %u", btype, l, (unsigned)data.size(), error);
+
+    unsigned char* inflated = 0;
+    size_t inflatedsize = 0;
+    error = lodepng_inflate(&inflated, &inflatedsize, deflated, deflatedsize, &lodepng_default_decompress_settings);
+    CHECK(!error && inflatedsize == data.size() && (data.empty() || !memcmp(inflated, data.data(), data.size())),
+          "inflate btype %u level %u size %u: error %u", btype, l, (unsigned)data.size(), error);
+    lodepng_free(inflated);
+
+    for(unsigned round = 0; round != 64 && deflatedsize; ++round) {
+      size_t cut = round < 32 ? round % deflatedsize : randomNumber() % deflatedsize;
+      inflated = 0;
+      inflatedsize = 0;
+      error = lodepng_inflate(&inflated, &inflatedsize, deflated, cut, &lodepng_default_decompress_settings);
+      bool expected = btype == 0 ? error == 23 || error == 52
+                    : btype == 1 ? error == (cut ? 51u : 52u)
+                    : error >= 49 && error <= 52;
+      CHECK(expected, "inflate btype %u level %u size %u cut at %u of %u: error %u", btype, l,
+            (unsigned)data.size(), (unsigned)cut, (unsigned)deflatedsize, error);
+      lodepng_free(inflated);
+    }
+    lodepng_free(deflated);
+  }
+}
+
+#ifdef LODEPNG_THREADS
+/*the parallel deflate for every level and Huffman block type: its zlib stream must decompress to the input and be
+the same for any number of threads above 1, 0 being one per hardware thread. On data that repeats every 1000 bytes, the window primed before each
+chunk must keep the matches across the chunk borders, so that it is hardly larger than with 1 thread*/
+static void testDeflateThreads() {
+  static const unsigned threadcounts[4] = {1, 2, 3, 0};
+  std::vector<unsigned char> data, period;
+  randomBytes(period, 1000);
+  for(unsigned periodic = 0; periodic != 2; ++periodic)
+  for(unsigned btype = 1; btype <= 2; ++btype)
+  for(unsigned l = 0; l != 4; ++l) {
+    if(periodic) {
+      data.clear();
+      while(data.size() < 1000000) data.insert(data.end(), period.begin(), period.end());
+    } else {
+      deflateInput(data, 1000000);
+    }
+    std::vector<unsigned char> single, parallel;
+    for(unsigned t = 0; t != 4; ++t) {
+      LodePNGCompressSettings settings;
+      lodepng_compress_settings_init(&settings);
+      settings.btype = btype;
+      settings.level = levels[l];
+      settings.threads = threadcounts[t];
+      unsigned char* compressed = 0;
+      size_t compressedsize = 0;
+      unsigned error = lodepng_zlib_compress(&compressed, &compressedsize, data.data(), data.size(), &settings);
+      unsigned char* decompressed = 0;
+      size_t decompressedsize = 0;
+      if(!error) {
+        error = lodepng_zlib_decompress(&decompressed, &decompressedsize, compressed, compressedsize,
+                                        &lodepng_default_decompress_settings);
+      }
+      CHECK(!error && decompressedsize == data.size() && !memcmp(decompressed, data.data(), data.size()),
+            "zlib %s btype %u level %u threads %u: error %u", periodic ? "periodic" : "mixed", btype, l,
+            threadcounts[t], error);
+      unsigned threads = threadcounts[t] ? threadcounts[t] : std::thread::hardware_concurrency();
+      if(t == 0) {
+        single.assign(compressed, compressed + compressedsize);
+      } else if(t == 1) {
+        parallel.assign(compressed, compressed + compressedsize);
+        /*4 chunks, each a few bytes for the sync flush and a new block header*/
+        CHECK(!periodic || compressedsize < single.size() + 4 * 100, "zlib periodic btype %u level %u: %u bytes "
+              "with 2 threads, %u with 1", btype, l, (unsigned)compressedsize, (unsigned)single.size());
+      } else {
+        const std::vector<unsigned char>& expected = threads > 1 ? parallel : single;
+        CHECK(expected.size() == compressedsize && !memcmp(expected.data(), compressed, compressedsize),
+              "zlib %s btype %u level %u: output with %u threads differs from %u threads",
+              periodic ? "periodic" : "mixed", btype, l, threadcounts[t], threads > 1 ? 2 : 1);
+      }
+      lodepng_free(compressed);
+      lodepng_free(decompressed);
+    }
+  }
+}
+#endif /*LODEPNG_THREADS*/
+
+struct PngMode {
+  LodePNGColorType colortype;
+  unsigned bitdepth;
+};
+
+/*every color type and bit depth PNG allows*/
+static const PngMode png_modes[] = {
+  {LCT_GREY, 1}, {LCT_GREY, 2}, {LCT_GREY, 4}, {LCT_GREY, 8}, {LCT_GREY, 16}, {LCT_RGB, 8}, {LCT_RGB, 16},
+  {LCT_PALETTE, 1}, {LCT_PALETTE, 2}, {LCT_PALETTE, 4}, {LCT_PALETTE, 8}, {LCT_GREY_ALPHA, 8},
+  {LCT_GREY_ALPHA, 16}, {LCT_RGBA, 8}, {LCT_RGBA, 16}
+};
+
+/*a w by h PNG in the given mode, with a full palette so that every index is valid. The pixels are random with
+some rows repeated, so that the filters and deflate have something to find*/
+static void makePng(std::vector<unsigned char>& png, const PngMode& pngmode, unsigned w, unsigned h,
+                    unsigned interlace, unsigned btype) {
+  LodePNGState state;
+  lodepng_state_init(&state);
+  lodepng_state_cleanup(&state);
+  LodePNGColorMode mode = lodepng_color_mode_make(pngmode.colortype, pngmode.bitdepth);
+  if(pngmode.colortype == LCT_PALETTE) {
+    for(unsigned i = 0; i != (1u << pngmode.bitdepth); ++i) {
+      unsigned rgba = randomNumber();
+      lodepng_palette_add(&mode, rgba & 255, (rgba >> 8) & 255, (rgba >> 16) & 255, rgba >> 24);
+    }
+  }
+  lodepng_state_init(&state);
+  lodepng_color_mode_copy(&state.info_raw, &mode);
+  lodepng_color_mode_copy(&state.info_png.color, &mode);
+  state.encoder.auto_convert = 0;
+  state.info_png.interlace_method = interlace;
+  state.encoder.zlibsettings.btype = btype;
+  size_t linebytes = lodepng_get_raw_size(w, 1, &mode);
+  std::vector<unsigned char> raw, line;
+  for(unsigned y = 0; y != h; ++y) {
+    if(y == 0 || randomNumber() % 3) randomBytes(line, linebytes);
+    raw.insert(raw.end(), line.begin(), line.end());
+  }
+  /*rows of less than 8 bits per pixel are packed without padding in the input of the encoder*/
+  raw.resize(lodepng_get_raw_size(w, h, &mode));
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  unsigned error = lodepng_encode(&out, &outsize, raw.data(), w, h, &state);
+  CHECK(!error, "encode %ux%u colortype %d bitdepth %u: error %u", w, h, (int)pngmode.colortype, pngmode.bitdepth,
+        error);
+  png.assign(out, out + outsize);
+  lodepng_free(out);
+  lodepng_color_mode_cleanup(&mode);
+  lodepng_state_cleanup(&state);
+}
+
+/*row y of an image from lodepng_decode as the streaming decoder gives it: there rows of less than 8 bits per pixel
+are packed, here they start at a whole byte and the unused bits of their last byte are zero*/
+static void imageRow(std::vector<unsigned char>& row, const unsigned char* image, unsigned w, unsigned y,
+                     unsigned bpp) {
+  size_t bits = (size_t)w * bpp, start = bits * y;
+  row.assign((bits + 7) / 8, 0);
+  for(size_t i = 0; i != bits; ++i) {
+    unsigned bit = (image[(start + i) >> 3] >> (7 - ((start + i) & 7))) & 1;
+    row[i >> 3] |= (unsigned char)(bit << (7 - (i & 7)));
+  }
+}
+
+/*what the row callback received*/
+struct StreamRows {
+  std::vector<std::vector<unsigned char> > rows;
+  unsigned bpp, w, h;
+  unsigned abort_at; /*row at which the callback asks to stop*/
+  bool ordered; /*y counted up from 0, w and h stayed the same*/
+};
+
+static unsigned collectRow(void* user, const unsigned char* row, size_t rowsize, unsigned y, unsigned w, unsigned h) {
+  StreamRows* rows = (StreamRows*)user;
+  if(rows->rows.empty()) {
+    rows->w = w;
+    rows->h = h;
+  }
+  rows->ordered = rows->ordered && y == rows->rows.size() && w == rows->w && h == rows->h &&
+                  rowsize == ((size_t)w * rows->bpp + 7) / 8;
+  rows->rows.push_back(std::vector<unsigned char>(row, row + rowsize));
+  size_t bits = (size_t)w * rows->bpp;
+  if(bits & 7) rows->rows.back().back() &= (unsigned char)(0xff00u >> (bits & 7)); /*the unused bits*/
+  return y == rows->abort_at;
+}
+
+/*streams png through a decoder with state's settings, in pieces of size piece, or of random sizes if piece is 0.
+Returns the error of the push or of finish*/
+static unsigned streamDecode(StreamRows& rows, LodePNGState* state, const unsigned char* png, size_t pngsize,
+                             size_t piece, unsigned abort_at = ~0u) {
+  rows.rows.clear();
+  rows.bpp = state->decoder.color_convert ? lodepng_get_bpp(&state->info_raw) : 0;
+  rows.abort_at = abort_at;
+  rows.ordered = true;
+  LodePNGStreamDecoder* decoder = 0;
+  unsigned error = lodepng_stream_decoder_create(&decoder, state, collectRow, &rows);
+  if(!rows.bpp && !error) { /*the PNG's own color mode, known after the header*/
+    LodePNGState header;
+    unsigned w, h;
+    lodepng_state_init(&header);
+    lodepng_inspect(&w, &h, &header, png, pngsize);
+    rows.bpp = lodepng_get_bpp(&header.info_png.color);
+    lodepng_state_cleanup(&header);
+  }
+  for(size_t pos = 0; pos < pngsize && !error;) {
+    size_t size = piece ? piece : 1 + randomNumber() % 1000;
+    if(size > pngsize - pos) size = pngsize - pos;
+    error = lodepng_stream_decoder_push(decoder, png + pos, size);
+    pos += size;
+  }
+  if(!error) error = lodepng_stream_decoder_finish(decoder);
+  lodepng_stream_decoder_destroy(decoder);
+  return error;
+}
+
+/*the streamed rows against lodepng_decode with the same settings, the PNG pushed a byte at a time, in random
+pieces and whole, in its own color mode and converted to RGBA*/
+static void checkStreamRows(const std::vector<unsigned char>& png, const char* name) {
+  std::vector<unsigned char> expected;
+  StreamRows rows;
+  for(unsigned convert = 0; convert != 2; ++convert) {
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.decoder.color_convert = convert;
+    unsigned char* image = 0;
+    unsigned w = 0, h = 0;
+    unsigned error = lodepng_decode(&image, &w, &h, &state, png.data(), png.size());
+    CHECK(!error, "decode %s: error %u", name, error);
+    unsigned bpp = lodepng_get_bpp(convert ? &state.info_raw : &state.info_png.color);
+    static const size_t pieces[3] = {1, 0, (size_t)-1};
+    for(unsigned p = 0; p != 3 && !error; ++p) {
+      LodePNGState streamstate;
+      lodepng_state_init(&streamstate);
+      streamstate.decoder.color_convert = convert;
+      unsigned streamerror = streamDecode(rows, &streamstate, png.data(), png.size(), pieces[p]);
+      bool same = !streamerror && rows.ordered && rows.rows.size() == h && rows.w == w && rows.h == h;
+      for(unsigned y = 0; y != h && same; ++y) {
+        imageRow(expected, image, w, y, bpp);
+        same = rows.rows[y] == expected;
+      }
+      CHECK(same, "stream %s%s, pieces of %d: error %u, %u rows", name, convert ? " to RGBA" : "", (int)pieces[p],
+            streamerror, (unsigned)rows.rows.size());
+      lodepng_state_cleanup(&streamstate);
+    }
+    lodepng_free(image);
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*png with its image data cut in IDAT chunks of at most size bytes. first receives where the first of them starts,
+which is the same in png, and ends where each of them ends*/
+static void splitImageData(std::vector<unsigned char>& out, size_t& first, std::vector<size_t>& ends,
+                           const std::vector<unsigned char>& png, size_t size) {
+  const unsigned char* end = png.data() + png.size();
+  size_t resultsize = 8;
+  unsigned char* result = (unsigned char*)lodepng_malloc(resultsize);
+  memcpy(result, png.data(), 8); /*the signature*/
+  ends.clear();
+  for(const unsigned char* chunk = png.data() + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end)) {
+    if(!lodepng_chunk_type_equals(chunk, "IDAT")) {
+      lodepng_chunk_append(&result, &resultsize, chunk);
+      continue;
+    }
+    if(ends.empty()) first = resultsize;
+    const unsigned char* data = lodepng_chunk_data_const(chunk);
+    for(size_t pos = 0, length = lodepng_chunk_length(chunk); pos < length; pos += size) {
+      lodepng_chunk_create(&result, &resultsize, (unsigned)(length - pos < size ? length - pos : size), "IDAT",
+                           data + pos);
+      ends.push_back(resultsize);
+    }
+  }
+  out.assign(result, result + resultsize);
+  lodepng_free(result);
+}
+
+/*callback abort gives 116. A cut off file gives 48 or 27 in the header and 30 after it. With ignore_end, a file that
+ends between IDAT chunks gives 52, one cut inside an IDAT chunk fails with inflate's error for the missing data,
+and the rows given before are right. A broken IDAT gives 57 unless CRCs are ignored*/
+static void checkStreamErrors(const std::vector<unsigned char>& png, const char* name) {
+  StreamRows rows;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  unsigned char* image = 0;
+  unsigned w = 0, h = 0;
+  lodepng_decode(&image, &w, &h, &state, png.data(), png.size());
+  unsigned bpp = lodepng_get_bpp(&state.info_raw);
+  lodepng_state_cleanup(&state);
+  lodepng_state_init(&state);
+  unsigned error = streamDecode(rows, &state, png.data(), png.size(), 0, h / 2);
+  CHECK(error == 116 && rows.rows.size() == h / 2 + 1, "stream %s, abort at row %u: error %u, %u rows", name, h / 2,
+        error, (unsigned)rows.rows.size());
+  lodepng_state_cleanup(&state);
+
+  std::vector<unsigned char> split, expected;
+  std::vector<size_t> ends;
+  size_t first = 0;
+  splitImageData(split, first, ends, png, 1 + randomNumber() % 100);
+  for(unsigned round = 0; round != 8; ++round) {
+    size_t cut = round == 0 ? 0 : round == 1 ? 20 : randomNumber() % ends.back();
+    lodepng_state_init(&state);
+    error = streamDecode(rows, &state, split.data(), cut, 0);
+    CHECK(error == (cut == 0 ? 48u : cut < 33 ? 27u : 30u), "stream %s cut at %u: error %u", name, (unsigned)cut,
+          error);
+    lodepng_state_cleanup(&state);
+
+    /*at the end of an IDAT chunk other than the last, or anywhere in the image data*/
+    if(round & 1 && ends.size() > 1) cut = ends[randomNumber() % (ends.size() - 1)];
+    else cut = first + randomNumber() % (ends.back() - 4 - first); /*not in the CRC of the last, all data is there*/
+    bool between = false;
+    for(size_t i = 0; i + 1 < ends.size(); ++i) between = between || cut == ends[i];
+    lodepng_state_init(&state);
+    state.decoder.ignore_end = 1;
+    error = streamDecode(rows, &state, split.data(), cut, 0);
+    unsigned char* partial = 0;
+    unsigned decodeerror = lodepng_decode(&partial, &w, &h, &state, split.data(), cut);
+    lodepng_free(partial);
+    bool prefix = rows.rows.size() <= h;
+    for(unsigned y = 0; y != rows.rows.size() && prefix; ++y) {
+      imageRow(expected, image, w, y, bpp);
+      prefix = rows.rows[y] == expected;
+    }
+    CHECK(error && (!between || error == decodeerror), "stream %s cut at %u%s, ignore_end: error %u, lodepng_decode %u",
+          name, (unsigned)cut, between ? " between IDAT chunks" : " in an IDAT chunk", error, decodeerror);
+    CHECK(prefix, "stream %s cut at %u, ignore_end: %u wrong rows", name, (unsigned)cut, (unsigned)rows.rows.size());
+    lodepng_state_cleanup(&state);
+  }
+  lodepng_free(image);
+
+  std::vector<unsigned char> broken = png;
+  broken[first + 8 + randomNumber() % lodepng_chunk_length(&broken[first])] ^= (unsigned char)(1u << (randomNumber() % 8));
+  for(unsigned ignore = 0; ignore != 2; ++ignore) {
+    lodepng_state_init(&state);
+    state.decoder.ignore_crc = ignore;
+    error = streamDecode(rows, &state, broken.data(), broken.size(), 0);
+    CHECK(ignore ? error != 57 : error == 57, "stream %s with a broken IDAT%s: error %u", name,
+          ignore ? ", ignore_crc" : "", error);
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*lodepng_decode_into with the state's settings against lodepng_decode: rows at a pitch with padding, whose bytes
+stay untouched like those after the last row, and 117 without any write when the pitch or the buffer is one byte
+short*/
+static void checkDecodeInto(const std::vector<unsigned char>& png, const LodePNGState& settings, const char* name) {
+  LodePNGState state;
+  lodepng_state_init(&state);
+  lodepng_state_copy(&state, &settings);
+  unsigned char* image = 0;
+  unsigned w = 0, h = 0;
+  unsigned error = lodepng_decode(&image, &w, &h, &state, png.data(), png.size());
+  CHECK(!error, "decode %s: error %u", name, error);
+  unsigned bpp = lodepng_get_bpp(state.decoder.color_convert ? &state.info_raw : &state.info_png.color);
+  size_t rowsize = ((size_t)w * bpp + 7) / 8;
+  std::vector<unsigned char> buffer, expected, row;
+  for(unsigned round = 0; round != 4 && !error; ++round) {
+    /*a tight pitch, a padded one, then one byte too little pitch or buffer*/
+    size_t pitch = round == 0 || round == 2 ? rowsize : rowsize + 1 + randomNumber() % 13;
+    if(round == 2) --pitch;
+    size_t size = pitch * (h - 1) + rowsize - (round == 3);
+    buffer.assign(size + 16, 0xa5);
+    lodepng_state_cleanup(&state);
+    lodepng_state_init(&state);
+    lodepng_state_copy(&state, &settings);
+    unsigned intoerror = lodepng_decode_into(buffer.data(), size, pitch, &w, &h, &state, png.data(), png.size());
+    if(round >= 2) {
+      bool untouched = true;
+      for(size_t i = 0; i != buffer.size(); ++i) untouched = untouched && buffer[i] == 0xa5;
+      CHECK(intoerror == 117 && untouched, "decode_into %s with one byte too little %s: error %u%s", name,
+            round == 2 ? "pitch" : "buffer", intoerror, untouched ? "" : ", written");
+      continue;
+    }
+    bool same = !intoerror;
+    for(unsigned y = 0; y != h && same; ++y) {
+      imageRow(expected, image, w, y, bpp);
+      row.assign(&buffer[y * pitch], &buffer[y * pitch] + rowsize);
+      if((w * bpp) & 7) row.back() &= (unsigned char)(0xff00u >> ((w * bpp) & 7)); /*the unused bits*/
+      same = row == expected;
+      for(size_t i = rowsize; i < pitch && y + 1 != h; ++i) same = same && buffer[y * pitch + i] == 0xa5;
+    }
+    for(size_t i = size; i != buffer.size(); ++i) same = same && buffer[i] == 0xa5;
+    CHECK(same, "decode_into %s, pitch %u for rows of %u: error %u", name, (unsigned)pitch, (unsigned)rowsize,
+          intoerror);
+  }
+  lodepng_free(image);
+  lodepng_state_cleanup(&state);
+}
+
+/*lodepng_decode_into in the PNG's own color mode and converted, lodepng_decode_memory_into against
+lodepng_decode_memory*/
+static void testDecodeInto() {
+  static const PngMode outputs[] = {{LCT_RGBA, 8}, {LCT_RGB, 8}, {LCT_RGBA, 16}, {LCT_GREY_ALPHA, 8}};
+  std::vector<unsigned char> png;
+  char name[100];
+  for(size_t m = 0; m != sizeof(png_modes) / sizeof(png_modes[0]); ++m)
+  for(unsigned interlace = 0; interlace != 2; ++interlace) {
+    unsigned w = 1 + randomNumber() % 40, h = 1 + randomNumber() % 40;
+    makePng(png, png_modes[m], w, h, interlace, 2);
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.decoder.color_convert = 0;
+    snprintf(name, sizeof(name), "%ux%u colortype %d bitdepth %u interlace %u", w, h, (int)png_modes[m].colortype,
+             png_modes[m].bitdepth, interlace);
+    checkDecodeInto(png, state, name);
+    state.decoder.color_convert = 1;
+    for(size_t o = 0; o != sizeof(outputs) / sizeof(outputs[0]); ++o) {
+      /*grey output only from grey input*/
+      if(outputs[o].colortype == LCT_GREY_ALPHA && png_modes[m].colortype != LCT_GREY) continue;
+      state.info_raw.colortype = outputs[o].colortype;
+      state.info_raw.bitdepth = outputs[o].bitdepth;
+      snprintf(name, sizeof(name), "%ux%u colortype %d bitdepth %u interlace %u to colortype %d bitdepth %u", w, h,
+               (int)png_modes[m].colortype, png_modes[m].bitdepth, interlace, (int)outputs[o].colortype,
+               outputs[o].bitdepth);
+      checkDecodeInto(png, state, name);
+
+      unsigned char* image = 0;
+      unsigned error = lodepng_decode_memory(&image, &w, &h, png.data(), png.size(), outputs[o].colortype,
+                                             outputs[o].bitdepth);
+      size_t pitch = lodepng_get_raw_size(w, 1, &state.info_raw) + 3;
+      std::vector<unsigned char> buffer(pitch * h, 0);
+      unsigned intoerror = lodepng_decode_memory_into(buffer.data(), buffer.size(), pitch, &w, &h, png.data(),
+                                                      png.size(), outputs[o].colortype, outputs[o].bitdepth);
+      bool same = !error && !intoerror;
+      for(unsigned y = 0; y != h && same; ++y) {
+        size_t rowsize = pitch - 3;
+        same = !memcmp(&buffer[y * pitch], image + y * rowsize, rowsize);
+      }
+      CHECK(same, "decode_memory_into %s: error %u, lodepng_decode_memory %u", name, intoerror, error);
+      lodepng_free(image);
+    }
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*the pixels at (x * scale, y * scale) of an image from lodepng_decode, in rows that each start at a whole byte like
+those of lodepng_decode_preview*/
+static void samplePixels(std::vector<unsigned char>& out, const unsigned char* image, unsigned w, unsigned h,
+                         unsigned bpp, unsigned scale) {
+  unsigned pw = (w + scale - 1) / scale, ph = (h + scale - 1) / scale;
+  size_t rowbytes = ((size_t)pw * bpp + 7) / 8;
+  out.assign(rowbytes * ph, 0);
+  for(unsigned y = 0; y != ph; ++y)
+  for(unsigned x = 0; x != pw; ++x)
+  for(unsigned b = 0; b != bpp; ++b) {
+    size_t in = ((size_t)y * scale * w + (size_t)x * scale) * bpp + b;
+    size_t o = y * rowbytes * 8 + (size_t)x * bpp + b;
+    if((image[in >> 3] >> (7 - (in & 7))) & 1) out[o >> 3] |= (unsigned char)(0x80u >> (o & 7));
+  }
+}
+
+/*lodepng_decode_preview at scales 2, 4 and 8 against the sampled pixels of lodepng_decode, in the PNG's own color
+mode and converted to RGBA. An interlaced file also gives the preview when it is cut off after its Adam7 passes:
+before the Adler-32 of the zlib data, and for stored blocks right after the last byte of the passes, where one byte
+less fails*/
+static void checkPreview(const std::vector<unsigned char>& png, unsigned interlace, unsigned btype,
+                         const char* name) {
+  std::vector<unsigned char> expected;
+  /*lodepng writes all image data in one IDAT chunk*/
+  const unsigned char* idat = lodepng_chunk_find_const(png.data() + 8, png.data() + png.size(), "IDAT");
+  size_t data = idat ? (size_t)(lodepng_chunk_data_const(idat) - png.data()) : 0;
+  size_t datasize = idat ? lodepng_chunk_length(idat) : 0;
+  CHECK(idat && !lodepng_chunk_find_const(lodepng_chunk_next_const(idat, png.data() + png.size()),
+                                          png.data() + png.size(), "IDAT"), "preview %s: not one IDAT", name);
+  for(unsigned convert = 0; convert != 2 && idat; ++convert) {
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.decoder.color_convert = convert;
+    unsigned char* image = 0;
+    unsigned w = 0, h = 0;
+    unsigned error = lodepng_decode(&image, &w, &h, &state, png.data(), png.size());
+    CHECK(!error, "decode %s: error %u", name, error);
+    unsigned bpp = lodepng_get_bpp(&state.info_png.color);
+    for(unsigned scale = 2; scale <= 8 && !error; scale *= 2) {
+      samplePixels(expected, image, w, h, convert ? lodepng_get_bpp(&state.info_raw) : bpp, scale);
+      size_t sizes[4] = {png.size(), data + datasize - 4, 0, 0};
+      unsigned numsizes = interlace ? 2 : 1;
+      if(interlace && btype == 0) {
+        /*the zlib header, then 5 bytes in front of each stored block of up to 65535 bytes*/
+        unsigned passw[7], passh[7];
+        size_t filter_passstart[8], padded_passstart[8], passstart[8];
+        Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+        size_t prefix = filter_passstart[scale == 8 ? 1 : scale == 4 ? 3 : 5];
+        sizes[2] = data + 2 + prefix + (prefix + 65534) / 65535 * 5;
+        sizes[3] = sizes[2] - 1;
+        numsizes = 4;
+      }
+      for(unsigned cut = 0; cut != numsizes; ++cut) {
+        LodePNGState previewstate;
+        lodepng_state_init(&previewstate);
+        previewstate.decoder.color_convert = convert;
+        unsigned char* preview = 0;
+        unsigned pw = 0, ph = 0;
+        unsigned previewerror = lodepng_decode_preview(&preview, &pw, &ph, scale, &previewstate, png.data(),
+                                                       sizes[cut]);
+        if(cut == 3) {
+          CHECK(previewerror == 30, "preview %s%s scale %u cut at %u of %u bytes: error %u", name,
+                convert ? " to RGBA" : "", scale, (unsigned)sizes[cut], (unsigned)png.size(), previewerror);
+        } else {
+          bool same = !previewerror && pw == (w + scale - 1) / scale && ph == (h + scale - 1) / scale &&
+                      std::vector<unsigned char>(preview, preview + expected.size()) == expected;
+          CHECK(same, "preview %s%s scale %u cut at %u of %u bytes: error %u, %ux%u", name, convert ? " to RGBA" : "",
+                scale, (unsigned)sizes[cut], (unsigned)png.size(), previewerror, pw, ph);
+        }
+        lodepng_free(preview);
+        lodepng_state_cleanup(&previewstate);
+      }
+    }
+    lodepng_free(image);
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*the streaming decoder and previews for every color type, bit depth, interlace method and block type*/
+static void testStreamDecoder() {
+  std::vector<unsigned char> png;
+  char name[100];
+  for(size_t m = 0; m != sizeof(png_modes) / sizeof(png_modes[0]); ++m)
+  for(unsigned interlace = 0; interlace != 2; ++interlace)
+  for(unsigned btype = 0; btype <= 2; ++btype) {
+    /*a few sizes, one large enough for several deflate blocks*/
+    for(unsigned round = 0; round != 3; ++round) {
+      unsigned w = round == 0 ? 1 + randomNumber() % 8 : round == 1 ? 9 + randomNumber() % 40 : 300;
+      unsigned h = round == 0 ? 1 + randomNumber() % 8 : round == 1 ? 9 + randomNumber() % 40 : 200;
+      makePng(png, png_modes[m], w, h, interlace, btype);
+      snprintf(name, sizeof(name), "%ux%u colortype %d bitdepth %u interlace %u btype %u", w, h,
+               (int)png_modes[m].colortype, png_modes[m].bitdepth, interlace, btype);
+      checkStreamRows(png, name);
+      checkPreview(png, interlace, btype, name);
+      if(round == 1) checkStreamErrors(png, name);
+    }
+  }
+}
+
+static const LodePNGFilterStrategy filter_strategies[] = {
+  LFS_ZERO, LFS_ONE, LFS_TWO, LFS_THREE, LFS_FOUR, LFS_MINSUM, LFS_ENTROPY, LFS_BRUTE_FORCE, LFS_PREDEFINED
+};
+
+/*rows for filter to choose between: random, repeated, or the row above with small changes, so that every filter
+type gets picked and the adaptive strategies see close scores*/
+static void filterInput(std::vector<unsigned char>& in, size_t linebytes, unsigned h) {
+  in.resize(linebytes * h);
+  for(unsigned y = 0; y != h; ++y) {
+    unsigned char* row = &in[y * linebytes];
+    unsigned kind = y == 0 ? 0 : randomNumber() % 3;
+    for(size_t i = 0; i != linebytes; ++i) {
+      if(kind == 0) row[i] = (unsigned char)randomNumber();
+      else if(kind == 1) row[i] = row[i - linebytes];
+      else row[i] = (unsigned char)(row[i - linebytes] + randomNumber() % 5 - 2);
+    }
+  }
+}
+
+/*filter with every strategy, color type, bit depth and a range of widths, for each of the given feature sets with
+1, 3 and 0 threads, against the portable code on one thread. The tall images have several bands for the threads*/
+static void testFilter(const std::vector<unsigned>& sets) {
+  static const unsigned threads[3] = {1, 3, 0};
+  std::vector<unsigned char> in, predefined, expected, actual;
+  for(size_t m = 0; m != sizeof(png_modes) / sizeof(png_modes[0]); ++m)
+  for(unsigned round = 0; round != 30; ++round) {
+    LodePNGColorMode mode = lodepng_color_mode_make(png_modes[m].colortype, png_modes[m].bitdepth);
+    unsigned bpp = lodepng_get_bpp(&mode);
+    /*widths 1 to 20, around 32, 64 and 96 for the 16 and 32 byte vectors, then a random one of 500 to 2000 bytes
+    per row that is tall enough for 3 to 4 bands of 64 KiB. Brute force deflates every row, so not narrower*/
+    unsigned w = round < 20 ? round + 1 : round < 29 ? 31 + (round - 20) / 3 * 32 + round % 3
+                                                     : (500 + randomNumber() % 1500) * 8 / bpp;
+    size_t linebytes = ((size_t)w * bpp + 7u) / 8u;
+    unsigned h = round < 29 ? 1 + randomNumber() % 6 : (unsigned)(3 * 65536 / (linebytes + 1) + randomNumber() % 64);
+    filterInput(in, linebytes, h);
+    randomBytes(predefined, h);
+    for(unsigned y = 0; y != h; ++y) predefined[y] %= 5;
+    for(size_t s = 0; s != sizeof(filter_strategies) / sizeof(filter_strategies[0]); ++s) {
+      /*brute force deflates each row 5 times, the bands of a tall image only need a few of the color types*/
+      if(round == 29 && filter_strategies[s] == LFS_BRUTE_FORCE && m % 5 != 0) continue;
+      LodePNGEncoderSettings settings;
+      lodepng_encoder_settings_init(&settings);
+      settings.filter_strategy = filter_strategies[s];
+      settings.filter_palette_zero = 0;
+      settings.predefined_filters = predefined.data();
+      expected.assign(h * (linebytes + 1), 0);
+#ifdef LODEPNG_X86_SIMD
+      lodepng_cpu_feature_mask = 0;
+#endif /*LODEPNG_X86_SIMD*/
+      unsigned error = filter(expected.data(), in.data(), w, h, &mode, &settings);
+      CHECK(!error, "filter strategy %d colortype %d bitdepth %u width %u: error %u", (int)filter_strategies[s],
+            (int)mode.colortype, mode.bitdepth, w, error);
+      for(size_t f = 0; f != sets.size(); ++f)
+      for(unsigned t = 0; t != 3; ++t) {
+#ifdef LODEPNG_X86_SIMD
+        lodepng_cpu_feature_mask = sets[f];
+#endif /*LODEPNG_X86_SIMD*/
+        settings.zlibsettings.threads = threads[t];
+        actual.assign(h * (linebytes + 1), 0);
+        error = filter(actual.data(), in.data(), w, h, &mode, &settings);
+        CHECK(!error && actual == expected, "filter features %x threads %u strategy %d colortype %d bitdepth %u "
+              "%ux%u: error %u", sets[f], threads[t], (int)filter_strategies[s], (int)mode.colortype, mode.bitdepth,
+              w, h, error);
+      }
+    }
+    lodepng_color_mode_cleanup(&mode);
+  }
+#ifdef LODEPNG_X86_SIMD
+  lodepng_cpu_feature_mask = ~0u;
+#endif /*LODEPNG_X86_SIMD*/
+}
+#endif /*TEST_ZLIB*/
+
+int main() {
+#ifdef LODEPNG_X86_SIMD
+  std::vector<unsigned> sets = featureSets();
+  for(size_t i = 0; i != sets.size(); ++i) {
+    printf("features %x\n", sets[i]);
+    testUnfilter(sets[i]);
+#ifdef LODEPNG_COMPILE_CRC
+    testCrc32(sets[i]);
+#endif /*LODEPNG_COMPILE_CRC*/
+#ifdef LODEPNG_COMPILE_ZLIB
+    testAdler32(sets[i]);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+    testConvert(sets[i]);
+  }
+  lodepng_cpu_feature_mask = ~0u;
+#else
+  printf("no SIMD code in this build, nothing to compare\n");
+#endif /*LODEPNG_X86_SIMD*/
+#ifdef TEST_ZLIB
+  printf("deflate and inflate\n");
+  testInflate();
+#ifdef LODEPNG_THREADS
+  testDeflateThreads();
+#endif /*LODEPNG_THREADS*/
+  printf("streaming decoder\n");
+  testStreamDecoder();
+  printf("decode into caller memory\n");
+  testDecodeInto();
+  printf("filter strategies\n");
+#ifdef LODEPNG_X86_SIMD
+  testFilter(sets);
+#else
+  testFilter(std::vector<unsigned>(1, 0u));
+#endif /*LODEPNG_X86_SIMD*/
+#endif /*TEST_ZLIB*/
+  printf("%s (%u failures)\n", failures ? "FAILED" : "ok", failures);
+  return failures ? 1 : 0;
+}
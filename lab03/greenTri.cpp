@@ -1,19 +1,14 @@
 #include "./framework.h"
 
-const char* fragmentSource = R"(
+const char* shaderHeader = R"(
    #version 330
     precision highp float;
+)";
 
-    uniform sampler2D textureUnit;
-    uniform int objectType;      
-    uniform vec3 color;          
-
+const char* dayNightSource = R"(
     uniform int currentHour;        
     uniform float axisTilt;    
 
-    in vec2 texCoord;         
-    out vec4 fragmentColor;
-
     const float PI = 3.14159265359;
 
     bool isDaytime(vec2 mercator) {
@@ -44,6 +39,15 @@ const char* fragmentSource = R"(
     
         return illumination > 0.0;
     }
+)";
+
+const char* fragmentSource = R"(
+    uniform sampler2D textureUnit;
+    uniform int objectType;      
+    uniform vec3 color;          
+
+    in vec2 texCoord;         
+    out vec4 fragmentColor;
 
     void main() {
         if (objectType == 0) {
@@ -56,12 +60,35 @@ const char* fragmentSource = R"(
             } else {
                 fragmentColor = texColor;
             }
+        } else if (objectType == 3) {   // tárolt térképréteg
+            fragmentColor = texture(textureUnit, texCoord);
         } else {
             fragmentColor = vec4(color, 1.0);
         }
     }
 )";
 
+// nagy felbontású térkép virtuális textúrából
+const char* virtualMapSource = R"(
+    in vec2 texCoord;
+    out vec4 fragmentColor;
+
+    void main() {
+        vec4 texColor = vtSample(texCoord);
+        fragmentColor = isDaytime(texCoord) ? texColor : vec4(texColor.rgb * 0.5, texColor.a);
+    }
+)";
+
+// látható csempék kigyűjtése a virtuális textúrához
+const char* feedbackSource = R"(
+    in vec2 texCoord;
+    out vec4 fragmentColor;
+
+    void main() {
+        fragmentColor = vtFeedback(texCoord);
+    }
+)";
+
 const char* vertexSource = R"(
     #version 330
     precision highp float;
@@ -81,6 +108,8 @@ const char* vertexSource = R"(
 
 const int winWidth = 600, winHeight = 600;
 const int textureWidth = 64, textureHeight = 64;
+const char* mapTileDir = "map_tiles";   // ha létezik, innen jön a térkép
+const char* mapImage = "map.png";       // különben ez, ha létezik, előnézettel kezdve
 const float PI = 3.14159265359f;
 
 const float EARTH_RADIUS = 6371.0f;
@@ -240,6 +269,19 @@ class Map : public Object {
 private:
     unsigned int textureId;
     std::vector<vec4> decodedImage;
+    VirtualTexture* virtualTexture = nullptr;
+    Texture* mapTexture = nullptr;   // a mapImage kép
+    bool previewOnly = false;        // még csak a 8-szor kisebb előnézete van a GPU-n
+    GPUProgram* virtualProgram = nullptr;
+    GPUProgram* feedbackProgram = nullptr;
+    RenderTarget* layer = nullptr;   // az árnyalt térkép, amíg nem változik
+    bool layerDirty = true;
+    int layerHour = -1;
+
+    void setMapUniforms(GPUProgram* program) {
+        program->Use();
+        program->setUniform(mat4(1.0f), "MVP");
+    }
 
 public:
     Map() {
@@ -270,6 +312,53 @@ public:
         
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        layer = renderTargets().Acquire(winWidth, winHeight, GL_RGBA8, false);
+
+        if (fs::is_directory(mapTileDir)) {
+            virtualTexture = new VirtualTexture(mapTileDir);
+            std::string header = std::string(shaderHeader) + VirtualTexture::shaderSource;
+            virtualProgram = new GPUProgram(vertexSource, (header + dayNightSource + virtualMapSource).c_str());
+            feedbackProgram = new GPUProgram(vertexSource, (header + feedbackSource).c_str());
+        } else if (fs::is_regular_file(mapImage)) {
+            mapTexture = new Texture(mapImage, false, GL_LINEAR, 8);
+            previewOnly = true;
+        }
+    }
+
+    // Látható csempék felderítése, a rajzolás előtt
+    void DrawFeedback() {
+        if (!virtualTexture || !LayerDirty()) return;
+
+        virtualTexture->BeginFeedback(feedbackProgram);
+        setMapUniforms(feedbackProgram);
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        virtualTexture->EndFeedback();
+    }
+
+    // Csempék betöltése a háttérből, illetve az előnézet cseréje a teljes
+    // képre, ha már kirajzoltuk; igaz ha újra kell rajzolni
+    bool Update() {
+        if (previewOnly && !layerDirty) {
+            mapTexture->Refine();   // ha nem sikerül, az előnézet marad
+            previewOnly = false;
+            layerDirty = true;
+            return true;
+        }
+        if (!virtualTexture || !virtualTexture->Update()) return false;
+        layerDirty = true;
+        return true;
+    }
+
+    // Újra kell-e rajzolni a tárolt réteget
+    bool LayerDirty() const {
+        return layerDirty || layerHour != currentHour;
+    }
+
+    // Van-e még betöltésre váró csempe vagy teljes kép
+    bool Streaming() {
+        return previewOnly || (virtualTexture && virtualTexture->Busy());
     }
 
     void DecodeImage() {
@@ -303,21 +392,61 @@ public:
         }
     }
 
+    // Az árnyalt térkép csak óraváltáskor vagy új csempéknél rajzolódik újra,
+    // egyébként a tárolt réteg kerül ki egyetlen textúrázott négyszöggel
     void Draw(GPUProgram* gpuProgram) override {
+        if (LayerDirty()) {
+            layer->Begin();
+            DrawShaded(gpuProgram);
+            layer->End();
+            layerDirty = false;
+            layerHour = currentHour;
+        }
+
+        gpuProgram->setUniform(3, "objectType");
+        gpuProgram->setUniform(0, "textureUnit");
+        layer->Bind(0);
+
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+
+    void DrawShaded(GPUProgram* gpuProgram) {
+        if (virtualTexture) {
+            setMapUniforms(virtualProgram);
+            virtualProgram->setUniform(currentHour, "currentHour");
+            virtualProgram->setUniform(AXIS_TILT, "axisTilt");
+            virtualTexture->Bind(virtualProgram, 0);
+
+            glBindVertexArray(vao);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            gpuProgram->Use();
+            return;
+        }
+
         gpuProgram->setUniform(0, "objectType");
 
         int samplerUnit = 0;
         gpuProgram->setUniform(samplerUnit, "textureUnit");
 
-        glActiveTexture(GL_TEXTURE0 + samplerUnit);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+        if (mapTexture) {
+            mapTexture->Bind(samplerUnit);
+        } else {
+            glActiveTexture(GL_TEXTURE0 + samplerUnit);
+            glBindTexture(GL_TEXTURE_2D, textureId);
+        }
 
         glBindVertexArray(vao);
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
     }
 
     ~Map() {
+        renderTargets().Release(layer);
         glDeleteTextures(1, &textureId);
+        delete virtualTexture;
+        delete mapTexture;
+        delete virtualProgram;
+        delete feedbackProgram;
     }
 };
 
@@ -433,6 +562,7 @@ class MercatorMapApp : public glApp {
     Path* path;
     std::vector<Station*> stations;
     GPUProgram* gpuProgram;
+    bool streaming = false;   // amíg csempék jönnek, folyamatosan frissítünk
 
 public:
     MercatorMapApp() : glApp("Mercator Map") {
@@ -444,12 +574,14 @@ public:
     void onInitialization() override {
         glViewport(0, 0, winWidth, winHeight);
 
-        gpuProgram = new GPUProgram(vertexSource, fragmentSource);
+        std::string fragmentCode = std::string(shaderHeader) + dayNightSource + fragmentSource;
+        gpuProgram = new GPUProgram(vertexSource, fragmentCode.c_str());
         map = new Map();
         path = new Path();
 
         currentHour = 0;  
 
+        gpuProgram->Use();   // a térkép programjai után ez legyen aktív
         gpuProgram->setUniform(currentHour, "currentHour");
         gpuProgram->setUniform(AXIS_TILT, "axisTilt");
 
@@ -458,6 +590,8 @@ public:
     }
 
     void onDisplay() override {
+        map->DrawFeedback();
+
         glClearColor(0, 0, 0, 0);
         glClear(GL_COLOR_BUFFER_BIT);
 
@@ -473,6 +607,21 @@ public:
         for (auto station : stations) {
             station->Draw(gpuProgram);
         }
+
+        if (!streaming && map->Streaming()) {
+            streaming = true;
+            startAnimation();
+        }
+    }
+
+    void onTimeElapsed(double startTime, double endTime) override {
+        if (map->Update()) {
+            refreshScreen();
+        }
+        if (streaming && !map->Streaming()) {
+            streaming = false;
+            stopAnimation();
+        }
     }
 
     void onKeyboard(int key) override {